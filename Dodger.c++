@@ -9,6 +9,25 @@
 #include <limits.h>  // For PATH_MAX (Standard C header for limits)
 #include <unistd.h>  // For readlink (Linux-specific)
 #include <set>       // For std::set to get unique usernames
+#include <chrono>    // For timing the headless simulation loop
+#include <cstdarg>   // For va_list in the simulation log hook
+#include <cstdint>   // For fixed-width integer types (tick counters, checksums)
+#include <cstdio>    // For printf/vsnprintf
+#include <cstring>   // For strcmp when parsing command-line arguments
+#include <atomic>    // For the profiler's lock-free sample ring
+#include <thread>    // For the background save thread
+#include <mutex>     // For handing save snapshots to the save thread
+#include <condition_variable> // For waking the save thread
+#include <fcntl.h>   // For open() when writing the save file (fsync needs a file descriptor)
+#include <cerrno>    // For errno when a write is interrupted
+#include <sys/stat.h> // For fstat when checking the profile store's size
+#include <malloc.h>  // For mallinfo2/malloc_trim in --bench-save (glibc)
+#include <dirent.h>  // For listing the replays in --verify-replays
+#include <ctime>     // For timestamping replay file names
+#include <deque>     // For the --tune work-stealing queues
+#ifdef DODGER_ALLOC_COUNT
+#include <new>       // For counting allocations in operator new (--selftest-frame-allocs)
+#endif
 
 // --- Game Constants (Global or passed around) ---
 // Changed to non-const so they can be updated on window resize/fullscreen toggle
@@ -33,7 +52,8 @@ enum GameState {
     GAME_STATE_GAME_OVER,
     GAME_STATE_ACHIEVEMENTS,       // Achievements display screen
     GAME_STATE_SELECT_ACHIEVEMENT_PROFILE, // New state: For assigning Portal achievement
-    GAME_STATE_TAMPERED            // New state for detected tampering
+    GAME_STATE_TAMPERED,           // New state for detected tampering
+    GAME_STATE_REPLAY              // Watching a recorded game (V on the game over screen, or --play-replay)
 };
 
 // --- Difficulty Settings Structure ---
@@ -50,57 +70,65 @@ enum TextAlignment {
     ALIGN_RIGHT
 };
 
-// --- Game Elements: Projectile Struct ---
-struct Projectile {
-    Rectangle rect; // x, y, width, height
-    float speed;
-    Vector2 velocity; // vx, vy
-    bool active;
-    bool is_player_shot; // True if shot by player, false if by obstacle
-    int bounces_remaining; // How many bounces left for the projectile before it starts wrapping
+// --- Game Elements: Projectile Pool ---
+// Projectiles are stored as a fixed-capacity pool laid out as one array per field (struct of arrays),
+// so the per-tick movement/bounce/wrap pass is a straight loop over floats the compiler can vectorize.
+// Slot i of every array belongs to the same projectile. Freed slots go on a free list and are reused
+// by the next spawn, so nothing is ever shifted or reallocated while playing.
+// All projectiles are PROJECTILE_SIZE x PROJECTILE_SIZE, so no per-projectile width/height is stored.
+// The movement pass works in fixed batches of PROJECTILE_BATCH slots, which GCC 12+ and clang vectorize
+// at plain -O2. The candidate pass reads the grid through a per-slot index, so it only vectorizes where
+// the target has gather instructions, e.g.:
+//   g++ -O2 -march=native Dodger.c++ -o Dodger-game -lraylib
+enum ProjectileFlags : uint32_t {
+    PROJECTILE_ACTIVE = 1u << 0,
+    PROJECTILE_PLAYER_SHOT = 1u << 1, // Set if shot by player, clear if by obstacle
+    PROJECTILE_STRESS = 1u << 2       // Spawned by --stress rather than by gameplay
+};
+
+const int PROJECTILE_BATCH = 8; // The arrays are padded to a multiple of this, see integrateProjectiles
+
+struct ProjectilePool {
+    int capacity = 0; // Slots that can be handed out; the arrays may be a little longer (padding)
+    int high_water = 0; // One past the highest slot handed out since the last clear; passes stop here
+    int live_count = 0;
+    int stress_count = 0; // How many of the live projectiles have PROJECTILE_STRESS set
+    std::vector<float> x;       // Top-left corner
+    std::vector<float> y;
+    std::vector<float> prev_x;  // Position at the start of the last simulation tick (for render interpolation)
+    std::vector<float> prev_y;
+    std::vector<float> vx;      // Velocity in pixels per tick (direction * speed)
+    std::vector<float> vy;
+    std::vector<int32_t> bounces_remaining; // How many bounces left before the projectile starts wrapping
+    std::vector<uint32_t> flags;            // ProjectileFlags
+    std::vector<uint32_t> candidate;        // Scratch: non-zero if the slot needs exact collision checks this tick
+    std::vector<int> free_slots;            // Stack of released slots below high_water
 };
 
 // --- Global Game Variables ---
 // Gameplay related
+// Note: the moving parts of a game (positions, timers, projectiles...) live in SimState below.
 Color obstacle_color = RED; // Using Raylib's predefined RED
-float obstacle_x;
-float obstacle_y;
 float obstacle_size = 50.0f;
-float obstacle_speed; // Will be set by difficulty
 
 Color player_color = GREEN; // Using Raylib's predefined GREEN
-float player_x;
-float player_y;
 float player_size = 50.0f;
-float player_speed; // Will be set by difficulty
 
-float player_vx = 0.0f; // Player velocity X (for normal movement)
-float player_vy = 0.0f; // Player velocity Y (for normal movement)
-float player_aim_angle = 0.0f; // New: Angle for player's aiming direction (in radians)
-
-float ai_target_x;
-float ai_target_y;
-int ai_reaction_timer = 0;
-int ai_reaction_delay; // Will be set by difficulty
-const int prediction_frames = 30;
+const int prediction_frames = 30; // How many ticks ahead the obstacle AI aims (the default for SimTuning)
 
 GameState current_game_state = GAME_STATE_USERNAME_INPUT; // Start with username input
 
 // Countdown
-const int FPS = 60; // Frames per second, used for countdown timing
+const int FPS = 60; // Frames per second, used for countdown timing (and the simulation tick rate)
 const int countdown_time_seconds = 3;
 int countdown_timer_frames = countdown_time_seconds * FPS;
 int current_countdown_frame;
 
-// Time tracking
-double start_time_s = 0.0; // Seconds since game start
-double elapsed_time_s = 0.0; // Total survival time in seconds
-double final_survival_time_s = 0.0;
-
 // High Score (Now persistent via file I/O)
-// Note: high_scores now stores only the current user's high score for the current difficulty.
-// Full high score data for all users/difficulties would require a more complex structure.
+// Note: high_scores holds the active profile's scores; every profile's are kept in HIGH_SCORES_BY_USER
+// and copied in by switchToProfile().
 std::map<std::string, double> high_scores; // Maps difficulty_mode to high score for current_username
+std::map<std::string, std::map<std::string, double>> HIGH_SCORES_BY_USER; // username -> difficulty_mode -> high score
 bool is_new_high_score = false; // Correct variable name
 
 // Difficulty Management
@@ -124,47 +152,170 @@ std::string last_active_username = "Guest"; // Stores the last username that was
 
 // File persistence
 const std::string SAVE_FILE_NAME = "dodger_data.json";
+const int SAVE_FILE_MAX_NESTING = 64; // Deeper unknown values make the save file malformed (instead of overflowing the stack)
+
+// Saving happens behind the game's back: saveGameData() copies what goes into the file into a
+// SaveSnapshot and hands it to a background thread. That thread waits SAVE_COALESCE_MS so a burst of
+// changes (several unlocks in one game, an unlock plus a profile switch...) becomes one write, then
+// writes a temp file, fsyncs it and renames it over the save file, so a crash mid-write leaves the old
+// file intact. The frame thread never waits on the disk. shutdownPersistence() writes anything pending.
+// A failed write goes back in the queue (merged under anything newer) and is retried after a backoff
+// that doubles up to SAVE_RETRY_MAX_MS; at shutdown it gets SAVE_SHUTDOWN_RETRIES more tries.
+const int SAVE_COALESCE_MS = 200;
+const int SAVE_RETRY_MIN_MS = 500;
+const int SAVE_RETRY_MAX_MS = 30000;
+const int SAVE_SHUTDOWN_RETRIES = 3;
+const size_t SAVE_UNLOCKS_RESERVE = 64; // Queued unlocks before the queue has to grow (see queueAchievementUnlock)
+
+// --- Binary Profile Store ---
+// Optional replacement for the JSON save once there are thousands of profiles. Turned on with
+// --binary-profiles (the JSON save is migrated on first use) and used automatically from then on,
+// whenever dodger_profiles.bin exists. Opening it reads only the header and the username index;
+// a profile's record is read the first time it's needed, and saving writes only the records that
+// changed, in place, instead of rewriting every profile.
+//
+// dodger_profiles.bin: ProfileStoreHeader, then one fixed-size ProfileRecord per profile in creation order.
+// dodger_profiles.idx: ProfileIndexHeader, then an open-addressing hash table (linear probing) mapping a
+//   username to its record. Updated slot by slot, rewritten when it grows, and rebuilt from the records
+//   if it's missing or doesn't match the record count (e.g. after a crash between the two writes).
+// Both files are native-endian; the magic and version reject anything else.
+// High scores are kept per difficulty mode, like the JSON save: the header names up to
+// PROFILE_STORE_MAX_MODES modes ("normal" first) and each record has a score slot per mode.
+const char PROFILE_STORE_MAGIC[8] = {'D', 'O', 'D', 'G', 'P', 'R', 'O', 'F'};
+const char PROFILE_INDEX_MAGIC[8] = {'D', 'O', 'D', 'G', 'I', 'D', 'X', '1'};
+const uint32_t PROFILE_STORE_VERSION = 2; // 2: per-mode high scores
+const int PROFILE_STORE_MAX_ACHIEVEMENTS = 64; // One bit each in ProfileRecord::achievement_bits
+const int PROFILE_STORE_MAX_MODES = 4;         // Score slots in ProfileRecord::high_scores
+const std::string PROFILE_STORE_FILE_NAME = "dodger_profiles.bin";
+const std::string PROFILE_INDEX_FILE_NAME = "dodger_profiles.idx";
+
+struct ProfileStoreHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_count;
+    char last_username[16];
+    uint32_t achievement_id_count;
+    uint32_t mode_count;
+    char achievement_ids[PROFILE_STORE_MAX_ACHIEVEMENTS][32]; // Bit i of a record means achievement_ids[i] is unlocked
+    char mode_names[PROFILE_STORE_MAX_MODES][16];             // Slot i of a record's high_scores is mode_names[i]
+};
+
+struct ProfileRecord {
+    char username[16]; // Up to MAX_USERNAME_LENGTH characters, zero padded
+    double high_scores[PROFILE_STORE_MAX_MODES];
+    uint32_t score_bits; // Bit i set if high_scores[i] holds a score
+    uint32_t reserved;
+    uint64_t achievement_bits;
+};
+
+struct ProfileIndexHeader {
+    char magic[8];
+    uint32_t capacity;     // Number of slots, a power of two
+    uint32_t record_count; // Must match the store's header, or the index is rebuilt
+};
+
+struct ProfileIndexEntry {
+    uint32_t record_plus_one; // 0 = empty slot
+    uint32_t name_hash;       // So probing only reads records whose name could match
+};
+
+struct ProfileStore {
+    bool enabled = false;
+    std::string path = PROFILE_STORE_FILE_NAME;
+    std::string index_path = PROFILE_INDEX_FILE_NAME;
+    int fd = -1;                          // Read-only, for loading records lazily
+    ProfileStoreHeader header = {};       // Including records not written yet
+    std::vector<ProfileIndexEntry> index; // Including entries not written yet
+    uint32_t index_used = 0;
+    std::map<std::string, uint32_t> loaded_records; // Record number of every profile loaded or created this session
+    std::set<std::string> dirty;          // Profiles changed since the last save (JSON saves use it too)
+    bool json_rewrite_pending = true;     // The next JSON snapshot copies every profile (after loading, say)
+    bool index_rewrite_pending = false;   // The index grew, so the next save rewrites all of it
+    std::vector<uint32_t> changed_index_slots;
+};
+ProfileStore profile_store;
+
+// Everything the save file holds
+struct SaveSnapshot {
+    std::string last_username;
+    double normal_high_score = 0.0;
+    // With the JSON save, only the profiles changed since the last save, unless every_profile is set.
+    // The save thread keeps the rest (PersistenceQueue::saved_profiles).
+    bool every_profile = false;
+    std::map<std::string, std::vector<std::string>> unlocked_achievements_by_user;
+    std::map<std::string, std::map<std::string, double>> high_scores_by_user;
+
+    // With the binary profile store, only what changed since the last save
+    bool binary = false;
+    std::string store_path;
+    std::string index_path;
+    ProfileStoreHeader store_header = {};
+    std::map<uint32_t, ProfileRecord> store_records;   // Record number -> new contents
+    bool store_index_rewrite = false;
+    std::vector<ProfileIndexEntry> store_index;        // The whole index, if store_index_rewrite
+    std::map<uint32_t, ProfileIndexEntry> store_index_updates; // Slot -> new entry otherwise
+};
+
+// An achievement unlocked mid-game, handed to the save thread instead of a snapshot (JSON save only)
+struct AchievementUnlockWrite {
+    std::string username;                   // At most MAX_USERNAME_LENGTH, so it fits std::string's own buffer
+    const std::string* achievement_id;      // Points into ALL_ACHIEVEMENTS, which doesn't change after startup
+};
+
+// A finished game's replay, written by the save thread like the save file
+struct ReplayWrite {
+    std::string directory;
+    std::string path;
+    std::string bytes;
+};
+
+struct PersistenceQueue {
+    std::thread worker;
+    std::mutex mutex;               // Only held to hand a snapshot over, never during I/O
+    std::condition_variable wake;
+    bool started = false;
+    bool stopping = false;
+    bool has_pending = false;
+    SaveSnapshot pending;           // Changes not written yet; newer snapshots are merged in
+    std::vector<ReplayWrite> pending_replays; // Replays not written yet, oldest first
+    std::vector<AchievementUnlockWrite> pending_unlocks; // Unlocks not written yet, newer than any full snapshot pending
+    uint64_t requests = 0;          // Snapshots handed over
+    uint64_t writes = 0;            // Save files actually written
+    uint64_t failures = 0;          // Writes that failed (and were queued again)
+    SaveSnapshot saved_profiles;    // Every profile, as last written to the JSON save; only the save thread touches it
+    std::string path = SAVE_FILE_NAME;
+    int injected_write_delay_ms = 0; // Simulated slow disk (--selftest-slow-io)
+    int injected_write_failures = 0; // Fail this many writes before touching the disk (--selftest-slow-io)
+};
+PersistenceQueue persistence;
 
 // Audio variables
 Music normal_music; // Renamed for normal game soundtrack (oiaa_oiaa.mp3)
 Music win_music;    // Renamed for win soundtrack (rat_dance_audio_only.mp3)
 
 // --- Projectile Variables ---
-std::vector<Projectile> projectiles;
 const float PROJECTILE_SPEED = 10.0f;
 const float PROJECTILE_SIZE = 10.0f;
 const float PLAYER_SHOOT_COOLDOWN = 0.5; // seconds for normal projectile
-double player_last_shot_time = -PLAYER_SHOOT_COOLDOWN; // Initialize to allow immediate first shot
 const int MAX_PROJECTILE_BOUNCES = 5; // Projectiles bounce 5 times, then wrap
+const float NEAR_MISS_MARGIN = 15.0f; // A "near miss" passes within this many pixels of a direct hit
 
 // --- Stun Mechanic Variables ---
-bool obstacle_is_stunned = false;
-double obstacle_stun_end_time = 0.0;
 const double OBSTACLE_STUN_DURATION = 3.0; // seconds obstacle is stunned
 const double PLAYER_STUN_SHOT_COOLDOWN = 5.0; // seconds cooldown for player's stun shot
-double player_last_stun_shot_time = -PLAYER_STUN_SHOT_COOLDOWN; // Initialize to allow immediate first stun shot
 
 // Player stun variables
-bool player_is_stunned = false;
-double player_stun_end_time = 0.0;
 const double PLAYER_STUN_DURATION = 2.0; // seconds player is stunned
 const double OBSTACLE_STUN_COOLDOWN = 5.0; // Cooldown for obstacle to stun player
-double obstacle_last_stun_time = -OBSTACLE_STUN_COOLDOWN; // Initialize to allow immediate first stun
 
 // --- Obstacle Shooting Variables ---
 const float OBSTACLE_PROJECTILE_SPEED = 8.0f; // Slower than player's
 const float OBSTACLE_SHOOT_COOLDOWN = 2.0; // Obstacle shoots every 2 seconds (re-introduced cooldown)
-double obstacle_last_shot_time = -OBSTACLE_SHOOT_COOLDOWN; // Initialize to allow immediate first shot
 
 // --- Player Dash Variables ---
-double player_last_dash_time = -2.0; // Initialize to allow immediate first dash (PLAYER_DASH_COOLDOWN)
 const double PLAYER_DASH_COOLDOWN = 2.0; // seconds
 const float PLAYER_DASH_DISTANCE = 150.0f; // Total distance of the dash
 const double PLAYER_DASH_DURATION = 0.15; // seconds (duration of the dash, for invincibility and movement)
-bool player_is_dashing = false;
-double player_dash_end_time = 0.0;
-float player_dash_velocity_x = 0.0f; // New: Velocity for dash movement
-float player_dash_velocity_y = 0.0f; // New: Velocity for dash movement
 
 // --- Anti-Tampering Variables ---
 // IMPORTANT: This checksum is for a specific, compiled executable.
@@ -194,19 +345,23 @@ const long long EXPECTED_CHECKSUM = 1234567890; // Placeholder - will need to be
 std::string nextGameMessage = ""; // Moved to global scope
 
 // --- Time Bonus Variables ---
-double dodge_streak_start_time = 0.0; // Time when the current dodge streak began
 const double DODGE_BONUS_INTERVAL = 10.0; // Every 10 seconds of continuous dodging
 const double DODGE_BONUS_AMOUNT = 1.0; // Add 1 second to time
-bool showing_time_bonus_message = false;
-double time_bonus_message_end_time = 0.0;
 const double TIME_BONUS_MESSAGE_DURATION = 1.0; // Duration for the "TIME BONUS" message
 
 // --- Achievement System Variables ---
+// Achievement ids are interned to small integers (AchievementId) when the definitions are set up or a
+// save mentions one. Everything that runs often (the simulation, unlock checks, the achievements screen)
+// works with those; the id strings only come back out for the save file, replays and the log.
+typedef uint16_t AchievementId;
+const AchievementId ACHIEVEMENT_NONE = UINT16_MAX;
+
 struct Achievement {
     std::string id;
     std::string name;
     std::string description;
     bool is_secret; // New: true if achievement should be hidden until unlocked
+    AchievementId index = ACHIEVEMENT_NONE; // Interned id, set by initializeAchievementDefinitions()
     // Constructor for easier initialization
     Achievement(std::string id, std::string name, std::string description, bool is_secret = false)
         : id(std::move(id)), name(std::move(name)), description(std::move(description)), is_secret(is_secret) {}
@@ -215,70 +370,815 @@ struct Achievement {
 // Global map of all possible achievements
 std::map<std::string, Achievement> ALL_ACHIEVEMENTS;
 
-// Global map to store which achievements are unlocked for each user
-// Key: username, Value: vector of unlocked achievement IDs
-std::map<std::string, std::vector<std::string>> UNLOCKED_ACHIEVEMENTS_BY_USER;
+// The intern table. Only grows, and only on the main thread, so other threads may read it while the
+// simulation runs (ids given out before they started stay valid).
+std::vector<std::string> ACHIEVEMENT_NAMES;           // AchievementId -> id string (defined, or just seen in a save)
+std::map<std::string, AchievementId> ACHIEVEMENT_IDS; // id string -> AchievementId
+std::vector<const Achievement*> ACHIEVEMENTS_BY_ID;   // AchievementId -> definition (nullptr if not defined)
+
+// A profile's unlocked achievements, one bit per AchievementId
+struct AchievementSet {
+    std::vector<uint64_t> words;
 
-// Game-specific flags for achievement tracking (reset per game)
-bool near_miss_achievement_unlocked_this_game = false;
-int obstacle_stuns_this_game = 0;
-bool has_shot_this_game = false; // To track if player has shot for "Bullet Ballet Master"
-bool dash_through_projectile_achievement_unlocked_this_game = false; // For "Dash of Genius"
+    bool contains(AchievementId id) const {
+        size_t word = id / 64;
+        return word < words.size() && ((words[word] >> (id % 64)) & 1) != 0;
+    }
+    // Returns false if it was already there
+    bool insert(AchievementId id) {
+        size_t word = id / 64;
+        if (word >= words.size()) {
+            words.resize(word + 1, 0);
+        }
+        uint64_t bit = (uint64_t)1 << (id % 64);
+        bool added = (words[word] & bit) == 0;
+        words[word] |= bit;
+        return added;
+    }
+};
+
+// Global map to store which achievements are unlocked for each user
+// Key: username, Value: the unlocked achievements
+std::map<std::string, AchievementSet> UNLOCKED_ACHIEVEMENTS_BY_USER;
 
 // Achievement popup display variables
-std::string current_achievement_popup_id = "";
+AchievementId current_achievement_popup = ACHIEVEMENT_NONE;
 double achievement_popup_display_end_time = 0.0;
 const double ACHIEVEMENT_POPUP_DURATION = 3.0; // seconds the popup is displayed
 
 // --- Portal Mode Variables ---
 bool is_portal_mode = false; // True if current_username is "PORTAL"
-bool portal_1_active = false;
-Vector2 portal_1_pos = {0,0};
-bool portal_2_active = false;
-Vector2 portal_2_pos = {0,0};
 const float PORTAL_RADIUS = 30.0f;
 const Color PORTAL_COLOR_1 = BLUE;
 const Color PORTAL_COLOR_2 = ORANGE;
-double last_teleport_time = 0.0;
 const double TELEPORT_COOLDOWN = 0.5; // seconds to prevent rapid teleporting
-
-// New variables for projectile-created portals
-double portal_active_until_time_1 = 0.0;
-double portal_active_until_time_2 = 0.0;
 const double PORTAL_ACTIVE_DURATION = 10.0; // seconds portals stay active
-bool next_projectile_portal_is_1 = true; // To toggle between placing portal 1 and 2
+
+// --- Simulation Core ---
+// All gameplay runs in stepSimulation() at a fixed rate of FPS ticks per second, no matter how
+// fast the window is actually drawing. Speeds given "per frame" above are per tick, and every
+// timer below is measured on the simulation clock (SimState::time), never on GetTime().
+// stepSimulation() makes no raylib calls, so it can also run without a window (see --headless).
+const double SIM_TICK_SECONDS = 1.0 / FPS;
+const double MAX_FRAME_SECONDS = 0.25; // Clamp long frames (window drags, breakpoints) so we don't spiral
+const float INTERPOLATION_SNAP_DISTANCE = 100.0f; // Moves bigger than this in one tick are wraps/teleports, not motion
+
+// Everything the simulation reads from the keyboard for one tick
+struct InputSnapshot {
+    bool move_up = false;    // Arrow keys (held)
+    bool move_down = false;
+    bool move_left = false;
+    bool move_right = false;
+    bool aim_up = false;     // WASD (held)
+    bool aim_down = false;
+    bool aim_left = false;
+    bool aim_right = false;
+    bool shoot_pressed = false; // Shift went down since the last tick
+    bool dash_pressed = false;  // Alt went down since the last tick
+};
+
+// The gameplay numbers one game runs with. A normal game takes the difficulty from DIFFICULTY_SETTINGS
+// (see applyDifficulty) and everything else from the constants above; --tune runs games with other values.
+// Types match the constants they replace, so a default-tuned game behaves bit for bit as before.
+struct SimTuning {
+    float player_speed = 0.0f;
+    float obstacle_speed = 0.0f;
+    int ai_reaction_delay = 0; // In ticks
+    int prediction_frames = ::prediction_frames;
+    float player_shoot_cooldown = PLAYER_SHOOT_COOLDOWN;
+    double player_stun_shot_cooldown = PLAYER_STUN_SHOT_COOLDOWN;
+    float obstacle_shoot_cooldown = OBSTACLE_SHOOT_COOLDOWN;
+    double obstacle_stun_cooldown = OBSTACLE_STUN_COOLDOWN;
+    double obstacle_stun_duration = OBSTACLE_STUN_DURATION;
+    double player_stun_duration = PLAYER_STUN_DURATION;
+    double player_dash_cooldown = PLAYER_DASH_COOLDOWN;
+    double player_dash_duration = PLAYER_DASH_DURATION;
+};
+
+// How a game is set up. Stays the same for the whole game (apart from the world size on window resize).
+struct SimOptions {
+    int world_width = 1366;
+    int world_height = 694;
+    bool portal_mode = false;
+    int stress_projectiles = 0; // If > 0, keep this many extra projectiles flying at all times (--stress)
+    int swarm_size = 1; // Number of obstacles chasing the player (--swarm)
+    uint32_t seed = 1; // Seeds the simulation's random numbers (stress projectile spawns); recorded in replays
+    std::string difficulty_mode = "normal"; // A key of DIFFICULTY_SETTINGS; recorded in replays
+    const SimTuning* tuning = nullptr; // Overrides the difficulty and constants if set (only read by resetSimulation)
+};
+
+const int DEFAULT_PROJECTILE_CAPACITY = 1024; // Far more than a normal game ever has in flight
+const float SWARM_SPAWN_CLEARANCE = 300.0f; // Swarm obstacles start at least this far from the player (see resetSimulation)
+const int SWARM_SPAWN_ATTEMPTS = 64;        // Spots tried per obstacle before settling for the last one (tiny worlds)
+
+// One chasing obstacle. A normal game has exactly one; swarm mode has many, each with its own
+// AI target, stun and shot cooldown.
+struct Obstacle {
+    float x = 0.0f;
+    float y = 0.0f;
+    float prev_x = 0.0f; // Position at the start of the last tick (for render interpolation)
+    float prev_y = 0.0f;
+    float ai_target_x = 0.0f;
+    float ai_target_y = 0.0f;
+    int ai_reaction_timer = 0;
+    bool is_stunned = false;
+    double stun_end_time = 0.0;
+    double last_shot_time = 0.0;
+};
+
+// --- Broadphase Grid ---
+// Uniform grid over the world plus a margin, because the player, obstacles and projectiles all
+// spend a few ticks partly off-screen while they wrap around. Positions beyond the margin are
+// clamped into the border cells, so anything that wraps lands in a valid cell.
+// Coordinates are not folded across the wrap: collisions never were (an obstacle half off the
+// left edge doesn't hit anything on the right edge), so the grid doesn't need to either.
+//
+// Each obstacle is linked into every cell a projectile's top-left corner could be in while the
+// projectile touches it, and the player's hit/near-miss reach is counted in the cells it covers.
+// A projectile only needs exact checks if the cell under its top-left corner is occupied, and then
+// only against the obstacles listed there, so the cost follows local density rather than
+// projectiles x obstacles. The grid is updated incrementally: an entity's cells are only
+// touched when it moves into a different set of cells.
+const float BROADPHASE_CELL_SIZE = 64.0f; // Raised if obstacle_size + PROJECTILE_SIZE is larger (see initBroadphaseGrid)
+const float BROADPHASE_MARGIN = 64.0f; // How far past each screen edge the grid reaches
+
+// Inclusive block of grid cells. The default is empty.
+struct GridCellRange {
+    int col_min = 0;
+    int col_max = -1;
+    int row_min = 0;
+    int row_max = -1;
+};
+
+struct BroadphaseGrid {
+    int world_width = 0; // World size the grid was built for
+    int world_height = 0;
+    int cols = 0;
+    int rows = 0;
+    float origin_x = 0.0f; // World position of the top-left corner of cell (0, 0)
+    float origin_y = 0.0f;
+    float inv_cell_size = 0.0f;
+    std::vector<uint32_t> occupancy; // Per cell: obstacles plus player reach covering it
+    std::vector<int> cell_head;      // Per cell: first obstacle node linked into it, -1 if none
+    // An obstacle covers at most 2x2 cells, so obstacle i owns nodes 4*i .. 4*i+3
+    std::vector<int> node_next;
+    std::vector<int> node_prev;
+    std::vector<int> node_cell;      // -1 while the node isn't linked
+    std::vector<GridCellRange> obstacle_cells; // Cells each obstacle is currently linked into
+    GridCellRange player_cells;      // Cells currently counted for the player's reach
+    std::vector<uint32_t> query_stamp; // Per obstacle: last query that returned it (obstacles span several cells)
+    uint32_t query_id = 0;
+    std::vector<int> query_results;  // Scratch result list for findObstaclesNear
+};
+
+// --- Achievement Engine ---
+// Gameplay publishes typed events (SimEvent) as things happen, into a queue in the SimState. At the end
+// of the tick every rule subscribed to an event's type looks at it (processAchievementEvents). Rules are
+// rows in ACHIEVEMENT_RULES, so a new achievement is a new row rather than another check in the
+// projectile loop. Each rule fires at most once per game, and once no rule is waiting on an event type
+// any more that type isn't published (AchievementProgress::listening): the near-miss distance test in
+// the projectile loop, for one, stops as soon as the near miss is earned.
+enum SimEventType : uint8_t {
+    SIM_EVENT_SURVIVAL_TICK,    // Every tick; value = seconds survived so far
+    SIM_EVENT_SHOT,             // Shoot was pressed (whether or not the gun was ready)
+    SIM_EVENT_OBSTACLE_STUNNED, // A player shot stunned an obstacle
+    SIM_EVENT_DASH_THROUGH,     // The player dashed through an obstacle projectile
+    SIM_EVENT_NEAR_MISS,        // An obstacle projectile passed within NEAR_MISS_MARGIN without hitting
+    SIM_EVENT_TYPE_COUNT
+};
+
+static inline uint32_t simEventBit(int type) {
+    return 1u << type;
+}
+
+struct SimEvent {
+    SimEventType type;
+    double value;
+};
+
+enum AchievementRuleKind : uint8_t {
+    RULE_COUNT_AT_LEAST, // Fires when the event has happened `threshold` times this game
+    RULE_VALUE_AT_LEAST  // Fires when an event's value reaches `threshold`
+};
+
+struct AchievementRuleDefinition {
+    const char* achievement;
+    SimEventType event;
+    AchievementRuleKind kind;
+    double threshold;
+    int cancelled_by; // SimEventType that rules the achievement out for the rest of the game, or -1
+};
+
+// Every achievement earned in play. (portal_username is unlocked from the menu, not by a rule.)
+// Rules for the same event are checked in this order, which is the order they're reported in.
+const AchievementRuleDefinition ACHIEVEMENT_RULES[] = {
+    {"bullet_ballet_master", SIM_EVENT_SURVIVAL_TICK, RULE_VALUE_AT_LEAST, 30.0, SIM_EVENT_SHOT},
+    {"long_haul_dodger", SIM_EVENT_SURVIVAL_TICK, RULE_VALUE_AT_LEAST, 120.0, -1}, // 2 minutes
+    {"stunned_silence", SIM_EVENT_OBSTACLE_STUNNED, RULE_COUNT_AT_LEAST, 3.0, -1},
+    {"dash_of_genius", SIM_EVENT_DASH_THROUGH, RULE_COUNT_AT_LEAST, 1.0, -1},
+    {"near_miss", SIM_EVENT_NEAR_MISS, RULE_COUNT_AT_LEAST, 1.0, -1},
+};
+
+// A rule with its achievement interned
+struct AchievementRule {
+    AchievementId achievement;
+    SimEventType event;
+    AchievementRuleKind kind;
+    double threshold;
+    int cancelled_by;
+};
+
+// The rules, indexed by the event types they subscribe to
+struct AchievementEngine {
+    std::vector<AchievementRule> rules;
+    std::vector<uint16_t> triggered_by[SIM_EVENT_TYPE_COUNT]; // Rules that count or test each event type
+    std::vector<uint16_t> cancelled_by[SIM_EVENT_TYPE_COUNT]; // Rules each event type rules out
+    uint32_t subscriptions[SIM_EVENT_TYPE_COUNT] = {};        // Rules in either list, per event type
+};
+
+AchievementEngine achievement_engine; // Built from ACHIEVEMENT_RULES by initializeAchievementDefinitions()
+
+const size_t ACHIEVEMENT_EVENTS_RESERVE = 64; // Events a tick usually publishes, with room to spare
+const size_t GAME_ACHIEVEMENTS_RESERVE = 64;  // Unlocks one game collects, with room to spare
+
+// One game's progress through the rules
+struct AchievementProgress {
+    std::vector<uint32_t> counts;  // Per rule
+    std::vector<uint8_t> finished; // Per rule: fired or ruled out this game
+    uint32_t open_subscriptions[SIM_EVENT_TYPE_COUNT] = {}; // Unfinished rules subscribed to each event type
+    uint32_t listening = 0;        // simEventBit() of every event type with open subscriptions
+    std::vector<SimEvent> events;  // Published this tick
+};
+
+// Complete state of one game. Nothing in here points back at globals, so several games can be
+// simulated side by side.
+struct SimState {
+    // World / difficulty (set by resetSimulation and applyDifficulty)
+    int world_width = 1366;
+    int world_height = 694;
+    bool portal_mode = false;
+    int stress_projectiles = 0;
+    uint32_t stress_rng = 1; // Drives where stress projectiles spawn
+    int swarm_size = 1;
+    SimTuning tuning;
+
+    // Simulation clock
+    uint64_t tick = 0;
+    double time = 0.0; // Seconds of simulated time since the game started
+
+    // Player
+    float player_x = 0.0f;
+    float player_y = 0.0f;
+    float prev_player_x = 0.0f; // Position at the start of the last tick (for render interpolation)
+    float prev_player_y = 0.0f;
+    float player_vx = 0.0f; // Player velocity X (for normal movement)
+    float player_vy = 0.0f; // Player velocity Y (for normal movement)
+    float player_aim_angle = 0.0f; // Angle for player's aiming direction (in radians)
+    double player_last_shot_time = 0.0;
+    double player_last_stun_shot_time = 0.0;
+    bool player_is_stunned = false;
+    double player_stun_end_time = 0.0;
+    bool player_is_dashing = false;
+    double player_dash_end_time = 0.0;
+    double player_last_dash_time = 0.0;
+    float player_dash_velocity_x = 0.0f; // Dash velocity in pixels per second
+    float player_dash_velocity_y = 0.0f;
+
+    // Obstacles (obstacles[0] is the one a normal game has)
+    std::vector<Obstacle> obstacles;
+    double obstacle_last_stun_time = 0.0; // Last time any obstacle's projectile stunned the player
+    BroadphaseGrid grid;
+
+    ProjectilePool projectiles;
+
+    // Portals (portal mode only)
+    bool portal_1_active = false;
+    Vector2 portal_1_pos = {0,0};
+    bool portal_2_active = false;
+    Vector2 portal_2_pos = {0,0};
+    double last_teleport_time = 0.0;
+    double portal_active_until_time_1 = 0.0;
+    double portal_active_until_time_2 = 0.0;
+    bool next_projectile_portal_is_1 = true; // To toggle between placing portal 1 and 2
+
+    // Score / time bonus
+    double elapsed_time_s = 0.0; // Total survival time in seconds
+    double final_survival_time_s = 0.0;
+    double dodge_streak_start_time = 0.0; // Time when the current dodge streak began
+    bool showing_time_bonus_message = false;
+    double time_bonus_message_end_time = 0.0;
+    bool game_over = false;
+
+    // Per-game achievement tracking (see the achievement engine)
+    AchievementProgress achievements;
+    // Achievements earned during the last steps. The simulation doesn't know about profiles or
+    // the save file, so the caller drains this and decides what to do with them.
+    std::vector<AchievementId> pending_achievements;
+};
+
+// The game being played in the window
+SimState sim;
+int stress_projectile_count = 0; // From --stress
+int swarm_obstacle_count = 1; // From --swarm
+double sim_accumulator = 0.0; // Real time not yet consumed by simulation ticks
+float sim_render_alpha = 0.0f; // How far we are between the last two ticks (0..1), for drawing
+InputSnapshot latched_input; // Input gathered since the last tick (presses are kept until a tick sees them)
+
+// --- Replays ---
+// Every game is recorded as the input the simulation saw on each tick, so it can be re-simulated to
+// check a score (--verify-replays) or watched again (GAME_STATE_REPLAY). The simulation is deterministic
+// given its SimOptions and inputs, so that's all a replay needs.
+//
+// File layout (native-endian, like the profile store):
+//   ReplayHeader
+//   Body: varint tokens. The low 2 bits of a token say what it is:
+//     REPLAY_TOKEN_RUN:    token >> 2 is the packed input (see packInput), followed by a varint tick count
+//     REPLAY_TOKEN_RESIZE: followed by varint width and height; bit 2 of the token = recenter (see resizeWorld)
+//     REPLAY_TOKEN_END:    end of the body
+//   ReplayFooter, then footer.achievement_count achievement ids (one length byte, then the characters)
+// Held keys change every few ticks and presses are single ticks, so a minute of play is around 1-2 KB.
+const char REPLAY_MAGIC[8] = {'D', 'O', 'D', 'G', 'R', 'P', 'L', '1'};
+const char REPLAY_FOOTER_MAGIC[8] = {'D', 'O', 'D', 'G', 'E', 'N', 'D', '1'};
+const uint32_t REPLAY_VERSION = 1;
+const std::string REPLAY_DIRECTORY = "replays";
+const size_t REPLAY_DIRECTORY_MAX_FILES = 500; // Oldest replays are deleted past this (a few MB)
+const std::string REPLAY_FILE_EXTENSION = ".dreplay";
+const uint32_t REPLAY_TOKEN_RUN = 0;
+const uint32_t REPLAY_TOKEN_RESIZE = 1;
+const uint32_t REPLAY_TOKEN_END = 2;
+const size_t REPLAY_BODY_RESERVE = 16 * 1024; // Reserved up front so recording a game doesn't reallocate mid-play
+
+struct ReplayHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t seed;               // SimOptions::seed
+    int32_t world_width;         // World size at the start (resizes are in the body)
+    int32_t world_height;
+    int32_t stress_projectiles;
+    int32_t swarm_size;
+    uint32_t portal_mode;
+    uint32_t tick_rate;          // Ticks per second; a replay from a build with another tick rate can't match
+    char difficulty[16];
+    char username[16];
+    int64_t recorded_at;         // Unix time the game started
+};
+
+struct ReplayFooter {
+    char magic[8];
+    uint64_t tick_count;           // Ticks simulated, up to and including the game over tick
+    double final_survival_time_s;  // Compared bit for bit when verifying
+    uint32_t achievement_count;
+    uint32_t reserved;
+    uint64_t content_hash;         // FNV-1a of the header and body, to catch damaged files
+};
+
+// Records the game being played. The current run of identical inputs is kept open until the input changes.
+struct ReplayRecorder {
+    bool active = false;
+    ReplayHeader header = {};
+    std::string body;
+    uint32_t run_bits = 0;
+    uint32_t run_length = 0;
+    uint64_t tick_count = 0;
+    std::vector<AchievementId> achievements; // In the order the simulation reported them
+};
+
+// A replay file, split up and checked by parseReplay()
+struct Replay {
+    ReplayHeader header = {};
+    std::string body; // Including the END token
+    ReplayFooter footer = {};
+    std::vector<AchievementId> achievements; // ACHIEVEMENT_NONE for ids this version has never heard of
+};
+
+// Walks a replay's body tick by tick
+struct ReplayReader {
+    const std::string* body = nullptr;
+    size_t position = 0;
+    uint32_t run_bits = 0;
+    uint32_t run_left = 0; // Ticks left in the current run
+    bool ended = false;
+    bool failed = false;
+};
+
+ReplayRecorder game_replay;     // The game being played in the window
+std::string last_replay_bytes;  // The last finished game's replay, for V on the game over screen
+std::string replay_record_directory; // From --record-replays: headless runs save a replay of every game here
+std::string replay_directory = REPLAY_DIRECTORY; // Where windowed games save their replays
+
+// Playback in the window
+Replay replay_playback;
+ReplayReader replay_playback_reader;
+std::vector<AchievementId> replay_playback_achievements;
+int replay_playback_speed = 1; // 0 = uncapped
+GameState replay_return_state = GAME_STATE_MAIN_MENU;
+const double REPLAY_UNCAPPED_FRAME_SECONDS = 0.012; // Uncapped playback simulates for this long each frame, then draws
+
+// --- Tuning (--tune) ---
+// Every SimTuning field --tune-sweep can change, by name
+struct TuningParameter {
+    const char* name;
+    void (*set)(SimTuning& tuning, double value);
+    double (*get)(const SimTuning& tuning);
+};
+
+// One --tune-sweep NAME=V1,V2,...
+struct TuningSweep {
+    const TuningParameter* parameter;
+    std::vector<double> values;
+};
+
+// Options for --tune (see runTuning)
+struct TuneConfig {
+    std::vector<TuningSweep> sweeps; // Empty = the default sweep set up in main()
+    int games_per_setting = 400;
+    bool scripted_bot = false;       // Use the headless run's random-key script instead of the heuristic bot
+    double max_game_seconds = 300.0; // Games still going after this long stop and count as capped
+    int jobs = 0;                    // 0 = one thread per core
+    std::string csv_path;            // Also write the results here if set
+};
+
+// Optional log sink for the simulation. Left empty in headless runs so the hot loop stays quiet.
+void (*sim_log_hook)(const char* message) = nullptr;
+
+#ifdef DODGER_ALLOC_COUNT
+// --- Allocation Counting ---
+// Only compiled in when building with -DDODGER_ALLOC_COUNT, e.g.:
+//   g++ -O2 -DDODGER_ALLOC_COUNT Dodger.c++ -o Dodger-game -lraylib
+// Replaces the global operator new/delete so every allocation bumps heap_allocation_count, which
+// --selftest-frame-allocs (also only in those builds) uses to check that frames of play don't touch
+// the heap. The count is per thread, so the save thread's work doesn't land in the frame's count.
+// Normal builds keep the standard allocator.
+thread_local uint64_t heap_allocation_count = 0;
+
+// None of these are inlined, so GCC doesn't see malloc/free where it expects the built-in new/delete
+__attribute__((noinline)) void* operator new(size_t size) {
+    heap_allocation_count++;
+    if (void* memory = malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+__attribute__((noinline)) void operator delete(void* memory) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete[](void* memory) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete(void* memory, size_t) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete[](void* memory, size_t) noexcept { free(memory); }
+#endif
+
+// --- Profiling ---
+// Frame-phase timers, only compiled in when building with -DDODGER_PROFILE, e.g.:
+//   g++ -O2 -DDODGER_PROFILE Dodger.c++ -o Dodger-game -lraylib
+// Without it every PROFILE_ macro expands to nothing, so normal builds pay nothing.
+//
+// PROFILE_SCOPE(zone) times the rest of the enclosing block; PROFILE_BEGIN(zone)/PROFILE_END(zone)
+// time a stretch inside a longer function. Samples go into a lock-free single-producer/single-consumer
+// ring, which profileEndFrame() drains once per frame into per-zone histograms (a zone's samples are
+// summed per frame, so a zone hit several times counts as its total for that frame). The F3 overlay
+// shows min/avg/p99 over the last second. On exit the totals are written to dodger_profile.csv and the
+// most recent samples to dodger_trace.json (open in chrome://tracing or https://ui.perfetto.dev).
+// Only threads that called profileEnableThisThread() record, so the ring keeps a single producer.
+enum ProfileZone {
+    PROFILE_FRAME,             // Whole main loop iteration
+    PROFILE_MUSIC,             // UpdateMusicStream for both streams
+    PROFILE_UPDATE,            // updateGame
+    PROFILE_INPUT,             // Keyboard sampling
+    PROFILE_SIM_STEP,          // stepSimulation (contains the phases below)
+    PROFILE_PLAYER_MOVEMENT,   // Dash, movement, aiming and wrap
+    PROFILE_PORTALS,           // Portal expiry and teleports
+    PROFILE_PROJECTILE_SPAWN,  // Player/obstacle/stress shots
+    PROFILE_PROJECTILE_LOOP,   // Batch move/bounce/wrap of every projectile
+    PROFILE_COLLISIONS,        // Broadphase, exact projectile checks, player vs obstacles
+    PROFILE_OBSTACLE_AI,       // Obstacle targeting, movement and wrap
+    PROFILE_ACHIEVEMENTS,      // Achievement checks and unlocks (including the save they trigger)
+    PROFILE_DRAW,              // drawGame
+    PROFILE_HUD_TEXT,          // Text and popups while playing
+    PROFILE_DRAW_CALLS,        // Player, obstacles, projectiles and portals
+    PROFILE_PRESENT,           // EndDrawing (buffer swap, waits for vsync)
+    PROFILE_ZONE_COUNT
+};
+
+#ifdef DODGER_PROFILE
+const char* const PROFILE_ZONE_NAMES[PROFILE_ZONE_COUNT] = {
+    "frame", "music", "update", "input", "sim_step", "player_movement", "portals", "projectile_spawn",
+    "projectile_loop", "collisions", "obstacle_ai", "achievements", "draw", "hud_text", "draw_calls", "present"
+};
+
+struct ProfileSample {
+    uint64_t start_ns;    // Since the profiler started
+    uint32_t duration_ns;
+    uint32_t zone;        // ProfileZone
+};
+
+// Records from construction to the end of the enclosing block
+struct ProfileScope {
+    ProfileZone zone;
+    uint64_t start_ns;
+    explicit ProfileScope(ProfileZone z);
+    ~ProfileScope();
+};
+
+uint64_t profileNow();
+void profileEnableThisThread();
+void profileBegin(ProfileZone zone);
+void profileEnd(ProfileZone zone);
+void profileEndFrame();
+void profileToggleOverlay();
+void drawProfileOverlay();
+void profileShutdown(); // Writes the CSV summary and the trace
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(zone) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(zone)
+#define PROFILE_BEGIN(zone) profileBegin(zone)
+#define PROFILE_END(zone) profileEnd(zone)
+#define PROFILE_ENABLE_THIS_THREAD() profileEnableThisThread()
+#define PROFILE_END_FRAME() profileEndFrame()
+#define PROFILE_SHUTDOWN() profileShutdown()
+#else
+#define PROFILE_SCOPE(zone)
+#define PROFILE_BEGIN(zone)
+#define PROFILE_END(zone)
+#define PROFILE_ENABLE_THIS_THREAD()
+#define PROFILE_END_FRAME()
+#define PROFILE_SHUTDOWN()
+#endif
 
 // --- Achievement Profile Selection Variables ---
 std::vector<std::string> available_profile_names; // List of usernames to choose from
 int selected_profile_index = 0; // Index of the currently selected profile
 
+// --- Retained Rendering ---
+// Screens that only change on input (menus, game over, achievements...) are drawn once into a render
+// texture and then just copied to the screen each frame. Whatever changes what one of them shows calls
+// markStaticScreenDirty(); switching screens or resizing the window redraws it anyway.
+struct StaticScreenCache {
+    RenderTexture2D texture = {};
+    bool loaded = false;
+    bool dirty = true;
+    GameState state = GAME_STATE_PLAYING; // The screen in the texture (never a static one to begin with)
+    int width = 0;
+    int height = 0;
+    uint64_t redraws = 0;
+};
+StaticScreenCache static_screen;
+uint64_t display_generation = 0; // Bumped by markStaticScreenDirty(); the HUD re-reads the profile when it changes
+
+// A piece of HUD text, formatted into its own buffer and measured only when the value it shows changes
+struct HudText {
+    char text[96] = "";
+    int width = 0;
+    int font_size = 0;
+    int64_t key = INT64_MIN; // Identifies the value `text` was formatted from (see updateHudText)
+};
+
+// Everything the PLAYING/REPLAY HUD keeps between frames
+struct HudLayer {
+    HudText profile;
+    HudText time;
+    HudText goal; // High score, or time left to win
+    HudText cooldowns[4];
+    HudText replay_label;
+    HudText popup_title;
+    HudText popup_name;
+    HudText popup_description;
+    uint64_t generation = UINT64_MAX; // display_generation that high_score/win_threshold were read at
+    double high_score = 0.0;
+    double win_threshold = 0.0;
+};
+HudLayer hud;
+
 // Helper function to unlock an achievement
-void unlockAchievement(const std::string& achievementId, const std::string& targetUsername); // Prototype added here
+void unlockAchievement(AchievementId achievementId, const std::string& targetUsername); // Prototype added here
+void unlockAchievement(const std::string& achievementId, const std::string& targetUsername);
 
 // Function to initialize all achievement definitions
 void initializeAchievementDefinitions(); // Prototype added here
+AchievementId internAchievementId(const std::string& name);
+AchievementId findAchievementId(const std::string& name);
+std::vector<std::string> achievementNames(const AchievementSet& set);
+void buildAchievementEngine(AchievementEngine& engine, const AchievementRuleDefinition* definitions, size_t count);
+void resetAchievementProgress(const AchievementEngine& engine, AchievementProgress& progress);
+void processAchievementEvents(const AchievementEngine& engine, AchievementProgress& progress, std::vector<AchievementId>& unlocked);
+int runAchievementBenchmark(uint64_t events, int rules);
 
 // --- Function Declarations (Prototypes) ---
 void resetGame();
-void applyDifficulty(const std::string& mode);
+void applyDifficulty(SimState& s, const std::string& mode);
 void updateGame(double deltaTime);
 void drawGame();
-void drawCenteredText(const std::string& text, int fontSize, Color color, int yOffset = 0);
-void drawInfoText(const std::string& text, int fontSize, Color color, int x, int y, TextAlignment align);
+void drawCenteredText(const char* text, int fontSize, Color color, int yOffset = 0);
+void drawInfoText(const char* text, int fontSize, Color color, int x, int y, TextAlignment align);
 void drawAchievementsScreen(); // New function for achievements screen
 void drawSelectAchievementProfileScreen(); // New function for profile selection
+void drawTamperedScreen();
+void drawUsernameInputScreen();
+void drawMainMenuScreen();
+void drawGameOverScreen();
+void drawPlayingScreen();
+void markStaticScreenDirty();
+void releaseStaticScreenCache();
+#ifdef DODGER_ALLOC_COUNT
+int runFrameAllocationSelfTest();
+#endif
+
+// Simulation functions (no raylib calls in here)
+void resetSimulation(SimState& s, const SimOptions& options);
+void stepSimulation(SimState& s, const InputSnapshot& input);
+void simLog(const char* format, ...);
+InputSnapshot sampleInput();
+void handleSimulationGameOver();
+int runHeadless(uint64_t ticks, uint32_t seed, int stressProjectiles, int swarmSize, bool portalMode);
+int runBroadphaseSelfTest();
+void resizeWorld(SimState& s, int width, int height, bool recenter);
+void resizeGameWorld(bool recenter);
+
+// Replay functions
+uint32_t packInput(const InputSnapshot& input);
+InputSnapshot unpackInput(uint32_t bits);
+void replayBegin(ReplayRecorder& recorder, const SimOptions& options, const std::string& username);
+void replayRecordTick(ReplayRecorder& recorder, const InputSnapshot& input);
+void replayRecordResize(ReplayRecorder& recorder, int width, int height, bool recenter);
+std::string replayFinish(ReplayRecorder& recorder, const SimState& s);
+std::string replayFilePath(const std::string& directory, const ReplayRecorder& recorder);
+bool writeReplayFile(const std::string& path, const std::string& bytes);
+bool listReplayFiles(const std::string& directory, std::vector<std::string>* paths);
+void pruneReplayDirectory(const std::string& directory, size_t keep);
+void queueReplayWrite(const std::string& directory, const std::string& path, const std::string& bytes);
+bool parseReplay(const std::string& bytes, Replay* replay, std::string* error);
+SimOptions replayOptions(const ReplayHeader& header);
+bool replayNextTick(ReplayReader& reader, SimState& s, InputSnapshot* input);
+bool verifyReplay(const Replay& replay, SimState& scratch, std::string* problem);
+int runReplayVerification(const std::string& directory, int jobs);
+bool startReplayPlayback(const std::string& bytes, GameState returnState);
+void stopReplayPlayback();
+
+// Tuning functions
+bool parseTuningSweep(const std::string& text, TuningSweep* sweep);
+int runTuning(const TuneConfig& config);
+
+// Projectile pool functions
+void initProjectilePool(ProjectilePool& pool, int capacity);
+void clearProjectilePool(ProjectilePool& pool);
+int spawnProjectile(ProjectilePool& pool, float x, float y, float vx, float vy, bool isPlayerShot);
+void releaseProjectile(ProjectilePool& pool, int slot);
+
+// Broadphase grid functions
+void initBroadphaseGrid(BroadphaseGrid& grid, int worldWidth, int worldHeight, int obstacleCount);
+void updateObstacleCells(BroadphaseGrid& grid, int index, const Obstacle& obstacle);
+void updatePlayerCells(BroadphaseGrid& grid, const Rectangle& reach);
+const std::vector<int>& findObstaclesNear(BroadphaseGrid& grid, const Rectangle& area);
 
 // Persistence functions
 void saveGameData(); // Prototype added here
+bool queueAchievementUnlock(const std::string& username, const std::string* achievementId);
 void loadGameData(); // Prototype added here
 void initializeDefaultGameData(); // Prototype added here
+SaveSnapshot takeSaveSnapshot();
+SaveSnapshot takeFullSaveSnapshot();
+std::string serializeSaveSnapshot(const SaveSnapshot& snapshot);
+bool writeSaveFileAtomically(const std::string& path, const std::string& contents, int injectedDelayMs);
+void shutdownPersistence();
+int runSlowIoSelfTest();
+bool loadSaveFileJson(const std::string& path);
+void switchToProfile(const std::string& username);
+void ensureProfileLoaded(const std::string& username);
+std::vector<std::string> listProfileNames();
+
+// Binary profile store functions
+bool openProfileStore();
+bool createProfileStore();
+bool writeProfileStoreChanges(const SaveSnapshot& snapshot, int injectedDelayMs);
+int runSaveBenchmark();
 
 // Anti-tampering functions
 std::string getExecutablePath();
 long long calculateFileChecksum(const std::string& filePath);
 
 // --- Main Function ---
-int main() {
+int main(int argc, char* argv[]) {
+    // --- Command-line options ---
+    // --headless          Run the simulation uncapped with no window or audio and print tick stats
+    // --ticks N           Number of ticks to simulate in headless mode (default 600000)
+    // --seed N            Seed for the scripted headless input (default 1)
+    // --stress N          Keep N extra projectiles in flight (works with and without --headless)
+    // --swarm N           Chase the player with N obstacles instead of one (works with and without --headless)
+    // --portal            Play the headless run in portal mode (as the PORTAL profile does in the window)
+    // --selftest-broadphase  Check the collision grid against testing every pair, then exit
+    // --selftest-slow-io  Check that saving on a (simulated) slow disk doesn't stall frames, then exit
+    // --selftest-frame-allocs  Check that menu, play and replay frames don't allocate, then exit
+    //                     (builds with -DDODGER_ALLOC_COUNT only)
+    // --binary-profiles   Keep profiles in the indexed binary store (migrating the JSON save), see ProfileStore
+    // --bench-save        Time the JSON save against the binary profile store with 10k/100k profiles, then exit
+    // --record-replays DIR  With --headless, save a replay of every game into DIR
+    // --verify-replays DIR  Re-simulate every replay in DIR and check its score and achievements, then exit
+    // --jobs N            Threads for --verify-replays and --tune (default: one per core)
+    // --play-replay FILE  Open the window straight into watching a replay (1/2/3/4 = 1x/2x/8x/uncapped)
+    // --tune              Play bot games for every combination of the swept settings and report survival
+    //                     times and achievement rates, then exit (see runTuning)
+    // --tune-sweep NAME=V1,V2,...  A setting to sweep in --tune (repeatable); default sweeps
+    //                     obstacle_speed, ai_reaction_delay and prediction_frames
+    // --tune-games N      Games per setting in --tune (default 400)
+    // --tune-bot heuristic|scripted  Who plays in --tune (default heuristic)
+    // --tune-max-seconds S  Stop --tune games that last this long (default 300)
+    // --tune-csv FILE     Also write the --tune results to FILE
+    // --bench-achievements  Time the achievement engine with hundreds of rules against checking every
+    //                     rule on every event, then exit (see runAchievementBenchmark)
+    initializeAchievementDefinitions(); // Every mode below simulates or saves games, so intern the ids first
+    bool headless = false;
+    uint64_t headless_ticks = 600000;
+    uint32_t headless_seed = 1;
+    bool headless_portal_mode = false;
+    std::string verify_replays_directory;
+    int verify_jobs = 0;
+    std::string play_replay_path;
+    bool tune = false;
+    TuneConfig tune_config;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+            headless_ticks = std::stoull(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            headless_seed = (uint32_t)std::stoul(argv[++i]);
+        } else if (strcmp(argv[i], "--stress") == 0 && i + 1 < argc) {
+            stress_projectile_count = std::max(0, std::stoi(argv[++i]));
+        } else if (strcmp(argv[i], "--selftest-slow-io") == 0) {
+            return runSlowIoSelfTest();
+        } else if (strcmp(argv[i], "--selftest-frame-allocs") == 0) {
+#ifdef DODGER_ALLOC_COUNT
+            return runFrameAllocationSelfTest();
+#else
+            printf("selftest-frame-allocs: this build doesn't count allocations; rebuild with -DDODGER_ALLOC_COUNT\n");
+            return 1;
+#endif
+        } else if (strcmp(argv[i], "--record-replays") == 0 && i + 1 < argc) {
+            replay_record_directory = argv[++i];
+        } else if (strcmp(argv[i], "--verify-replays") == 0 && i + 1 < argc) {
+            verify_replays_directory = argv[++i];
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            verify_jobs = std::max(1, std::stoi(argv[++i]));
+        } else if (strcmp(argv[i], "--play-replay") == 0 && i + 1 < argc) {
+            play_replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--binary-profiles") == 0) {
+            profile_store.enabled = true; // loadGameData() migrates the JSON save if there's no store yet
+        } else if (strcmp(argv[i], "--bench-save") == 0) {
+            return runSaveBenchmark();
+        } else if (strcmp(argv[i], "--bench-achievements") == 0) {
+            return runAchievementBenchmark(1000000, 500);
+        } else if (strcmp(argv[i], "--swarm") == 0 && i + 1 < argc) {
+            swarm_obstacle_count = std::max(1, std::stoi(argv[++i]));
+        } else if (strcmp(argv[i], "--portal") == 0) {
+            headless_portal_mode = true;
+        } else if (strcmp(argv[i], "--selftest-broadphase") == 0) {
+            return runBroadphaseSelfTest();
+        } else if (strcmp(argv[i], "--tune") == 0) {
+            tune = true;
+        } else if (strcmp(argv[i], "--tune-sweep") == 0 && i + 1 < argc) {
+            TuningSweep sweep;
+            if (!parseTuningSweep(argv[++i], &sweep)) {
+                return 1;
+            }
+            tune_config.sweeps.push_back(sweep);
+        } else if (strcmp(argv[i], "--tune-games") == 0 && i + 1 < argc) {
+            tune_config.games_per_setting = std::max(1, std::stoi(argv[++i]));
+        } else if (strcmp(argv[i], "--tune-bot") == 0 && i + 1 < argc) {
+            const char* bot = argv[++i];
+            if (strcmp(bot, "scripted") != 0 && strcmp(bot, "heuristic") != 0) {
+                fprintf(stderr, "tune: unknown bot '%s'; expected heuristic or scripted\n", bot);
+                return 1;
+            }
+            tune_config.scripted_bot = strcmp(bot, "scripted") == 0;
+        } else if (strcmp(argv[i], "--tune-max-seconds") == 0 && i + 1 < argc) {
+            tune_config.max_game_seconds = std::max(1.0, std::stod(argv[++i]));
+        } else if (strcmp(argv[i], "--tune-csv") == 0 && i + 1 < argc) {
+            tune_config.csv_path = argv[++i];
+        } else {
+            TraceLog(LOG_WARNING, "Ignoring unknown command-line option: %s", argv[i]);
+        }
+    }
+    PROFILE_ENABLE_THIS_THREAD(); // The main thread is the profiler's only producer
+    if (!verify_replays_directory.empty()) {
+        return runReplayVerification(verify_replays_directory, verify_jobs);
+    }
+    if (tune) {
+        if (tune_config.sweeps.empty()) {
+            // Default sweep: how hard the obstacle chases, around the normal game's 6 / 60 / 30
+            for (const char* sweep_text : {"obstacle_speed=5,6,7", "ai_reaction_delay=30,60,90", "prediction_frames=15,30,45"}) {
+                TuningSweep sweep;
+                parseTuningSweep(sweep_text, &sweep);
+                tune_config.sweeps.push_back(sweep);
+            }
+        }
+        tune_config.jobs = verify_jobs;
+        return runTuning(tune_config);
+    }
+    if (headless) {
+        int result = runHeadless(headless_ticks, headless_seed, stress_projectile_count, swarm_obstacle_count, headless_portal_mode);
+        PROFILE_SHUTDOWN();
+        return result;
+    }
+
     SetConfigFlags(FLAG_VSYNC_HINT);
     InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Dodger Game - Raylib C++");
     
@@ -333,12 +1233,23 @@ int main() {
     }
     // --- End Audio Initialization ---
 
-    initializeAchievementDefinitions(); // Initialize all achievement data
     loadGameData();
     username_input_buffer = current_username; // Set input buffer to current username on start
+    if (!play_replay_path.empty()) {
+        std::ifstream replay_file(play_replay_path, std::ios::binary);
+        std::stringstream replay_bytes;
+        replay_bytes << replay_file.rdbuf();
+        if (!replay_file.is_open() || !startReplayPlayback(replay_bytes.str(), GAME_STATE_USERNAME_INPUT)) {
+            TraceLog(LOG_WARNING, "Could not play replay %s.", play_replay_path.c_str());
+        }
+    }
+
+    // Forward simulation messages to the raylib log while playing in the window
+    sim_log_hook = [](const char* message) { TraceLog(LOG_INFO, "%s", message); };
 
     // Game Loop
     while (!WindowShouldClose()) { // WindowShouldClose() will now only be true if CloseWindow() is called manually
+        PROFILE_BEGIN(PROFILE_FRAME);
         double deltaTime = GetFrameTime();
 
         // Check for fullscreen toggle (F key) or window resize and update dimensions
@@ -346,16 +1257,19 @@ int main() {
             ToggleFullscreen();
             SCREEN_WIDTH = GetScreenWidth();
             SCREEN_HEIGHT = GetScreenHeight();
-            // Re-center player and obstacle if they were off-screen or in awkward positions
-            player_x = (float)SCREEN_WIDTH / 2.0f - player_size / 2.0f;
-            player_y = (float)SCREEN_HEIGHT - player_size;
-            obstacle_x = (float)SCREEN_WIDTH / 2.0f - obstacle_size / 2.0f;
-            obstacle_y = 0.0f;
+            resizeGameWorld(true); // Re-center player and obstacle if they were off-screen or in awkward positions
         } else if (IsWindowResized()) {
             SCREEN_WIDTH = GetScreenWidth();
             SCREEN_HEIGHT = GetScreenHeight();
+            resizeGameWorld(false);
         }
+#ifdef DODGER_PROFILE
+        if (IsKeyPressed(KEY_F3)) {
+            profileToggleOverlay();
+        }
+#endif
 
+        PROFILE_BEGIN(PROFILE_MUSIC);
         if (current_game_state != GAME_STATE_TAMPERED) {
             if (normal_music.frameCount > 0 && IsMusicStreamPlaying(normal_music)) {
                 UpdateMusicStream(normal_music);
@@ -364,6 +1278,7 @@ int main() {
                 UpdateMusicStream(win_music);
             }
         }
+        PROFILE_END(PROFILE_MUSIC);
 
         updateGame(deltaTime);
 
@@ -371,8 +1286,15 @@ int main() {
         ClearBackground(BLACK);
 
         drawGame();
+#ifdef DODGER_PROFILE
+        drawProfileOverlay();
+#endif
 
+        PROFILE_BEGIN(PROFILE_PRESENT);
         EndDrawing();
+        PROFILE_END(PROFILE_PRESENT);
+        PROFILE_END(PROFILE_FRAME);
+        PROFILE_END_FRAME();
 
         // The only place CloseWindow() should be called directly for quitting
         if (current_game_state == GAME_STATE_TAMPERED) {
@@ -390,6 +1312,11 @@ int main() {
     CloseAudioDevice();
     // --- End Audio Initialization ---
 
+    shutdownPersistence(); // Don't lose an unlock made just before quitting
+
+    PROFILE_SHUTDOWN();
+
+    releaseStaticScreenCache();
     CloseWindow();
     return 0;
 }
@@ -427,953 +1354,4320 @@ void initializeDefaultGameData() {
     current_username = "Guest"; // Ensure current_username is set to default
     high_scores["normal"] = 0.0;
     UNLOCKED_ACHIEVEMENTS_BY_USER.clear(); // Clear any existing achievement data
-    UNLOCKED_ACHIEVEMENTS_BY_USER[current_username] = {}; // Initialize empty for default user
+    UNLOCKED_ACHIEVEMENTS_BY_USER[current_username] = AchievementSet(); // Initialize empty for default user
+    HIGH_SCORES_BY_USER.clear();
+    HIGH_SCORES_BY_USER[current_username] = high_scores;
+    profile_store.json_rewrite_pending = true;
     TraceLog(LOG_INFO, "Initialized default game data.");
     saveGameData();
 }
 
-void saveGameData() {
-    std::ofstream outFile(SAVE_FILE_NAME);
-    if (outFile.is_open()) {
-        outFile << "{\n";
-        outFile << "  \"last_username\": \"" << current_username << "\",\n"; // Save the last active username
-        outFile << "  \"high_scores\": {\n";
-        outFile << "    \"normal\": " << high_scores["normal"]; // Only saving current user's normal high score
-        outFile << "\n  },\n";
-
-        outFile << "  \"user_data\": {\n";
-        bool first_user_entry = true;
-        for (const auto& user_entry : UNLOCKED_ACHIEVEMENTS_BY_USER) {
-            if (!first_user_entry) {
-                outFile << ",\n";
-            }
-            outFile << "    \"" << user_entry.first << "\": {\n";
-            outFile << "      \"unlocked_achievements\": [";
-            bool first_achievement = true;
-            for (const auto& achievement_id : user_entry.second) {
-                if (!first_achievement) {
-                    outFile << ", ";
-                }
-                outFile << "\"" << achievement_id << "\"";
-                first_achievement = false;
-            }
-            outFile << "]\n";
-            outFile << "    }"; // Close user_data object
-            first_user_entry = false;
-        }
-        outFile << "\n  }\n"; // Close user_data
-        outFile << "}\n"; // Close main JSON object
-        outFile.close();
-        TraceLog(LOG_INFO, "Game data saved successfully to %s.", SAVE_FILE_NAME.c_str());
+static void collectProfileStoreChanges(SaveSnapshot& snapshot);
+
+static void copyProfileIntoSnapshot(SaveSnapshot& snapshot, const std::string& username) {
+    auto unlocked = UNLOCKED_ACHIEVEMENTS_BY_USER.find(username);
+    if (unlocked != UNLOCKED_ACHIEVEMENTS_BY_USER.end()) {
+        snapshot.unlocked_achievements_by_user[username] = achievementNames(unlocked->second);
+    }
+    auto scores = HIGH_SCORES_BY_USER.find(username);
+    if (scores != HIGH_SCORES_BY_USER.end()) {
+        snapshot.high_scores_by_user[username] = scores->second;
+    }
+}
+
+static void copyEveryProfileIntoSnapshot(SaveSnapshot& snapshot) {
+    snapshot.every_profile = true;
+    for (const auto& user_entry : UNLOCKED_ACHIEVEMENTS_BY_USER) {
+        snapshot.unlocked_achievements_by_user[user_entry.first] = achievementNames(user_entry.second);
+    }
+    snapshot.high_scores_by_user = HIGH_SCORES_BY_USER;
+}
+
+// Copies what changed since the last save, for the save thread (done on the frame thread, so it has to
+// stay cheap with thousands of profiles). Only the profiles in profile_store.dirty (and the active one)
+// are copied; the save thread merges them into its own copy of the rest. After loading, the first
+// JSON snapshot copies everyone once.
+SaveSnapshot takeSaveSnapshot() {
+    SaveSnapshot snapshot;
+    snapshot.last_username = current_username;
+    snapshot.normal_high_score = high_scores["normal"]; // Top-level score, for older versions of the game
+    HIGH_SCORES_BY_USER[current_username] = high_scores;
+    if (profile_store.enabled) {
+        collectProfileStoreChanges(snapshot);
+        return snapshot;
+    }
+    if (profile_store.json_rewrite_pending) {
+        copyEveryProfileIntoSnapshot(snapshot);
+        profile_store.json_rewrite_pending = false;
     } else {
-        TraceLog(LOG_WARNING, "Could not open file %s for saving game data.", SAVE_FILE_NAME.c_str());
+        copyProfileIntoSnapshot(snapshot, current_username); // Its scores were just copied from high_scores
+        for (const std::string& username : profile_store.dirty) {
+            copyProfileIntoSnapshot(snapshot, username);
+        }
     }
+    profile_store.dirty.clear();
+    return snapshot;
 }
 
-void loadGameData() {
-    std::ifstream inFile(SAVE_FILE_NAME);
-    if (inFile.is_open()) {
-        std::stringstream buffer;
-        buffer << inFile.rdbuf();
-        std::string json_str = buffer.str();
-        inFile.close();
-
-        TraceLog(LOG_INFO, "Loaded game data from %s:\n%s", SAVE_FILE_NAME.c_str(), json_str.c_str());
-
-        // Parse last_username
-        size_t last_username_pos = json_str.find("\"last_username\": \"");
-        if (last_username_pos != std::string::npos) {
-            last_username_pos += std::string("\"last_username\": \"").length();
-            size_t last_username_end = json_str.find("\"", last_username_pos);
-            if (last_username_end != std::string::npos) {
-                last_active_username = json_str.substr(last_username_pos, last_username_end - last_username_pos);
-                current_username = last_active_username; // Set current_username to the last active one
-            }
-        }
-
-        // Parse high scores (only for the current_username, as before)
-        size_t scores_start = json_str.find("\"high_scores\": {");
-        if (scores_start != std::string::npos) {
-            scores_start += std::string("\"high_scores\": {").length();
-            size_t scores_end = json_str.find("}", scores_start);
-            if (scores_end != std::string::npos) {
-                std::string scores_content = json_str.substr(scores_start, scores_end - scores_start);
-                size_t key_start = scores_content.find("\"normal\":");
-                if (key_start != std::string::npos) {
-                    key_start += std::string("\"normal\":").length();
-                    try {
-                        high_scores["normal"] = std::stod(scores_content.substr(key_start));
-                    } catch (const std::invalid_argument& e) {
-                        TraceLog(LOG_WARNING, "Invalid number format in save file for 'normal' high score.");
-                    } catch (const std::out_of_range& e) {
-                        TraceLog(LOG_WARNING, "Number out of range in save file for 'normal' high score.");
-                    }
+// Copies every profile, for writing the JSON save directly (the benchmark and self-test do). Leaves the
+// dirty set alone, so the save thread still hears about those changes.
+SaveSnapshot takeFullSaveSnapshot() {
+    SaveSnapshot snapshot;
+    snapshot.last_username = current_username;
+    snapshot.normal_high_score = high_scores["normal"];
+    HIGH_SCORES_BY_USER[current_username] = high_scores;
+    copyEveryProfileIntoSnapshot(snapshot);
+    return snapshot;
+}
+
+// Quotes a string for the save file (usernames may contain spaces and dashes, but escape everything anyway)
+static std::string jsonQuote(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        switch (c) {
+            case '"': quoted += "\\\""; break;
+            case '\\': quoted += "\\\\"; break;
+            case '\n': quoted += "\\n"; break;
+            case '\r': quoted += "\\r"; break;
+            case '\t': quoted += "\\t"; break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+                    quoted += escaped;
                 } else {
-                    high_scores["normal"] = 0.0;
+                    quoted += c;
                 }
-            }
         }
+    }
+    quoted += '"';
+    return quoted;
+}
 
-        // Parse all unlocked achievements for all users
-        UNLOCKED_ACHIEVEMENTS_BY_USER.clear(); // Clear before loading
-        size_t user_data_start = json_str.find("\"user_data\": {");
-        if (user_data_start != std::string::npos) {
-            user_data_start += std::string("\"user_data\": {").length();
-            size_t user_data_end = json_str.find("}", user_data_start);
-            if (user_data_end == std::string::npos) { // Handle case where user_data is empty or malformed
-                user_data_end = json_str.length(); // Read to end of file if no closing brace
+std::string serializeSaveSnapshot(const SaveSnapshot& snapshot) {
+    std::ostringstream out;
+    out << "{\n";
+    out << "  \"last_username\": " << jsonQuote(snapshot.last_username) << ",\n"; // Save the last active username
+    // The active profile's scores again at the top level, where versions without per-user scores look for them
+    out << "  \"high_scores\": {\n";
+    out << "    \"normal\": " << snapshot.normal_high_score;
+    out << "\n  },\n";
+
+    out << "  \"user_data\": {\n";
+    bool first_user_entry = true;
+    for (const auto& user_entry : snapshot.unlocked_achievements_by_user) {
+        if (!first_user_entry) {
+            out << ",\n";
+        }
+        out << "    " << jsonQuote(user_entry.first) << ": {\n";
+        out << "      \"unlocked_achievements\": [";
+        bool first_achievement = true;
+        for (const auto& achievement_id : user_entry.second) {
+            if (!first_achievement) {
+                out << ", ";
             }
-            std::string user_data_content = json_str.substr(user_data_start, user_data_end - user_data_start);
-            
-            // Simple parsing: find usernames and their achievement arrays
-            size_t current_pos = 0;
-            while ((current_pos = user_data_content.find("\"", current_pos)) != std::string::npos) {
-                size_t user_name_start = current_pos + 1;
-                size_t user_name_end = user_data_content.find("\"", user_name_start);
-                if (user_name_end == std::string::npos) break;
-                std::string username_key = user_data_content.substr(user_name_start, user_name_end - user_name_start);
-                
-                size_t achievements_array_start = user_data_content.find("[", user_name_end);
-                if (achievements_array_start == std::string::npos) break;
-                size_t achievements_array_end = user_data_content.find("]", achievements_array_start);
-                if (achievements_array_end == std::string::npos) break;
-
-                std::string achievement_list_str = user_data_content.substr(achievements_array_start + 1, achievements_array_end - achievements_array_start - 1);
-                std::stringstream list_ss(achievement_list_str);
-                std::string achievement_id;
-                while (std::getline(list_ss, achievement_id, ',')) {
-                    // Trim whitespace and quotes
-                    size_t first = achievement_id.find_first_not_of(" \"\n\r\t");
-                    size_t last = achievement_id.find_last_not_of(" \"\n\r\t");
-                    if (std::string::npos == first) continue;
-                    UNLOCKED_ACHIEVEMENTS_BY_USER[username_key].push_back(achievement_id.substr(first, (last - first + 1)));
-                }
-                current_pos = achievements_array_end + 1;
+            out << jsonQuote(achievement_id);
+            first_achievement = false;
+        }
+        out << "]";
+        auto scores = snapshot.high_scores_by_user.find(user_entry.first);
+        if (scores != snapshot.high_scores_by_user.end() && !scores->second.empty()) {
+            out << ",\n      \"high_scores\": {";
+            bool first_score = true;
+            for (const auto& score : scores->second) {
+                out << (first_score ? "" : ", ") << jsonQuote(score.first) << ": " << score.second;
+                first_score = false;
             }
+            out << "}";
         }
+        out << "\n";
+        out << "    }"; // Close user_data object
+        first_user_entry = false;
+    }
+    out << "\n  }\n"; // Close user_data
+    out << "}\n"; // Close main JSON object
+    return out.str();
+}
+
+// Writes `contents` to path.tmp, fsyncs it and renames it over `path`. Runs on the save thread
+// (or directly in --selftest-slow-io). injectedDelayMs stalls before the fsync to mimic a slow disk.
+bool writeSaveFileAtomically(const std::string& path, const std::string& contents, int injectedDelayMs) {
+    const std::string temp_path = path + ".tmp";
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        TraceLog(LOG_WARNING, "Could not open file %s for saving game data.", temp_path.c_str());
+        return false;
+    }
 
-        // If no user data was loaded, ensure the current_username has an empty achievement list
-        if (UNLOCKED_ACHIEVEMENTS_BY_USER.find(current_username) == UNLOCKED_ACHIEVEMENTS_BY_USER.end()) {
-            UNLOCKED_ACHIEVEMENTS_BY_USER[current_username] = {};
+    size_t written = 0;
+    while (written < contents.size()) {
+        ssize_t count = write(fd, contents.data() + written, contents.size() - written);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            TraceLog(LOG_WARNING, "Failed writing game data to %s.", temp_path.c_str());
+            close(fd);
+            unlink(temp_path.c_str());
+            return false;
         }
+        written += (size_t)count;
+    }
+    if (injectedDelayMs > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(injectedDelayMs));
+    }
+    if (fsync(fd) != 0) {
+        TraceLog(LOG_WARNING, "Failed to flush game data to %s.", temp_path.c_str());
+        close(fd);
+        unlink(temp_path.c_str());
+        return false;
+    }
+    close(fd);
 
-        TraceLog(LOG_INFO, "Game data loaded successfully. Last active username: %s", current_username.c_str());
-    } else {
-        TraceLog(LOG_INFO, "Save file %s not found or could not be opened. Initializing default data.", SAVE_FILE_NAME.c_str());
-        initializeDefaultGameData();
+    if (rename(temp_path.c_str(), path.c_str()) != 0) {
+        TraceLog(LOG_WARNING, "Could not replace %s with %s.", path.c_str(), temp_path.c_str());
+        unlink(temp_path.c_str());
+        return false;
+    }
+    // Flush the directory too, so the rename itself survives a power cut
+    size_t slash = path.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+    int directory_fd = open(directory.c_str(), O_RDONLY);
+    if (directory_fd >= 0) {
+        fsync(directory_fd);
+        close(directory_fd);
     }
+    TraceLog(LOG_INFO, "Game data saved successfully to %s.", path.c_str());
+    return true;
 }
 
-// Helper function to unlock an achievement for a specific user
-void unlockAchievement(const std::string& achievementId, const std::string& targetUsername) {
-    // Check if the achievement exists in ALL_ACHIEVEMENTS
-    if (ALL_ACHIEVEMENTS.count(achievementId) == 0) {
-        TraceLog(LOG_WARNING, "Attempted to unlock non-existent achievement: %s", achievementId.c_str());
+// Folds a newer snapshot into an older one (one that hasn't been written yet, or the save thread's copy
+// of every profile). Both only hold changes, so they're merged, newest profile wins; a snapshot holding
+// every profile (or of the other kind) just replaces the older one.
+static void mergeSaveSnapshot(SaveSnapshot& older, SaveSnapshot&& newer) {
+    if (newer.binary != older.binary || newer.every_profile) {
+        older = std::move(newer);
         return;
     }
+    older.last_username = newer.last_username;
+    if (!newer.binary) {
+        older.normal_high_score = newer.normal_high_score;
+        for (auto& user_entry : newer.unlocked_achievements_by_user) {
+            older.unlocked_achievements_by_user[user_entry.first] = std::move(user_entry.second);
+        }
+        for (auto& user_entry : newer.high_scores_by_user) {
+            older.high_scores_by_user[user_entry.first] = std::move(user_entry.second);
+        }
+        return;
+    }
+    older.store_header = newer.store_header;
+    for (const auto& record : newer.store_records) {
+        older.store_records[record.first] = record.second;
+    }
+    if (newer.store_index_rewrite) {
+        older.store_index_rewrite = true;
+        older.store_index = std::move(newer.store_index);
+        older.store_index_updates.clear();
+    } else if (older.store_index_rewrite) {
+        for (const auto& update : newer.store_index_updates) {
+            older.store_index[update.first] = update.second;
+        }
+    } else {
+        for (const auto& update : newer.store_index_updates) {
+            older.store_index_updates[update.first] = update.second;
+        }
+    }
+}
 
-    // Ensure the target user's entry exists in UNLOCKED_ACHIEVEMENTS_BY_USER
-    if (UNLOCKED_ACHIEVEMENTS_BY_USER.find(targetUsername) == UNLOCKED_ACHIEVEMENTS_BY_USER.end()) {
-        UNLOCKED_ACHIEVEMENTS_BY_USER[targetUsername] = {}; // Create an empty vector for the user
+// Adds a queued unlock to a JSON snapshot's profile, keeping its ids in order (see achievementNames)
+static void addUnlockToSnapshot(SaveSnapshot& snapshot, const AchievementUnlockWrite& unlock) {
+    std::vector<std::string>& names = snapshot.unlocked_achievements_by_user[unlock.username];
+    auto position = std::lower_bound(names.begin(), names.end(), *unlock.achievement_id);
+    if (position == names.end() || *position != *unlock.achievement_id) {
+        names.insert(position, *unlock.achievement_id);
     }
+}
 
-    // Check if the achievement is already unlocked for the target user
-    bool already_unlocked = false;
-    for (const auto& id : UNLOCKED_ACHIEVEMENTS_BY_USER.at(targetUsername)) {
-        if (id == achievementId) {
-            already_unlocked = true;
-            break;
+// Save thread: waits for snapshots, lets bursts settle, writes the newest one (with any unlocks queued by
+// queueAchievementUnlock()). Also writes the replays queued by queueReplayWrite().
+static void persistenceWorker() {
+    std::unique_lock<std::mutex> lock(persistence.mutex);
+    int retry_ms = SAVE_RETRY_MIN_MS;
+    int shutdown_retries = 0;
+    std::vector<ReplayWrite> replays;
+    std::vector<AchievementUnlockWrite> unlocks;
+    unlocks.reserve(SAVE_UNLOCKS_RESERVE); // Swapped with the frame thread's queue, so both stay reserved
+    while (true) {
+        persistence.wake.wait(lock, [] {
+            return persistence.has_pending || !persistence.pending_replays.empty() ||
+                   !persistence.pending_unlocks.empty() || persistence.stopping;
+        });
+        if (!persistence.has_pending && persistence.pending_replays.empty() && persistence.pending_unlocks.empty()) {
+            break; // Stopping with nothing left to write
+        }
+
+        if (!persistence.pending_replays.empty()) {
+            replays.swap(persistence.pending_replays);
+            lock.unlock();
+            for (const ReplayWrite& replay : replays) {
+                if (writeReplayFile(replay.path, replay.bytes)) {
+                    TraceLog(LOG_INFO, "Saved replay %s (%zu bytes).", replay.path.c_str(), replay.bytes.size());
+                } else {
+                    TraceLog(LOG_WARNING, "Could not save replay %s.", replay.path.c_str());
+                }
+            }
+            pruneReplayDirectory(replays.back().directory, REPLAY_DIRECTORY_MAX_FILES);
+            replays.clear();
+            lock.lock();
+            continue; // Then look at the save file with the lock held again
         }
-    }
 
-    if (!already_unlocked) {
-        UNLOCKED_ACHIEVEMENTS_BY_USER.at(targetUsername).push_back(achievementId);
-        TraceLog(LOG_INFO, "Achievement Unlocked for %s: %s", targetUsername.c_str(), ALL_ACHIEVEMENTS.at(achievementId).name.c_str());
-        saveGameData(); // Save immediately when an achievement is unlocked
+        if (!persistence.stopping) {
+            persistence.wake.wait_for(lock, std::chrono::milliseconds(SAVE_COALESCE_MS),
+                                      [] { return persistence.stopping; });
+        }
+        const bool had_snapshot = persistence.has_pending;
+        SaveSnapshot snapshot = std::move(persistence.pending);
+        persistence.pending = SaveSnapshot();
+        persistence.has_pending = false;
+        unlocks.swap(persistence.pending_unlocks);
+        const std::string path = persistence.path;
+        const int injected_delay_ms = persistence.injected_write_delay_ms;
+        const bool injected_failure = persistence.injected_write_failures > 0;
+        if (injected_failure) {
+            persistence.injected_write_failures--;
+        }
+        lock.unlock();
 
-        // Only show popup if the achievement was unlocked for the currently active user
-        if (targetUsername == current_username) {
-            current_achievement_popup_id = achievementId;
-            achievement_popup_display_end_time = GetTime() + ACHIEVEMENT_POPUP_DURATION;
+        bool saved = false;
+        if (snapshot.binary) {
+            saved = !injected_failure && writeProfileStoreChanges(snapshot, injected_delay_ms);
+        } else {
+            // JSON snapshots and unlocks only hold what changed; the file needs everyone, so they go into
+            // the save thread's copy of every profile first. A failed write then only has to be redone.
+            if (had_snapshot) {
+                mergeSaveSnapshot(persistence.saved_profiles, std::move(snapshot));
+            }
+            for (const AchievementUnlockWrite& unlock : unlocks) {
+                addUnlockToSnapshot(persistence.saved_profiles, unlock);
+            }
+            saved = !injected_failure &&
+                    writeSaveFileAtomically(path, serializeSaveSnapshot(persistence.saved_profiles), injected_delay_ms);
+            snapshot = SaveSnapshot(); // What a retry merges in: nothing new
+            snapshot.last_username = persistence.saved_profiles.last_username;
+            snapshot.normal_high_score = persistence.saved_profiles.normal_high_score;
+        }
+        unlocks.clear();
+
+        lock.lock();
+        if (saved) {
+            persistence.writes++;
+            retry_ms = SAVE_RETRY_MIN_MS;
+            continue;
+        }
+        // The snapshot was the only copy of those changes (the frame thread has already forgotten
+        // they were dirty), so put it back under whatever was queued meanwhile and try again later.
+        // (For the JSON save the changes are in saved_profiles by now; this just asks for another write.)
+        persistence.failures++;
+        if (persistence.stopping && ++shutdown_retries > SAVE_SHUTDOWN_RETRIES) {
+            TraceLog(LOG_WARNING, "Giving up on saving game data; the last changes are lost.");
+            continue;
+        }
+        if (persistence.has_pending) {
+            mergeSaveSnapshot(snapshot, std::move(persistence.pending));
+        }
+        persistence.pending = std::move(snapshot);
+        persistence.has_pending = true;
+        TraceLog(LOG_WARNING, "Saving game data failed; retrying in %d ms.", persistence.stopping ? 0 : retry_ms);
+        if (!persistence.stopping) {
+            persistence.wake.wait_for(lock, std::chrono::milliseconds(retry_ms), [] { return persistence.stopping; });
+            retry_ms = std::min(retry_ms * 2, SAVE_RETRY_MAX_MS);
         }
     }
 }
 
-// Function to initialize all achievement definitions
-void initializeAchievementDefinitions() {
-    ALL_ACHIEVEMENTS.clear(); // Clear any previous definitions
+// Starts the save thread if it isn't running. Call with persistence.mutex held.
+static void startPersistenceWorker() {
+    if (!persistence.started) {
+        persistence.started = true;
+        persistence.stopping = false;
+        persistence.pending_unlocks.reserve(SAVE_UNLOCKS_RESERVE);
+        persistence.worker = std::thread(persistenceWorker);
+    }
+}
 
-    ALL_ACHIEVEMENTS.emplace("portal_username", Achievement(
-        "portal_username",
-        "vrooom wait that's too *whoosh*",
-        "Set your username to 'PORTAL'.",
-        true // This is a secret achievement
-    ));
-    ALL_ACHIEVEMENTS.emplace("near_miss", Achievement(
-        "near_miss",
-        "*whew* that was a close call",
-        "Perform a truly close dodge against a projectile."
-    ));
-    ALL_ACHIEVEMENTS.emplace("bullet_ballet_master", Achievement(
-        "bullet_ballet_master",
-        "Bullet Ballet Master",
-        "Survive for 30 seconds without firing a single shot."
-    ));
-    ALL_ACHIEVEMENTS.emplace("stunned_silence", Achievement(
-        "stunned_silence",
-        "Stunned Silence",
-        "Stun the enemy obstacle 3 times in one game."
-    ));
-    ALL_ACHIEVEMENTS.emplace("dash_of_genius", Achievement(
-        "dash_of_genius",
-        "Dash of Genius",
-        "Successfully dash through an enemy projectile."
-    ));
-    ALL_ACHIEVEMENTS.emplace("long_haul_dodger", Achievement(
-        "long_haul_dodger",
-        "Long-Haul Dodger",
-        "Survive for 120 seconds (2 minutes)."
-    ));
-    // Add more achievements here!
+// Queues the current state for saving and returns straight away (see PersistenceQueue)
+void saveGameData() {
+    SaveSnapshot snapshot = takeSaveSnapshot();
+    {
+        std::lock_guard<std::mutex> lock(persistence.mutex);
+        startPersistenceWorker();
+        if (snapshot.every_profile) {
+            persistence.pending_unlocks.clear(); // Already in this snapshot, or from profiles it replaces
+        }
+        if (persistence.has_pending) {
+            // Snapshots only hold changes, so fold this one into the pending one instead of replacing it
+            mergeSaveSnapshot(persistence.pending, std::move(snapshot));
+        } else {
+            persistence.pending = std::move(snapshot);
+        }
+        persistence.has_pending = true;
+        persistence.requests++;
+    }
+    persistence.wake.notify_one();
 }
 
+// Hands a finished game's replay to the save thread, so the frame thread never waits on the disk
+void queueReplayWrite(const std::string& directory, const std::string& path, const std::string& bytes) {
+    {
+        std::lock_guard<std::mutex> lock(persistence.mutex);
+        startPersistenceWorker();
+        persistence.pending_replays.push_back({directory, path, bytes});
+    }
+    persistence.wake.notify_one();
+}
 
-void resetGame() {
-    player_x = (float)SCREEN_WIDTH / 2.0f - player_size / 2.0f;
-    player_y = (float)SCREEN_HEIGHT - player_size;
-    
-    obstacle_x = (float)SCREEN_WIDTH / 2.0f - obstacle_size / 2.0f;
-    obstacle_y = 0.0f;
+// Saves one achievement unlock with the JSON save. Instead of a snapshot (which copies the profile) the
+// save thread gets the username and id and adds the unlock to its own copy of the profiles. Nothing here
+// allocates once the queue is reserved, so unlocking mid-game doesn't touch the heap. Returns false if
+// the save thread has no copy of the profiles yet (nothing saved since loading); save normally then.
+bool queueAchievementUnlock(const std::string& username, const std::string* achievementId) {
+    if (profile_store.enabled || profile_store.json_rewrite_pending || username.size() > (size_t)MAX_USERNAME_LENGTH) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(persistence.mutex);
+        startPersistenceWorker();
+        persistence.pending_unlocks.push_back({username, achievementId});
+        persistence.requests++;
+    }
+    persistence.wake.notify_one();
+    return true;
+}
 
-    player_vx = 0.0f;
-    player_vy = 0.0f;
-    player_aim_angle = 0.0f;
-    ai_reaction_timer = 0;
+// Writes anything still queued and stops the save thread. Call before exiting.
+void shutdownPersistence() {
+    {
+        std::lock_guard<std::mutex> lock(persistence.mutex);
+        if (!persistence.started) {
+            return;
+        }
+        persistence.stopping = true;
+    }
+    persistence.wake.notify_one();
+    persistence.worker.join();
+    persistence.started = false;
+    TraceLog(LOG_INFO, "Save thread stopped (%llu save requests, %llu writes).",
+             (unsigned long long)persistence.requests, (unsigned long long)persistence.writes);
+}
 
-    start_time_s = 0.0;
-    elapsed_time_s = 0.0;
-    final_survival_time_s = 0.0;
-    is_new_high_score = false;
+// --- Save File Parsing ---
+// A small pull parser that reads the save file straight from the stream, one character at a time,
+// instead of slurping it into a string and find()-ing keys (which broke once there were nested objects
+// and was quadratic in the number of profiles). Unknown keys are skipped, so newer files still load.
+struct JsonReader {
+    std::streambuf* in = nullptr;
+    bool failed = false;
+    size_t position = 0; // Bytes consumed, for error messages
+    int depth = 0;       // Objects and arrays jsonSkipValue() is inside
+};
 
-    current_countdown_frame = countdown_time_seconds * FPS;
-    // Game state is set to COUNTDOWN from MAIN_MENU, not here
-    applyDifficulty("normal");
+static int jsonPeek(JsonReader& reader) {
+    return reader.failed ? EOF : reader.in->sgetc();
+}
 
-    if (win_music.frameCount > 0 && IsMusicStreamPlaying(win_music)) {
-        StopMusicStream(win_music);
+static int jsonNext(JsonReader& reader) {
+    if (reader.failed) {
+        return EOF;
     }
-    if (normal_music.frameCount > 0 && !IsMusicStreamPlaying(normal_music)) {
-        PlayMusicStream(normal_music);
+    int c = reader.in->sbumpc();
+    if (c != EOF) {
+        reader.position++;
     }
+    return c;
+}
 
-    projectiles.clear();
-    player_last_shot_time = -PLAYER_SHOOT_COOLDOWN;
+static void jsonSkipWhitespace(JsonReader& reader) {
+    int c = jsonPeek(reader);
+    while (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
+        jsonNext(reader);
+        c = jsonPeek(reader);
+    }
+}
 
-    obstacle_is_stunned = false;
-    obstacle_stun_end_time = 0.0;
-    player_last_stun_shot_time = -PLAYER_STUN_SHOT_COOLDOWN;
-    obstacle_last_shot_time = -OBSTACLE_SHOOT_COOLDOWN;
+// Consumes `expected` (after any whitespace) if it's next; returns whether it was
+static bool jsonConsume(JsonReader& reader, char expected) {
+    jsonSkipWhitespace(reader);
+    if (jsonPeek(reader) == expected) {
+        jsonNext(reader);
+        return true;
+    }
+    return false;
+}
 
-    player_is_dashing = false; // Reset dash state on game reset
-    player_dash_end_time = 0.0;
-    player_last_dash_time = -PLAYER_DASH_COOLDOWN; // Reset dash cooldown
-    player_dash_velocity_x = 0.0f; // Reset dash velocity
-    player_dash_velocity_y = 0.0f; // Reset dash velocity
-
-    player_is_stunned = false;
-    player_stun_end_time = 0.0;
-    obstacle_last_stun_time = -OBSTACLE_STUN_COOLDOWN;
-
-    // Reset dodge streak timer
-    dodge_streak_start_time = 0.0;
-    showing_time_bonus_message = false;
-    time_bonus_message_end_time = 0.0;
-
-    // Reset achievement tracking flags for new game
-    near_miss_achievement_unlocked_this_game = false;
-    obstacle_stuns_this_game = 0;
-    has_shot_this_game = false;
-    dash_through_projectile_achievement_unlocked_this_game = false;
-    current_achievement_popup_id = ""; // Clear any pending popup
-    achievement_popup_display_end_time = 0.0;
-
-    // Reset portal mode variables
-    portal_1_active = false;
-    portal_2_active = false;
-    last_teleport_time = 0.0;
-    portal_active_until_time_1 = 0.0;
-    portal_active_until_time_2 = 0.0;
-    next_projectile_portal_is_1 = true;
-    // is_portal_mode is set based on username, not reset here
+static bool jsonExpect(JsonReader& reader, char expected) {
+    if (!jsonConsume(reader, expected)) {
+        reader.failed = true;
+    }
+    return !reader.failed;
 }
 
-void applyDifficulty(const std::string& mode) {
-    current_difficulty_mode = "normal";
-    const DifficultySettings& settings = DIFFICULTY_SETTINGS["normal"];
-    player_speed = settings.player_speed;
-    obstacle_speed = settings.obstacle_speed;
-    ai_reaction_delay = settings.ai_reaction_delay;
-    TraceLog(LOG_INFO, "Difficulty forced to: normal (Player Speed: %.1f, Obstacle Speed: %.1f)", player_speed, obstacle_speed);
+static void jsonAppendUtf8(std::string& out, uint32_t code_point) {
+    if (code_point < 0x80) {
+        out += (char)code_point;
+    } else if (code_point < 0x800) {
+        out += (char)(0xC0 | (code_point >> 6));
+        out += (char)(0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+        out += (char)(0xE0 | (code_point >> 12));
+        out += (char)(0x80 | ((code_point >> 6) & 0x3F));
+        out += (char)(0x80 | (code_point & 0x3F));
+    } else {
+        out += (char)(0xF0 | (code_point >> 18));
+        out += (char)(0x80 | ((code_point >> 12) & 0x3F));
+        out += (char)(0x80 | ((code_point >> 6) & 0x3F));
+        out += (char)(0x80 | (code_point & 0x3F));
+    }
 }
 
-void updateGame(double deltaTime) {
-    if (current_game_state == GAME_STATE_TAMPERED) {
-        return;
+// Reads the four hex digits after \u
+static bool jsonReadHex4(JsonReader& reader, uint32_t* value) {
+    *value = 0;
+    for (int i = 0; i < 4; ++i) {
+        int digit = jsonNext(reader);
+        if (!isxdigit(digit)) {
+            reader.failed = true;
+            return false;
+        }
+        *value = *value * 16 + (isdigit(digit) ? digit - '0' : (tolower(digit) - 'a' + 10));
     }
+    return true;
+}
 
-    if (current_game_state == GAME_STATE_USERNAME_INPUT) {
-        for (int key = KEY_A; key <= KEY_Z; ++key) {
-            if (IsKeyPressed(key) && username_input_buffer.length() < MAX_USERNAME_LENGTH) {
-                username_input_buffer += (char)key;
-            }
+static std::string jsonReadString(JsonReader& reader) {
+    std::string text;
+    if (!jsonExpect(reader, '"')) {
+        return text;
+    }
+    // Characters past U+FFFF come as two \u escapes (a UTF-16 surrogate pair), so a high surrogate waits
+    // here for the low one; one without the other becomes U+FFFD
+    uint32_t high_surrogate = 0;
+    while (true) {
+        int c = jsonNext(reader);
+        if (c == EOF) {
+            reader.failed = true;
+            return text;
         }
-        for (int key = KEY_ZERO; key <= KEY_NINE; ++key) {
-            if (IsKeyPressed(key) && username_input_buffer.length() < MAX_USERNAME_LENGTH) {
-                username_input_buffer += (char)key;
+        uint32_t code_point = 0;
+        bool escaped_code_point = false;
+        if (c == '\\' && jsonPeek(reader) == 'u') {
+            jsonNext(reader);
+            if (!jsonReadHex4(reader, &code_point)) {
+                return text;
             }
+            escaped_code_point = true;
         }
-        if (IsKeyPressed(KEY_SPACE) && username_input_buffer.length() < MAX_USERNAME_LENGTH) {
-            username_input_buffer += ' ';
-        }
-        if (IsKeyPressed(KEY_MINUS) && username_input_buffer.length() < MAX_USERNAME_LENGTH) {
-            username_input_buffer += '-';
-        }
-
-        if (IsKeyPressed(KEY_BACKSPACE)) {
-            if (username_input_buffer.length() > 0) {
-                username_input_buffer.pop_back();
+        if (high_surrogate != 0) {
+            if (escaped_code_point && code_point >= 0xDC00 && code_point <= 0xDFFF) {
+                jsonAppendUtf8(text, 0x10000 + ((high_surrogate - 0xD800) << 10) + (code_point - 0xDC00));
+                high_surrogate = 0;
+                continue;
             }
+            jsonAppendUtf8(text, 0xFFFD);
+            high_surrogate = 0;
         }
-
-        if (IsKeyPressed(KEY_ENTER)) {
-            if (username_input_buffer.empty()) {
-                current_username = "Guest";
-            } else {
-                current_username = username_input_buffer;
-            }
-            // If "PORTAL" username is entered, go to achievement profile selection
-            if (current_username == "PORTAL") {
-                is_portal_mode = true; // Enable portal mode immediately for gameplay
-                TraceLog(LOG_INFO, "Portal mode enabled!");
-                
-                // Populate available_profile_names for selection
-                available_profile_names.clear();
-                for (const auto& pair : UNLOCKED_ACHIEVEMENTS_BY_USER) {
-                    available_profile_names.push_back(pair.first);
-                }
-                // Add current_username if it's not already in the list (e.g., brand new profile)
-                if (std::find(available_profile_names.begin(), available_profile_names.end(), current_username) == available_profile_names.end()) {
-                    available_profile_names.push_back(current_username);
-                }
-                // Sort for consistent display
-                std::sort(available_profile_names.begin(), available_profile_names.end());
-                
-                // Set selected_profile_index to the current_username if possible
-                selected_profile_index = 0;
-                for(size_t i = 0; i < available_profile_names.size(); ++i) {
-                    if (available_profile_names[i] == last_active_username) {
-                        selected_profile_index = i;
-                        break;
-                    }
-                }
-
-                current_game_state = GAME_STATE_SELECT_ACHIEVEMENT_PROFILE;
+        if (escaped_code_point) {
+            if (code_point >= 0xD800 && code_point <= 0xDBFF) {
+                high_surrogate = code_point;
             } else {
-                is_portal_mode = false; // Disable portal mode for other usernames
-                last_active_username = current_username; // Update last active username
-                saveGameData(); // Save the new current_username as last active
-                username_input_buffer = "";
-                current_game_state = GAME_STATE_MAIN_MENU; // Go to main menu
+                jsonAppendUtf8(text, (code_point >= 0xDC00 && code_point <= 0xDFFF) ? 0xFFFD : code_point);
             }
+            continue;
         }
-
-        // Only ESC to close window from username input screen
-        if (IsKeyPressed(KEY_ESCAPE)) {
-            CloseWindow(); // This will make WindowShouldClose() return true and exit the main loop
+        if (c == '"') {
+            return text;
         }
-
-    } else if (current_game_state == GAME_STATE_MAIN_MENU) {
-        if (IsKeyPressed(KEY_ENTER)) {
-            resetGame(); // Reset game state before starting
-            current_game_state = GAME_STATE_COUNTDOWN; // Start playing
+        if (c != '\\') {
+            text += (char)c;
+            continue;
         }
-        if (IsKeyPressed(KEY_A)) {
-            current_game_state = GAME_STATE_ACHIEVEMENTS;
+        c = jsonNext(reader);
+        switch (c) {
+            case '"': case '\\': case '/': text += (char)c; break;
+            case 'n': text += '\n'; break;
+            case 'r': text += '\r'; break;
+            case 't': text += '\t'; break;
+            case 'b': text += '\b'; break;
+            case 'f': text += '\f'; break;
+            default:
+                reader.failed = true;
+                return text;
         }
-        if (IsKeyPressed(KEY_P) || IsKeyPressed(KEY_ESCAPE)) { // P OR ESC to change profile
-            current_game_state = GAME_STATE_USERNAME_INPUT; // Go back to username input
-            username_input_buffer = current_username; // Pre-fill input with current username
+    }
+}
+
+static double jsonReadNumber(JsonReader& reader) {
+    jsonSkipWhitespace(reader);
+    char digits[64];
+    size_t length = 0;
+    int c = jsonPeek(reader);
+    while (c != EOF && (isdigit(c) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E')) {
+        if (length + 1 < sizeof(digits)) {
+            digits[length++] = (char)c;
         }
+        jsonNext(reader);
+        c = jsonPeek(reader);
+    }
+    digits[length] = '\0';
+    char* end = nullptr;
+    double value = strtod(digits, &end);
+    if (length == 0 || end != digits + length) {
+        reader.failed = true;
+        return 0.0;
+    }
+    return value;
+}
 
-    } else if (current_game_state == GAME_STATE_SELECT_ACHIEVEMENT_PROFILE) {
-        if (IsKeyPressed(KEY_UP)) {
-            selected_profile_index = (selected_profile_index - 1 + available_profile_names.size()) % available_profile_names.size();
+// Skips a value of any type, including nested objects and arrays
+static void jsonSkipValue(JsonReader& reader) {
+    jsonSkipWhitespace(reader);
+    int c = jsonPeek(reader);
+    if (c == '"') {
+        jsonReadString(reader);
+    } else if (c == '{' || c == '[') {
+        if (reader.depth >= SAVE_FILE_MAX_NESTING) {
+            reader.failed = true;
+            return;
         }
-        if (IsKeyPressed(KEY_DOWN)) {
-            selected_profile_index = (selected_profile_index + 1) % available_profile_names.size();
+        char close = (c == '{') ? '}' : ']';
+        jsonNext(reader);
+        if (jsonConsume(reader, close)) {
+            return;
         }
-        if (IsKeyPressed(KEY_ENTER)) {
-            std::string chosen_profile = available_profile_names[selected_profile_index];
-            unlockAchievement("portal_username", chosen_profile); // Unlock for chosen profile
-            
-            // After selection, go back to main menu to allow playing with "PORTAL"
-            current_username = "PORTAL"; // Keep username as PORTAL for gameplay
-            last_active_username = current_username; // Update last active username
-            saveGameData(); // Save the new last active username and achievement
-            username_input_buffer = ""; // Clear buffer for next input
-            current_game_state = GAME_STATE_MAIN_MENU; // Go to main menu after selection
+        reader.depth++;
+        do {
+            if (close == '}') {
+                jsonReadString(reader);
+                jsonExpect(reader, ':');
+            }
+            jsonSkipValue(reader);
+        } while (!reader.failed && jsonConsume(reader, ','));
+        reader.depth--;
+        jsonExpect(reader, close);
+    } else if (c == 't' || c == 'f' || c == 'n') {
+        while (isalpha(jsonPeek(reader))) { // true, false, null
+            jsonNext(reader);
         }
-        if (IsKeyPressed(KEY_ESCAPE)) {
-            current_game_state = GAME_STATE_USERNAME_INPUT; // Go back to username input
-            username_input_buffer = current_username; // Pre-fill input with current username
+    } else {
+        jsonReadNumber(reader);
+    }
+}
+
+// Calls on_member(key) for each member of an object; on_member must read (or skip) the value
+template <typename OnMember>
+static void jsonReadObject(JsonReader& reader, OnMember on_member) {
+    if (!jsonExpect(reader, '{') || jsonConsume(reader, '}')) {
+        return;
+    }
+    do {
+        std::string key = jsonReadString(reader);
+        if (!jsonExpect(reader, ':')) {
+            return;
         }
+        on_member(key);
+    } while (!reader.failed && jsonConsume(reader, ','));
+    jsonExpect(reader, '}');
+}
 
-    } else if (current_game_state == GAME_STATE_COUNTDOWN) {
-        current_countdown_frame--;
-        if (current_countdown_frame <= 0) {
-            current_game_state = GAME_STATE_PLAYING;
-            start_time_s = GetTime();
-            dodge_streak_start_time = GetTime(); // Initialize dodge streak timer
-            has_shot_this_game = false; // Reset for "Bullet Ballet Master"
-            obstacle_stuns_this_game = 0; // Reset for "Stunned Silence"
-            dash_through_projectile_achievement_unlocked_this_game = false; // Reset for "Dash of Genius"
+// Calls on_element() for each element of an array; on_element must read (or skip) the value
+template <typename OnElement>
+static void jsonReadArray(JsonReader& reader, OnElement on_element) {
+    if (!jsonExpect(reader, '[') || jsonConsume(reader, ']')) {
+        return;
+    }
+    do {
+        on_element();
+    } while (!reader.failed && jsonConsume(reader, ','));
+    jsonExpect(reader, ']');
+}
 
-            if (normal_music.frameCount > 0 && !IsMusicStreamPlaying(normal_music)) {
-                PlayMusicStream(normal_music);
-            }
-            if (win_music.frameCount > 0 && IsMusicStreamPlaying(win_music)) {
-                StopMusicStream(win_music);
+// Fills the usernames, achievements and high scores from a JSON save file. Anything read before a
+// syntax error is kept. Returns false if the file couldn't be opened.
+bool loadSaveFileJson(const std::string& path) {
+    std::ifstream inFile(path, std::ios::binary);
+    if (!inFile.is_open()) {
+        return false;
+    }
+    JsonReader reader;
+    reader.in = inFile.rdbuf();
+
+    UNLOCKED_ACHIEVEMENTS_BY_USER.clear(); // Clear before loading
+    HIGH_SCORES_BY_USER.clear();
+    profile_store.json_rewrite_pending = true; // The save thread's copy of the profiles is out of date now
+    std::map<std::string, double> legacy_high_scores; // Top-level scores, from before they were per user
+
+    // A score that isn't a number (null, say) is skipped rather than failing the rest of the file
+    auto read_scores = [&reader](std::map<std::string, double>& scores) {
+        jsonReadObject(reader, [&](const std::string& mode) {
+            jsonSkipWhitespace(reader);
+            int c = jsonPeek(reader);
+            if (isdigit(c) || c == '-') {
+                scores[mode] = jsonReadNumber(reader);
+            } else {
+                jsonSkipValue(reader);
             }
+        });
+    };
+
+    jsonReadObject(reader, [&](const std::string& key) {
+        if (key == "last_username") {
+            last_active_username = jsonReadString(reader);
+            current_username = last_active_username; // Set current_username to the last active one
+        } else if (key == "high_scores") {
+            read_scores(legacy_high_scores);
+        } else if (key == "user_data") {
+            jsonReadObject(reader, [&](const std::string& username) {
+                AchievementSet& unlocked = UNLOCKED_ACHIEVEMENTS_BY_USER[username];
+                jsonReadObject(reader, [&](const std::string& field) {
+                    if (field == "unlocked_achievements") {
+                        jsonReadArray(reader, [&]() {
+                            // Ids this version doesn't define are interned too, so they survive the next save
+                            AchievementId id = internAchievementId(jsonReadString(reader));
+                            if (id != ACHIEVEMENT_NONE) {
+                                unlocked.insert(id);
+                            }
+                        });
+                    } else if (field == "high_scores") {
+                        read_scores(HIGH_SCORES_BY_USER[username]);
+                    } else {
+                        jsonSkipValue(reader);
+                    }
+                });
+            });
+        } else {
+            jsonSkipValue(reader);
         }
-    } else if (current_game_state == GAME_STATE_PLAYING) {
-        elapsed_time_s = GetTime() - start_time_s;
+    });
 
-        // "Bullet Ballet Master" achievement check
-        // Check if player has survived for 30 seconds AND has not shot
-        if (!has_shot_this_game && elapsed_time_s >= 30.0) {
-            unlockAchievement("bullet_ballet_master", current_username);
-        }
-        // "Long-Haul Dodger" achievement check
-        if (elapsed_time_s >= 120.0) { // 2 minutes
-            unlockAchievement("long_haul_dodger", current_username);
-        }
+    if (reader.failed) {
+        TraceLog(LOG_WARNING, "Save file %s is malformed near byte %zu; keeping what was read before that.",
+                 path.c_str(), reader.position);
+    }
 
+    // Files written before scores were per user only have the last user's scores, at the top level
+    if (!legacy_high_scores.empty() && HIGH_SCORES_BY_USER.count(last_active_username) == 0) {
+        HIGH_SCORES_BY_USER[last_active_username] = legacy_high_scores;
+    }
+    return true;
+}
 
-        // Handle dash activation
-        if ((IsKeyPressed(KEY_LEFT_ALT) || IsKeyPressed(KEY_RIGHT_ALT)) && GetTime() - player_last_dash_time >= PLAYER_DASH_COOLDOWN) {
-            player_is_dashing = true;
-            player_dash_end_time = GetTime() + PLAYER_DASH_DURATION;
-            player_last_dash_time = GetTime();
+// --- Profile Switching ---
+// Makes `username` the active profile: its achievements and high scores become the current ones
+void switchToProfile(const std::string& username) {
+    current_username = username;
+    markStaticScreenDirty(); // Menus and the HUD show the profile's name and scores
+    ensureProfileLoaded(username);
+    high_scores = HIGH_SCORES_BY_USER[username];
+    if (high_scores.count("normal") == 0) {
+        high_scores["normal"] = 0.0;
+    }
+    // Room for every achievement up front, so unlocking one mid-game doesn't grow the set
+    AchievementSet& unlocked = UNLOCKED_ACHIEVEMENTS_BY_USER[username];
+    unlocked.words.resize(std::max(unlocked.words.size(), (ACHIEVEMENT_NAMES.size() + 63) / 64), 0);
+}
 
-            float dash_dir_x = 0.0f;
-            float dash_dir_y = 0.0f;
+// --- Binary Profile Store Functions ---
+static uint32_t profileNameHash(const std::string& username) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (unsigned char c : username) {
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
 
-            // Determine dash direction based on movement keys (arrows)
-            bool moving_up = IsKeyDown(KEY_UP);
-            bool moving_down = IsKeyDown(KEY_DOWN);
-            bool moving_left = IsKeyDown(KEY_LEFT);
-            bool moving_right = IsKeyDown(KEY_RIGHT);
+static std::string profileRecordName(const ProfileRecord& record) {
+    return std::string(record.username, strnlen(record.username, sizeof(record.username)));
+}
 
-            if (moving_up) dash_dir_y = -1.0f;
-            if (moving_down) dash_dir_y = 1.0f;
-            if (moving_left) dash_dir_x = -1.0f;
-            if (moving_right) dash_dir_x = 1.0f;
+static bool readProfileRecord(uint32_t record_number, ProfileRecord* record) {
+    off_t offset = (off_t)sizeof(ProfileStoreHeader) + (off_t)record_number * (off_t)sizeof(ProfileRecord);
+    return pread(profile_store.fd, record, sizeof(ProfileRecord), offset) == (ssize_t)sizeof(ProfileRecord);
+}
 
-            if (dash_dir_x == 0.0f && dash_dir_y == 0.0f) {
-                // If not moving, use aiming direction (WASD)
-                bool aiming_up = IsKeyDown(KEY_W);
-                bool aiming_down = IsKeyDown(KEY_S);
-                bool aiming_left = IsKeyDown(KEY_A);
-                bool aiming_right = IsKeyDown(KEY_D);
+// Looks a username up in the index and reads its record from disk. Only finds records that are on
+// disk; profiles created this session are found through loaded_records instead.
+static bool findProfileRecord(const std::string& username, ProfileRecord* record, uint32_t* record_number) {
+    if (profile_store.index.empty()) {
+        return false;
+    }
+    uint32_t hash = profileNameHash(username);
+    uint32_t mask = (uint32_t)profile_store.index.size() - 1;
+    for (uint32_t slot = hash & mask; ; slot = (slot + 1) & mask) {
+        const ProfileIndexEntry& entry = profile_store.index[slot];
+        if (entry.record_plus_one == 0) {
+            return false;
+        }
+        if (entry.name_hash == hash && readProfileRecord(entry.record_plus_one - 1, record) &&
+            profileRecordName(*record) == username) {
+            *record_number = entry.record_plus_one - 1;
+            return true;
+        }
+    }
+}
 
-                if (aiming_up) dash_dir_y = -1.0f;
-                if (aiming_down) dash_dir_y = 1.0f;
-                if (aiming_left) dash_dir_x = -1.0f;
-                if (aiming_right) dash_dir_x = 1.0f;
-            }
+static void placeProfileIndexEntry(std::vector<ProfileIndexEntry>& index, ProfileIndexEntry entry, uint32_t* placed_slot) {
+    uint32_t mask = (uint32_t)index.size() - 1;
+    uint32_t slot = entry.name_hash & mask;
+    while (index[slot].record_plus_one != 0) {
+        slot = (slot + 1) & mask;
+    }
+    index[slot] = entry;
+    if (placed_slot) {
+        *placed_slot = slot;
+    }
+}
 
-            // Normalize dash direction to ensure consistent speed for diagonals
-            float dash_length = sqrtf(dash_dir_x * dash_dir_x + dash_dir_y * dash_dir_y);
-            if (dash_length > 0) {
-                dash_dir_x /= dash_length;
-                dash_dir_y /= dash_length;
-            } else {
-                // If no direction input at all, default to dashing upwards
-                dash_dir_y = -1.0f;
+// Adds a record to the index, doubling the table when it would become more than half full
+static void insertProfileIndex(uint32_t hash, uint32_t record_number) {
+    if (profile_store.index.empty() || (profile_store.index_used + 1) * 2 > profile_store.index.size()) {
+        std::vector<ProfileIndexEntry> grown(std::max<size_t>(64, profile_store.index.size() * 2), ProfileIndexEntry{0, 0});
+        for (const ProfileIndexEntry& entry : profile_store.index) {
+            if (entry.record_plus_one != 0) {
+                placeProfileIndexEntry(grown, entry, nullptr);
             }
+        }
+        profile_store.index.swap(grown);
+        profile_store.index_rewrite_pending = true;
+        profile_store.changed_index_slots.clear();
+    }
+    uint32_t slot = 0;
+    placeProfileIndexEntry(profile_store.index, ProfileIndexEntry{record_number + 1, hash}, &slot);
+    profile_store.index_used++;
+    if (!profile_store.index_rewrite_pending) {
+        profile_store.changed_index_slots.push_back(slot);
+    }
+}
 
-            // Calculate dash velocity
-            float dash_speed_per_frame = PLAYER_DASH_DISTANCE / PLAYER_DASH_DURATION;
-            player_dash_velocity_x = dash_dir_x * dash_speed_per_frame;
-            player_dash_velocity_y = dash_dir_y * dash_speed_per_frame;
+// Bit for an achievement id in ProfileRecord::achievement_bits, adding the id to the header if it's new.
+// Returns -1 once all the bits are taken.
+static int achievementBit(const std::string& achievement_id) {
+    ProfileStoreHeader& header = profile_store.header;
+    for (uint32_t i = 0; i < header.achievement_id_count; ++i) {
+        if (achievement_id == header.achievement_ids[i]) {
+            return (int)i;
         }
+    }
+    if (header.achievement_id_count >= (uint32_t)PROFILE_STORE_MAX_ACHIEVEMENTS ||
+        achievement_id.size() >= sizeof(header.achievement_ids[0])) {
+        TraceLog(LOG_WARNING, "Profile store can't hold achievement '%s'; it won't be saved.", achievement_id.c_str());
+        return -1;
+    }
+    strncpy(header.achievement_ids[header.achievement_id_count], achievement_id.c_str(), sizeof(header.achievement_ids[0]) - 1);
+    return (int)header.achievement_id_count++;
+}
 
-        // Update player position based on dash or normal movement
-        if (player_is_dashing) {
-            player_x += player_dash_velocity_x * deltaTime;
-            player_y += player_dash_velocity_y * deltaTime;
+// Score slot for a difficulty mode in ProfileRecord::high_scores, adding the mode to the header if it's new.
+// Returns -1 once all the slots are taken.
+static int highScoreSlot(const std::string& mode) {
+    ProfileStoreHeader& header = profile_store.header;
+    for (uint32_t i = 0; i < header.mode_count; ++i) {
+        if (mode == header.mode_names[i]) {
+            return (int)i;
+        }
+    }
+    if (header.mode_count >= (uint32_t)PROFILE_STORE_MAX_MODES || mode.size() >= sizeof(header.mode_names[0])) {
+        TraceLog(LOG_WARNING, "Profile store can't hold high scores for mode '%s'; they won't be saved.", mode.c_str());
+        return -1;
+    }
+    strncpy(header.mode_names[header.mode_count], mode.c_str(), sizeof(header.mode_names[0]) - 1);
+    return (int)header.mode_count++;
+}
 
-            // Check if dash duration has ended
-            if (GetTime() > player_dash_end_time) {
-                player_is_dashing = false;
-                player_dash_velocity_x = 0.0f; // Stop dash movement
-                player_dash_velocity_y = 0.0f;
-                TraceLog(LOG_INFO, "Player dash ended.");
+// Builds the record for a profile from the in-memory maps
+static ProfileRecord makeProfileRecord(const std::string& username) {
+    ProfileRecord record = {};
+    strncpy(record.username, username.c_str(), sizeof(record.username) - 1);
+    auto scores = HIGH_SCORES_BY_USER.find(username);
+    if (scores != HIGH_SCORES_BY_USER.end()) {
+        for (const auto& score : scores->second) {
+            int slot = highScoreSlot(score.first);
+            if (slot >= 0) {
+                record.high_scores[slot] = score.second;
+                record.score_bits |= 1u << slot;
             }
-        } else {
-            // Normal movement (only if not stunned)
-            player_vx = 0.0f;
-            player_vy = 0.0f;
-            if (!player_is_stunned) {
-                if (IsKeyDown(KEY_UP)) player_vy = -player_speed;
-                if (IsKeyDown(KEY_DOWN)) player_vy = player_speed;
-                if (IsKeyDown(KEY_LEFT)) player_vx = -player_speed;
-                if (IsKeyDown(KEY_RIGHT)) player_vx = player_speed;
-
-                player_x += player_vx;
-                player_y += player_vy;
-
-                // Update aiming angle based on movement or aiming keys
-                bool aiming_up = IsKeyDown(KEY_W);
-                bool aiming_down = IsKeyDown(KEY_S);
-                bool aiming_left = IsKeyDown(KEY_A);
-                bool aiming_right = IsKeyDown(KEY_D);
-
-                if (aiming_up || aiming_down || aiming_left || aiming_right) {
-                    if (aiming_up && !aiming_left && !aiming_right) player_aim_angle = -PI / 2.0f;
-                    else if (aiming_down && !aiming_left && !aiming_right) player_aim_angle = PI / 2.0f;
-                    else if (aiming_left && !aiming_up && !aiming_down) player_aim_angle = PI;
-                    else if (aiming_right && !aiming_up && !aiming_down) player_aim_angle = 0.0f;
-                    else if (aiming_up && aiming_left) player_aim_angle = -3.0f * PI / 4.0f;
-                    else if (aiming_up && aiming_right) player_aim_angle = -PI / 4.0f;
-                    else if (aiming_down && aiming_left) player_aim_angle = 3.0f * PI / 4.0f;
-                    else if (aiming_down && aiming_right) player_aim_angle = PI / 4.0f;
-                }
-                else if (player_vx != 0 || player_vy != 0) {
-                    player_aim_angle = atan2f(player_vy, player_vx);
-                }
-            } else {
-                // If player is stunned, check for stun end time
-                if (GetTime() > player_stun_end_time) {
-                    player_is_stunned = false;
-                    TraceLog(LOG_INFO, "Player stun ended.");
-                }
+        }
+    }
+    auto unlocked = UNLOCKED_ACHIEVEMENTS_BY_USER.find(username);
+    if (unlocked != UNLOCKED_ACHIEVEMENTS_BY_USER.end()) {
+        for (const std::string& achievement_id : achievementNames(unlocked->second)) {
+            int bit = achievementBit(achievement_id);
+            if (bit >= 0) {
+                record.achievement_bits |= (uint64_t)1 << bit;
             }
         }
+    }
+    return record;
+}
 
-        // Player wrap-around (applies to both normal movement and dash movement)
-        if (player_x < -player_size) player_x = (float)SCREEN_WIDTH;
-        else if (player_x > SCREEN_WIDTH) player_x = -player_size;
-        
-        if (player_y < -player_size) player_y = (float)SCREEN_HEIGHT;
-        else if (player_y > SCREEN_HEIGHT) player_y = -player_size;
+// Loads a profile into the in-memory maps if it isn't there yet. With the binary store that's the
+// first time its record is read; a name that isn't in the store becomes a new profile.
+void ensureProfileLoaded(const std::string& username) {
+    if (UNLOCKED_ACHIEVEMENTS_BY_USER.count(username)) {
+        return;
+    }
+    AchievementSet& unlocked = UNLOCKED_ACHIEVEMENTS_BY_USER[username];
+    if (!profile_store.enabled) {
+        profile_store.dirty.insert(username); // New profile; written with the next save
+        return;
+    }
+    ProfileRecord record;
+    uint32_t record_number = 0;
+    if (findProfileRecord(username, &record, &record_number)) {
+        for (uint32_t i = 0; i < profile_store.header.achievement_id_count; ++i) {
+            if (record.achievement_bits & ((uint64_t)1 << i)) {
+                AchievementId id = internAchievementId(profile_store.header.achievement_ids[i]);
+                if (id != ACHIEVEMENT_NONE) {
+                    unlocked.insert(id);
+                }
+            }
+        }
+        std::map<std::string, double>& scores = HIGH_SCORES_BY_USER[username];
+        for (uint32_t i = 0; i < profile_store.header.mode_count; ++i) {
+            if (record.score_bits & (1u << i)) {
+                scores[profile_store.header.mode_names[i]] = record.high_scores[i];
+            }
+        }
+        profile_store.loaded_records[username] = record_number;
+    } else {
+        profile_store.dirty.insert(username); // New profile; gets a record at the next save
+    }
+}
 
-        // --- Portal Mode Logic (Teleportation and Timed Deactivation) ---
-        if (is_portal_mode) {
-            // Portal deactivation over time
-            if (portal_1_active && GetTime() > portal_active_until_time_1) {
-                portal_1_active = false;
-                TraceLog(LOG_INFO, "Portal 1 deactivated due to time.");
+// Opens dodger_profiles.bin and loads its index (rebuilding the index if needed). Records stay on disk.
+bool openProfileStore() {
+    int fd = open(profile_store.path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    ProfileStoreHeader header;
+    struct stat file_info;
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, PROFILE_STORE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != PROFILE_STORE_VERSION ||
+        header.achievement_id_count > (uint32_t)PROFILE_STORE_MAX_ACHIEVEMENTS ||
+        header.mode_count > (uint32_t)PROFILE_STORE_MAX_MODES ||
+        fstat(fd, &file_info) != 0 ||
+        (off_t)file_info.st_size < (off_t)sizeof(header) + (off_t)header.record_count * (off_t)sizeof(ProfileRecord)) {
+        TraceLog(LOG_WARNING, "Profile store %s is damaged or from another version.", profile_store.path.c_str());
+        close(fd);
+        return false;
+    }
+    header.last_username[sizeof(header.last_username) - 1] = '\0';
+    for (auto& achievement_id : header.achievement_ids) {
+        achievement_id[sizeof(achievement_id) - 1] = '\0';
+    }
+    for (auto& mode : header.mode_names) {
+        mode[sizeof(mode) - 1] = '\0';
+    }
+    profile_store.fd = fd;
+    profile_store.header = header;
+    profile_store.loaded_records.clear();
+    profile_store.dirty.clear();
+    profile_store.changed_index_slots.clear();
+    profile_store.index_rewrite_pending = false;
+
+    // Load the index if it matches the records...
+    bool index_loaded = false;
+    std::ifstream index_file(profile_store.index_path, std::ios::binary);
+    ProfileIndexHeader index_header;
+    if (index_file.read((char*)&index_header, sizeof(index_header)) &&
+        memcmp(index_header.magic, PROFILE_INDEX_MAGIC, sizeof(index_header.magic)) == 0 &&
+        index_header.record_count == header.record_count &&
+        index_header.capacity >= 64 && (index_header.capacity & (index_header.capacity - 1)) == 0 &&
+        index_header.capacity >= (uint64_t)header.record_count * 2) {
+        profile_store.index.assign(index_header.capacity, ProfileIndexEntry{0, 0});
+        index_loaded = (bool)index_file.read((char*)profile_store.index.data(), (std::streamsize)(index_header.capacity * sizeof(ProfileIndexEntry)));
+    }
+    profile_store.index_used = header.record_count;
+
+    // ...otherwise rebuild it from the names in the records
+    if (!index_loaded) {
+        TraceLog(LOG_WARNING, "Rebuilding profile index %s from %u records.", profile_store.index_path.c_str(), header.record_count);
+        size_t capacity = 64;
+        while (capacity < (size_t)header.record_count * 2 + 2) {
+            capacity *= 2;
+        }
+        profile_store.index.assign(capacity, ProfileIndexEntry{0, 0});
+        std::vector<ProfileRecord> records(4096);
+        for (uint32_t first = 0; first < header.record_count; first += (uint32_t)records.size()) {
+            uint32_t count = std::min<uint32_t>((uint32_t)records.size(), header.record_count - first);
+            off_t offset = (off_t)sizeof(header) + (off_t)first * (off_t)sizeof(ProfileRecord);
+            if (pread(fd, records.data(), count * sizeof(ProfileRecord), offset) != (ssize_t)(count * sizeof(ProfileRecord))) {
+                close(fd);
+                profile_store.fd = -1;
+                return false;
             }
-            if (portal_2_active && GetTime() > portal_active_until_time_2) {
-                portal_2_active = false;
-                TraceLog(LOG_INFO, "Portal 2 deactivated due to time.");
+            for (uint32_t i = 0; i < count; ++i) {
+                placeProfileIndexEntry(profile_store.index,
+                                       ProfileIndexEntry{first + i + 1, profileNameHash(profileRecordName(records[i]))}, nullptr);
             }
+        }
+        profile_store.index_rewrite_pending = true; // Written with the next save
+    }
+    profile_store.enabled = true;
+    TraceLog(LOG_INFO, "Opened profile store %s (%u profiles).", profile_store.path.c_str(), header.record_count);
+    return true;
+}
 
-            // Teleport logic for player
-            if (portal_1_active && portal_2_active && GetTime() - last_teleport_time >= TELEPORT_COOLDOWN) {
-                Vector2 player_center = {player_x + player_size / 2.0f, player_y + player_size / 2.0f};
+// Creates the binary store from whatever is in the in-memory maps (i.e. migrates the JSON save), then opens it
+bool createProfileStore() {
+    ProfileStoreHeader header = {};
+    memcpy(header.magic, PROFILE_STORE_MAGIC, sizeof(header.magic));
+    header.version = PROFILE_STORE_VERSION;
+    strncpy(header.last_username, last_active_username.c_str(), sizeof(header.last_username) - 1);
+    profile_store.header = header;
+    highScoreSlot("normal"); // Always slot 0
+    profile_store.index.clear();
+    profile_store.index_used = 0;
+
+    // Users with scores but no achievements entry are migrated too
+    std::set<std::string> usernames;
+    for (const auto& user_entry : UNLOCKED_ACHIEVEMENTS_BY_USER) {
+        usernames.insert(user_entry.first);
+    }
+    for (const auto& user_entry : HIGH_SCORES_BY_USER) {
+        usernames.insert(user_entry.first);
+    }
+    std::string records;
+    records.reserve(usernames.size() * sizeof(ProfileRecord));
+    for (const std::string& username : usernames) {
+        if (username.empty() || username.size() > (size_t)MAX_USERNAME_LENGTH) {
+            TraceLog(LOG_WARNING, "Not migrating profile '%s': name too long for the profile store.", username.c_str());
+            continue;
+        }
+        ProfileRecord record = makeProfileRecord(username);
+        insertProfileIndex(profileNameHash(username), profile_store.header.record_count++);
+        records.append((const char*)&record, sizeof(record));
+    }
 
-                // Check collision with Portal 1
-                if (CheckCollisionCircles(player_center, player_size / 2.0f, portal_1_pos, PORTAL_RADIUS)) {
-                    player_x = portal_2_pos.x - player_size / 2.0f;
-                    player_y = portal_2_pos.y - player_size / 2.0f;
-                    last_teleport_time = GetTime();
-                    TraceLog(LOG_INFO, "Teleported player from Portal 1 to Portal 2.");
-                }
-                // Check collision with Portal 2
-                else if (CheckCollisionCircles(player_center, player_size / 2.0f, portal_2_pos, PORTAL_RADIUS)) {
-                    player_x = portal_1_pos.x - player_size / 2.0f;
-                    player_y = portal_1_pos.y - player_size / 2.0f;
-                    last_teleport_time = GetTime();
-                    TraceLog(LOG_INFO, "Teleported player from Portal 2 to Portal 1.");
-                }
+    std::string store_contents((const char*)&profile_store.header, sizeof(ProfileStoreHeader));
+    store_contents += records;
+    ProfileIndexHeader index_header = {};
+    memcpy(index_header.magic, PROFILE_INDEX_MAGIC, sizeof(index_header.magic));
+    index_header.capacity = (uint32_t)profile_store.index.size();
+    index_header.record_count = profile_store.header.record_count;
+    std::string index_contents((const char*)&index_header, sizeof(index_header));
+    index_contents.append((const char*)profile_store.index.data(), profile_store.index.size() * sizeof(ProfileIndexEntry));
+
+    // The index goes first: if we crash in between there's no store, so the JSON save is migrated again
+    if (!writeSaveFileAtomically(profile_store.index_path, index_contents, 0) ||
+        !writeSaveFileAtomically(profile_store.path, store_contents, 0)) {
+        TraceLog(LOG_ERROR, "Could not create profile store %s.", profile_store.path.c_str());
+        return false;
+    }
+    TraceLog(LOG_INFO, "Migrated %u profiles to %s.", profile_store.header.record_count, profile_store.path.c_str());
+    return openProfileStore();
+}
+
+// Moves the changed profiles (and the header/index changes they cause) into a save snapshot
+static void collectProfileStoreChanges(SaveSnapshot& snapshot) {
+    snapshot.binary = true;
+    snapshot.store_path = profile_store.path;
+    snapshot.index_path = profile_store.index_path;
+    strncpy(profile_store.header.last_username, snapshot.last_username.c_str(), sizeof(profile_store.header.last_username) - 1);
+    profile_store.header.last_username[sizeof(profile_store.header.last_username) - 1] = '\0';
+
+    for (const std::string& username : profile_store.dirty) {
+        if (username.empty() || username.size() > (size_t)MAX_USERNAME_LENGTH) {
+            continue; // Can't happen through the username screen, which limits the length
+        }
+        auto loaded = profile_store.loaded_records.find(username);
+        uint32_t record_number = 0;
+        if (loaded != profile_store.loaded_records.end()) {
+            record_number = loaded->second;
+        } else {
+            ProfileRecord existing;
+            if (!findProfileRecord(username, &existing, &record_number)) {
+                record_number = profile_store.header.record_count++;
+                insertProfileIndex(profileNameHash(username), record_number);
             }
+            profile_store.loaded_records[username] = record_number;
+        }
+        snapshot.store_records[record_number] = makeProfileRecord(username); // May add achievement ids to the header
+    }
+    profile_store.dirty.clear();
+    snapshot.store_header = profile_store.header;
+
+    if (profile_store.index_rewrite_pending) {
+        snapshot.store_index_rewrite = true;
+        snapshot.store_index = profile_store.index;
+    } else {
+        for (uint32_t slot : profile_store.changed_index_slots) {
+            snapshot.store_index_updates[slot] = profile_store.index[slot];
+        }
+    }
+    profile_store.index_rewrite_pending = false;
+    profile_store.changed_index_slots.clear();
+}
 
-            // Teleport logic for obstacle (separate cooldown not needed if last_teleport_time is for any entity)
-            // If separate cooldowns are needed for player and obstacle, new variables would be required.
-            // For now, using the same last_teleport_time for simplicity, meaning if player teleports, obstacle can't immediately.
-            if (portal_1_active && portal_2_active && GetTime() - last_teleport_time >= TELEPORT_COOLDOWN) {
-                Vector2 obstacle_center = {obstacle_x + obstacle_size / 2.0f, obstacle_y + obstacle_size / 2.0f};
+static bool pwriteAll(int fd, const void* data, size_t size, off_t offset) {
+    const char* bytes = (const char*)data;
+    while (size > 0) {
+        ssize_t written = pwrite(fd, bytes, size, offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        bytes += written;
+        size -= (size_t)written;
+        offset += written;
+    }
+    return true;
+}
 
-                // Check collision with Portal 1
-                if (CheckCollisionCircles(obstacle_center, obstacle_size / 2.0f, portal_1_pos, PORTAL_RADIUS)) {
-                    obstacle_x = portal_2_pos.x - obstacle_size / 2.0f;
-                    obstacle_y = portal_2_pos.y - obstacle_size / 2.0f;
-                    last_teleport_time = GetTime();
-                    TraceLog(LOG_INFO, "Teleported obstacle from Portal 1 to Portal 2.");
-                }
-                // Check collision with Portal 2
-                else if (CheckCollisionCircles(obstacle_center, obstacle_size / 2.0f, portal_2_pos, PORTAL_RADIUS)) {
-                    obstacle_x = portal_1_pos.x - obstacle_size / 2.0f;
-                    obstacle_y = portal_1_pos.y - obstacle_size / 2.0f;
-                    last_teleport_time = GetTime();
-                    TraceLog(LOG_INFO, "Teleported obstacle from Portal 2 to Portal 1.");
-                }
+// Writes a binary-store snapshot (on the save thread). Records are written and synced before the
+// header that counts them, and the index last, so a crash leaves at worst an index that gets rebuilt.
+bool writeProfileStoreChanges(const SaveSnapshot& snapshot, int injectedDelayMs) {
+    if (injectedDelayMs > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(injectedDelayMs));
+    }
+    int fd = open(snapshot.store_path.c_str(), O_WRONLY);
+    if (fd < 0) {
+        TraceLog(LOG_ERROR, "Could not open %s for saving.", snapshot.store_path.c_str());
+        return false;
+    }
+    bool ok = true;
+    for (const auto& record : snapshot.store_records) {
+        off_t offset = (off_t)sizeof(ProfileStoreHeader) + (off_t)record.first * (off_t)sizeof(ProfileRecord);
+        ok = ok && pwriteAll(fd, &record.second, sizeof(ProfileRecord), offset);
+    }
+    ok = ok && fsync(fd) == 0;
+    ok = ok && pwriteAll(fd, &snapshot.store_header, sizeof(ProfileStoreHeader), 0);
+    ok = ok && fsync(fd) == 0;
+    close(fd);
+    if (!ok) {
+        TraceLog(LOG_ERROR, "Failed to save profile store %s.", snapshot.store_path.c_str());
+        return false;
+    }
+
+    ProfileIndexHeader index_header = {};
+    memcpy(index_header.magic, PROFILE_INDEX_MAGIC, sizeof(index_header.magic));
+    index_header.record_count = snapshot.store_header.record_count;
+    if (snapshot.store_index_rewrite) {
+        index_header.capacity = (uint32_t)snapshot.store_index.size();
+        std::string index_contents((const char*)&index_header, sizeof(index_header));
+        index_contents.append((const char*)snapshot.store_index.data(), snapshot.store_index.size() * sizeof(ProfileIndexEntry));
+        return writeSaveFileAtomically(snapshot.index_path, index_contents, 0);
+    }
+    fd = open(snapshot.index_path.c_str(), O_RDWR);
+    ProfileIndexHeader old_header;
+    if (fd < 0 || pread(fd, &old_header, sizeof(old_header), 0) != (ssize_t)sizeof(old_header)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return true; // The store itself is saved; a missing index is rebuilt on the next start
+    }
+    index_header.capacity = old_header.capacity;
+    for (const auto& update : snapshot.store_index_updates) {
+        off_t offset = (off_t)sizeof(ProfileIndexHeader) + (off_t)update.first * (off_t)sizeof(ProfileIndexEntry);
+        ok = ok && pwriteAll(fd, &update.second, sizeof(ProfileIndexEntry), offset);
+    }
+    ok = ok && pwriteAll(fd, &index_header, sizeof(index_header), 0) && fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+// Every profile name, for the PORTAL profile list. With the binary store this reads every record's
+// name, which is fine for a menu that's opened by hand.
+std::vector<std::string> listProfileNames() {
+    std::set<std::string> names;
+    for (const auto& user_entry : UNLOCKED_ACHIEVEMENTS_BY_USER) {
+        names.insert(user_entry.first);
+    }
+    if (profile_store.enabled && profile_store.fd >= 0) {
+        std::vector<ProfileRecord> records(4096);
+        uint32_t on_disk = 0;
+        ProfileStoreHeader header;
+        if (pread(profile_store.fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header)) {
+            on_disk = header.record_count;
+        }
+        for (uint32_t first = 0; first < on_disk; first += (uint32_t)records.size()) {
+            uint32_t count = std::min<uint32_t>((uint32_t)records.size(), on_disk - first);
+            off_t offset = (off_t)sizeof(ProfileStoreHeader) + (off_t)first * (off_t)sizeof(ProfileRecord);
+            ssize_t got = pread(profile_store.fd, records.data(), count * sizeof(ProfileRecord), offset);
+            for (ssize_t i = 0; i < got / (ssize_t)sizeof(ProfileRecord); ++i) {
+                names.insert(profileRecordName(records[i]));
             }
         }
+    }
+    return std::vector<std::string>(names.begin(), names.end());
+}
+
+void loadGameData() {
+    // The binary store takes over once it exists (or once --binary-profiles asks for it)
+    bool store_exists = access(profile_store.path.c_str(), F_OK) == 0;
+    if (store_exists && openProfileStore()) {
+        UNLOCKED_ACHIEVEMENTS_BY_USER.clear();
+        HIGH_SCORES_BY_USER.clear();
+        last_active_username = profile_store.header.last_username;
+        if (last_active_username.empty()) {
+            last_active_username = "Guest";
+        }
+        switchToProfile(last_active_username);
+        TraceLog(LOG_INFO, "Game data loaded successfully. Last active username: %s", current_username.c_str());
+        return;
+    }
+    if (store_exists) {
+        TraceLog(LOG_WARNING, "Falling back to %s; the damaged profile store is left alone.", SAVE_FILE_NAME.c_str());
+    }
+    bool migrate = profile_store.enabled && !store_exists; // enabled was set by --binary-profiles
+    profile_store.enabled = false;
 
+    if (loadSaveFileJson(SAVE_FILE_NAME)) {
+        TraceLog(LOG_INFO, "Loaded game data from %s (%zu profiles).", SAVE_FILE_NAME.c_str(), UNLOCKED_ACHIEVEMENTS_BY_USER.size());
+    } else {
+        TraceLog(LOG_INFO, "Save file %s not found or could not be opened. Initializing default data.", SAVE_FILE_NAME.c_str());
+        initializeDefaultGameData();
+    }
 
-        if (IsKeyPressed(KEY_LEFT_SHIFT) || IsKeyPressed(KEY_RIGHT_SHIFT)) {
-            has_shot_this_game = true; // Player has shot, "Bullet Ballet Master" is now impossible this game
-            if (GetTime() - player_last_shot_time >= PLAYER_SHOOT_COOLDOWN) {
-                Projectile newProjectile;
-                newProjectile.rect = {player_x + player_size / 2.0f - PROJECTILE_SIZE / 2.0f,
-                                      player_y + player_size / 2.0f - PROJECTILE_SIZE / 2.0f,
-                                      PROJECTILE_SIZE, PROJECTILE_SIZE};
-                newProjectile.speed = PROJECTILE_SPEED;
-                newProjectile.velocity.x = cosf(player_aim_angle);
-                newProjectile.velocity.y = sinf(player_aim_angle);
-                newProjectile.active = true;
-                newProjectile.is_player_shot = true;
-                newProjectile.bounces_remaining = MAX_PROJECTILE_BOUNCES;
-                projectiles.push_back(newProjectile);
-                player_last_shot_time = GetTime();
-            }
-        }
-
-        if (!obstacle_is_stunned && GetTime() - obstacle_last_shot_time >= OBSTACLE_SHOOT_COOLDOWN) {
-            Projectile obstacleProjectile;
-            float obstacle_center_x = obstacle_x + obstacle_size / 2.0f;
-            float obstacle_center_y = obstacle_y + obstacle_size / 2.0f;
-
-            obstacleProjectile.rect = {obstacle_center_x - PROJECTILE_SIZE / 2.0f,
-                                       obstacle_center_y - PROJECTILE_SIZE / 2.2f, // Slightly adjusted Y to originate from center
-                                       PROJECTILE_SIZE, PROJECTILE_SIZE};
-            obstacleProjectile.speed = OBSTACLE_PROJECTILE_SPEED;
-
-            float angle_to_player = atan2f(player_y - obstacle_y, player_x - obstacle_x);
-            obstacleProjectile.velocity.x = cosf(angle_to_player);
-            obstacleProjectile.velocity.y = sinf(angle_to_player);
-
-            float nudge_distance = obstacle_size / 2.0f + PROJECTILE_SIZE / 2.0f + 5.0f;
-            obstacleProjectile.rect.x += obstacleProjectile.velocity.x * nudge_distance;
-            obstacleProjectile.rect.y += obstacleProjectile.velocity.y * nudge_distance;
-
-            obstacleProjectile.active = true;
-            obstacleProjectile.is_player_shot = false;
-            obstacleProjectile.bounces_remaining = MAX_PROJECTILE_BOUNCES;
-            projectiles.push_back(obstacleProjectile);
-            obstacle_last_shot_time = GetTime();
-        }
-
-        for (auto& p : projectiles) {
-            if (p.active) {
-                p.rect.x += p.velocity.x * p.speed;
-                p.rect.y += p.velocity.y * p.speed;
-
-                // --- Portal Creation Logic (if in portal mode and player shot) ---
-                if (is_portal_mode && p.is_player_shot) {
-                    bool hit_for_portal = false;
-                    Vector2 portal_spawn_pos = {0,0};
-
-                    // Calculate projectile center for accurate hit point
-                    Vector2 projectile_center = {p.rect.x + p.rect.width / 2.0f, p.rect.y + p.rect.height / 2.0f};
-
-                    // Check collision with screen edges for portal
-                    // Use a small buffer to ensure it's "on" the edge, not just past it
-                    float edge_buffer = 1.0f; // 1 pixel buffer
-                    if (p.rect.x <= edge_buffer || p.rect.x + p.rect.width >= SCREEN_WIDTH - edge_buffer ||
-                        p.rect.y <= edge_buffer || p.rect.y + p.rect.height >= SCREEN_HEIGHT - edge_buffer) {
-                        hit_for_portal = true;
-                        // Determine exact impact point for portal placement
-                        // Clamp to screen edges for precise placement
-                        portal_spawn_pos.x = fmaxf(0.0f, fminf((float)SCREEN_WIDTH, projectile_center.x));
-                        portal_spawn_pos.y = fmaxf(0.0f, fminf((float)SCREEN_HEIGHT, projectile_center.y));
-                    }
+    if (migrate && createProfileStore()) {
+        // From here on profiles are read from the store as they're needed
+        UNLOCKED_ACHIEVEMENTS_BY_USER.clear();
+        HIGH_SCORES_BY_USER.clear();
+    }
+    switchToProfile(current_username);
+    if (!profile_store.enabled) {
+        saveGameData(); // Gives the save thread its copy of every profile, so unlocks mid-game only send what changed
+    }
+    TraceLog(LOG_INFO, "Game data loaded successfully. Last active username: %s", current_username.c_str());
+}
 
-                    // Check collision with obstacle for portal
-                    if (!hit_for_portal && CheckCollisionRecs(p.rect, {obstacle_x, obstacle_y, obstacle_size, obstacle_size})) {
-                        hit_for_portal = true;
-                        portal_spawn_pos = {obstacle_x + obstacle_size / 2.0f, obstacle_y + obstacle_size / 2.0f};
-                    }
+// Helper function to unlock an achievement for a specific user
+void unlockAchievement(AchievementId achievementId, const std::string& targetUsername) {
+    // Check if the achievement exists in ALL_ACHIEVEMENTS
+    if (achievementId >= ACHIEVEMENTS_BY_ID.size() || ACHIEVEMENTS_BY_ID[achievementId] == nullptr) {
+        TraceLog(LOG_WARNING, "Attempted to unlock non-existent achievement: %s",
+                 achievementId < ACHIEVEMENT_NAMES.size() ? ACHIEVEMENT_NAMES[achievementId].c_str() : "(unknown id)");
+        return;
+    }
 
-                    if (hit_for_portal) {
-                        p.active = false; // Deactivate projectile as it created a portal
-                        
-                        if (next_projectile_portal_is_1) {
-                            portal_1_active = true;
-                            portal_1_pos = portal_spawn_pos;
-                            portal_active_until_time_1 = GetTime() + PORTAL_ACTIVE_DURATION;
-                            next_projectile_portal_is_1 = false; // Next one will be portal 2
-                            TraceLog(LOG_INFO, "Portal 1 created by projectile at (%.1f, %.1f)", portal_1_pos.x, portal_1_pos.y);
-                        } else {
-                            portal_2_active = true;
-                            portal_2_pos = portal_spawn_pos;
-                            portal_active_until_time_2 = GetTime() + PORTAL_ACTIVE_DURATION;
-                            next_projectile_portal_is_1 = true; // Next one will be portal 1
-                            TraceLog(LOG_INFO, "Portal 2 created by projectile at (%.1f, %.1f)", portal_2_pos.x, portal_2_pos.y);
-                        }
-                        continue; // Skip further processing for this projectile (no bouncing)
-                    }
-                }
-                // --- End Portal Creation Logic ---
-
-                // --- Projectile Boundary Handling (Bouncing then Wrapping) ---
-                bool bounced_on_x = false;
-                bool bounced_on_y = false;
-
-                // Check X-axis for bouncing
-                if (p.bounces_remaining > 0) {
-                    if (p.rect.x < 0) { // Hit left edge
-                        p.rect.x = 0; // Place exactly on edge
-                        p.velocity.x *= -1; // Reverse velocity
-                        p.bounces_remaining--;
-                        bounced_on_x = true;
-                    } else if (p.rect.x + p.rect.width > SCREEN_WIDTH) { // Hit right edge
-                        p.rect.x = (float)SCREEN_WIDTH - p.rect.width; // Place exactly on edge
-                        p.velocity.x *= -1; // Reverse velocity
-                        p.bounces_remaining--;
-                        bounced_on_x = true;
-                    }
-                }
-                
-                // Check Y-axis for bouncing
-                if (p.bounces_remaining > 0) { // Re-check bounces_remaining in case X-bounce used one up
-                    if (p.rect.y < 0) { // Hit top edge
-                        p.rect.y = 0; // Place exactly on edge
-                        p.velocity.y *= -1; // Reverse velocity
-                        p.bounces_remaining--;
-                        bounced_on_y = true;
-                    } else if (p.rect.y + p.rect.height > SCREEN_HEIGHT) { // Hit bottom edge
-                        p.rect.y = (float)SCREEN_HEIGHT - p.rect.height; // Place exactly on edge
-                        p.velocity.y *= -1; // Reverse velocity
-                        p.bounces_remaining--;
-                        bounced_on_y = true;
-                    }
-                }
+    // Ensure the target user's entry exists in UNLOCKED_ACHIEVEMENTS_BY_USER (read from the profile store if needed)
+    ensureProfileLoaded(targetUsername);
 
-                // If bounces are exhausted (or were already 0), apply wrap-around
-                // This check needs to be separate to ensure it only happens *after* potential bounces
-                if (p.bounces_remaining <= 0 && !bounced_on_x && !bounced_on_y) {
-                    // Apply wrap-around for X
-                    if (p.rect.x < -p.rect.width) {
-                        p.rect.x = (float)SCREEN_WIDTH;
-                    } else if (p.rect.x > SCREEN_WIDTH) {
-                        p.rect.x = -p.rect.width;
-                    }
-                    
-                    // Apply wrap-around for Y
-                    if (p.rect.y < -p.rect.height) {
-                        p.rect.y = (float)SCREEN_HEIGHT;
-                    } else if (p.rect.y > SCREEN_HEIGHT) {
-                        p.rect.y = -p.rect.height;
-                    }
+    // insert() says whether it was already unlocked for the target user
+    if (UNLOCKED_ACHIEVEMENTS_BY_USER.at(targetUsername).insert(achievementId)) {
+        TraceLog(LOG_INFO, "Achievement Unlocked for %s: %s", targetUsername.c_str(), ACHIEVEMENTS_BY_ID[achievementId]->name.c_str());
+        // Save immediately when an achievement is unlocked, without copying profiles on the frame thread if we can
+        if (!queueAchievementUnlock(targetUsername, &ACHIEVEMENTS_BY_ID[achievementId]->id)) {
+            profile_store.dirty.insert(targetUsername);
+            saveGameData();
+        }
+        markStaticScreenDirty(); // The achievements screen shows it now
+
+        // Only show popup if the achievement was unlocked for the currently active user
+        if (targetUsername == current_username) {
+            current_achievement_popup = achievementId;
+            achievement_popup_display_end_time = GetTime() + ACHIEVEMENT_POPUP_DURATION;
+        }
+    }
+}
+
+void unlockAchievement(const std::string& achievementId, const std::string& targetUsername) {
+    AchievementId id = findAchievementId(achievementId);
+    if (id == ACHIEVEMENT_NONE) {
+        TraceLog(LOG_WARNING, "Attempted to unlock non-existent achievement: %s", achievementId.c_str());
+        return;
+    }
+    unlockAchievement(id, targetUsername);
+}
+
+// Function to initialize all achievement definitions
+void initializeAchievementDefinitions() {
+    ALL_ACHIEVEMENTS.clear(); // Clear any previous definitions
+
+    ALL_ACHIEVEMENTS.emplace("portal_username", Achievement(
+        "portal_username",
+        "vrooom wait that's too *whoosh*",
+        "Set your username to 'PORTAL'.",
+        true // This is a secret achievement
+    ));
+    ALL_ACHIEVEMENTS.emplace("near_miss", Achievement(
+        "near_miss",
+        "*whew* that was a close call",
+        "Perform a truly close dodge against a projectile."
+    ));
+    ALL_ACHIEVEMENTS.emplace("bullet_ballet_master", Achievement(
+        "bullet_ballet_master",
+        "Bullet Ballet Master",
+        "Survive for 30 seconds without firing a single shot."
+    ));
+    ALL_ACHIEVEMENTS.emplace("stunned_silence", Achievement(
+        "stunned_silence",
+        "Stunned Silence",
+        "Stun the enemy obstacle 3 times in one game."
+    ));
+    ALL_ACHIEVEMENTS.emplace("dash_of_genius", Achievement(
+        "dash_of_genius",
+        "Dash of Genius",
+        "Successfully dash through an enemy projectile."
+    ));
+    ALL_ACHIEVEMENTS.emplace("long_haul_dodger", Achievement(
+        "long_haul_dodger",
+        "Long-Haul Dodger",
+        "Survive for 120 seconds (2 minutes)."
+    ));
+    // Add more achievements here! (Ones earned in play also need a row in ACHIEVEMENT_RULES.)
+
+    // Intern them, then point the ids back at the definitions
+    for (auto& entry : ALL_ACHIEVEMENTS) {
+        entry.second.index = internAchievementId(entry.first);
+    }
+    ACHIEVEMENTS_BY_ID.assign(ACHIEVEMENT_NAMES.size(), nullptr);
+    for (const auto& entry : ALL_ACHIEVEMENTS) {
+        if (entry.second.index != ACHIEVEMENT_NONE) {
+            ACHIEVEMENTS_BY_ID[entry.second.index] = &entry.second;
+        }
+    }
+    buildAchievementEngine(achievement_engine, ACHIEVEMENT_RULES, sizeof(ACHIEVEMENT_RULES) / sizeof(ACHIEVEMENT_RULES[0]));
+    for (const AchievementRule& rule : achievement_engine.rules) {
+        if (ACHIEVEMENTS_BY_ID[rule.achievement] == nullptr) {
+            TraceLog(LOG_WARNING, "Achievement rule for undefined achievement: %s", ACHIEVEMENT_NAMES[rule.achievement].c_str());
+        }
+    }
+}
+
+
+void resetGame() {
+    SimOptions options;
+    options.world_width = SCREEN_WIDTH;
+    options.world_height = SCREEN_HEIGHT;
+    options.portal_mode = is_portal_mode;
+    options.stress_projectiles = stress_projectile_count;
+    options.swarm_size = swarm_obstacle_count;
+    if (DIFFICULTY_SETTINGS.count(current_difficulty_mode) == 0) {
+        current_difficulty_mode = "normal"; // Only the difficulties in DIFFICULTY_SETTINGS can be played
+    }
+    options.difficulty_mode = current_difficulty_mode;
+    resetSimulation(sim, options);
+    replayBegin(game_replay, options, current_username);
+    sim_accumulator = 0.0;
+    sim_render_alpha = 0.0f;
+    latched_input = InputSnapshot();
+    is_new_high_score = false;
+
+    current_countdown_frame = countdown_time_seconds * FPS;
+    // Game state is set to COUNTDOWN from MAIN_MENU, not here
+
+    if (win_music.frameCount > 0 && IsMusicStreamPlaying(win_music)) {
+        StopMusicStream(win_music);
+    }
+    if (normal_music.frameCount > 0 && !IsMusicStreamPlaying(normal_music)) {
+        PlayMusicStream(normal_music);
+    }
+
+    current_achievement_popup = ACHIEVEMENT_NONE; // Clear any pending popup
+    achievement_popup_display_end_time = 0.0;
+    // is_portal_mode is set based on username, not reset here
+}
+
+// Sets one game's speeds for a difficulty mode. Only reads DIFFICULTY_SETTINGS, so replay verification
+// and --tune can reset games on several threads at once.
+void applyDifficulty(SimState& s, const std::string& mode) {
+    auto settings = DIFFICULTY_SETTINGS.find(mode);
+    if (settings == DIFFICULTY_SETTINGS.end()) {
+        simLog("Unknown difficulty %s; playing normal", mode.c_str());
+        settings = DIFFICULTY_SETTINGS.find("normal");
+    }
+    s.tuning.player_speed = settings->second.player_speed;
+    s.tuning.obstacle_speed = settings->second.obstacle_speed;
+    s.tuning.ai_reaction_delay = settings->second.ai_reaction_delay;
+    simLog("Difficulty set to: %s (Player Speed: %.1f, Obstacle Speed: %.1f)", settings->first.c_str(),
+           s.tuning.player_speed, s.tuning.obstacle_speed);
+}
+
+void simLog(const char* format, ...) {
+    if (sim_log_hook == nullptr) {
+        return;
+    }
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    sim_log_hook(message);
+}
+
+// Same tests as raylib's CheckCollisionRecs/CheckCollisionCircles, kept here so the simulation doesn't need raylib
+static inline bool rectsOverlap(const Rectangle& a, const Rectangle& b) {
+    return a.x < b.x + b.width && a.x + a.width > b.x &&
+           a.y < b.y + b.height && a.y + a.height > b.y;
+}
+
+static inline bool circlesOverlap(Vector2 center1, float radius1, Vector2 center2, float radius2) {
+    float dx = center2.x - center1.x;
+    float dy = center2.y - center1.y;
+    float radii = radius1 + radius2;
+    return dx * dx + dy * dy <= radii * radii;
+}
+
+// The one random number generator used everywhere the game needs repeatable randomness (stress spawns,
+// swarm placement, the headless/tuning bots, benchmarks): advances state (a Numerical Recipes LCG) and
+// returns its top 24 bits, since the low bits of an LCG are poor.
+static inline uint32_t nextRandom(uint32_t& state) {
+    state = state * 1664525u + 1013904223u;
+    return state >> 8;
+}
+
+// Same, as a float in [0, 1)
+static inline float nextRandomUnit(uint32_t& state) {
+    return nextRandom(state) / 16777216.0f;
+}
+
+void initProjectilePool(ProjectilePool& pool, int capacity) {
+    pool.capacity = capacity;
+    // Padding slots are never handed out, so they stay dead (zero velocity, no flags) forever
+    const int padded = (capacity + PROJECTILE_BATCH - 1) / PROJECTILE_BATCH * PROJECTILE_BATCH;
+    pool.x.assign(padded, 0.0f);
+    pool.y.assign(padded, 0.0f);
+    pool.prev_x.assign(padded, 0.0f);
+    pool.prev_y.assign(padded, 0.0f);
+    pool.vx.assign(padded, 0.0f);
+    pool.vy.assign(padded, 0.0f);
+    pool.bounces_remaining.assign(padded, 0);
+    pool.flags.assign(padded, 0u);
+    pool.candidate.assign(padded, 0u);
+    pool.free_slots.clear();
+    pool.free_slots.reserve(capacity);
+    pool.high_water = 0;
+    pool.live_count = 0;
+    pool.stress_count = 0;
+}
+
+void clearProjectilePool(ProjectilePool& pool) {
+    std::fill(pool.flags.begin(), pool.flags.begin() + pool.high_water, 0u);
+    std::fill(pool.vx.begin(), pool.vx.begin() + pool.high_water, 0.0f);
+    std::fill(pool.vy.begin(), pool.vy.begin() + pool.high_water, 0.0f);
+    pool.free_slots.clear();
+    pool.high_water = 0;
+    pool.live_count = 0;
+    pool.stress_count = 0;
+}
+
+// Returns the slot used, or -1 if the pool is full (the shot is simply not fired)
+int spawnProjectile(ProjectilePool& pool, float x, float y, float vx, float vy, bool isPlayerShot) {
+    int slot;
+    if (!pool.free_slots.empty()) {
+        slot = pool.free_slots.back();
+        pool.free_slots.pop_back();
+    } else if (pool.high_water < pool.capacity) {
+        slot = pool.high_water++;
+    } else {
+        return -1;
+    }
+    pool.x[slot] = pool.prev_x[slot] = x;
+    pool.y[slot] = pool.prev_y[slot] = y;
+    pool.vx[slot] = vx;
+    pool.vy[slot] = vy;
+    pool.bounces_remaining[slot] = MAX_PROJECTILE_BOUNCES;
+    pool.flags[slot] = PROJECTILE_ACTIVE | (isPlayerShot ? PROJECTILE_PLAYER_SHOT : 0u);
+    pool.live_count++;
+    return slot;
+}
+
+void releaseProjectile(ProjectilePool& pool, int slot) {
+    if (pool.flags[slot] & PROJECTILE_STRESS) {
+        pool.stress_count--;
+    }
+    pool.flags[slot] = 0u;
+    pool.vx[slot] = 0.0f; // Dead slots still go through the batch pass, so park them
+    pool.vy[slot] = 0.0f;
+    pool.free_slots.push_back(slot);
+    pool.live_count--;
+}
+
+static inline int gridColumn(const BroadphaseGrid& grid, float x) {
+    int col = (int)((x - grid.origin_x) * grid.inv_cell_size); // Truncation is fine, anything below 0 is clamped
+    return std::min(std::max(col, 0), grid.cols - 1);
+}
+
+static inline int gridRow(const BroadphaseGrid& grid, float y) {
+    int row = (int)((y - grid.origin_y) * grid.inv_cell_size);
+    return std::min(std::max(row, 0), grid.rows - 1);
+}
+
+// Cells covering the world-space box [left, right] x [top, bottom]
+static GridCellRange gridCellsCovering(const BroadphaseGrid& grid, float left, float top, float right, float bottom) {
+    GridCellRange range;
+    range.col_min = gridColumn(grid, left);
+    range.col_max = gridColumn(grid, right);
+    range.row_min = gridRow(grid, top);
+    range.row_max = gridRow(grid, bottom);
+    return range;
+}
+
+static inline bool sameCells(const GridCellRange& a, const GridCellRange& b) {
+    return a.col_min == b.col_min && a.col_max == b.col_max && a.row_min == b.row_min && a.row_max == b.row_max;
+}
+
+static void addOccupancy(BroadphaseGrid& grid, const GridCellRange& range, int delta) {
+    for (int row = range.row_min; row <= range.row_max; ++row) {
+        for (int col = range.col_min; col <= range.col_max; ++col) {
+            grid.occupancy[row * grid.cols + col] += delta;
+        }
+    }
+}
+
+// Sizes the grid for the world and empties it. Obstacles and the player have to be added again.
+void initBroadphaseGrid(BroadphaseGrid& grid, int worldWidth, int worldHeight, int obstacleCount) {
+    // A cell must be at least as big as the area covered by an obstacle plus a projectile, so that
+    // an obstacle never needs more than the 2x2 cells (4 nodes) it has
+    const float cell_size = std::max(BROADPHASE_CELL_SIZE, obstacle_size + PROJECTILE_SIZE);
+    grid.world_width = worldWidth;
+    grid.world_height = worldHeight;
+    grid.cols = (int)ceilf((worldWidth + 2.0f * BROADPHASE_MARGIN) / cell_size);
+    grid.rows = (int)ceilf((worldHeight + 2.0f * BROADPHASE_MARGIN) / cell_size);
+    grid.origin_x = -BROADPHASE_MARGIN;
+    grid.origin_y = -BROADPHASE_MARGIN;
+    grid.inv_cell_size = 1.0f / cell_size;
+    grid.occupancy.assign(grid.cols * grid.rows, 0u);
+    grid.cell_head.assign(grid.cols * grid.rows, -1);
+    grid.node_next.assign(obstacleCount * 4, -1);
+    grid.node_prev.assign(obstacleCount * 4, -1);
+    grid.node_cell.assign(obstacleCount * 4, -1);
+    grid.obstacle_cells.assign(obstacleCount, GridCellRange());
+    grid.player_cells = GridCellRange();
+    grid.query_stamp.assign(obstacleCount, 0u);
+    grid.query_id = 0;
+    grid.query_results.clear();
+    grid.query_results.reserve(obstacleCount);
+}
+
+// Re-links obstacle `index` if it moved into different cells since the last call
+void updateObstacleCells(BroadphaseGrid& grid, int index, const Obstacle& obstacle) {
+    // A projectile touches the obstacle only if its top-left corner is within this box
+    GridCellRange cells = gridCellsCovering(grid, obstacle.x - PROJECTILE_SIZE, obstacle.y - PROJECTILE_SIZE,
+                                            obstacle.x + obstacle_size, obstacle.y + obstacle_size);
+    if (sameCells(cells, grid.obstacle_cells[index])) {
+        return;
+    }
+
+    for (int node = index * 4; node < index * 4 + 4; ++node) {
+        int cell = grid.node_cell[node];
+        if (cell < 0) {
+            continue;
+        }
+        if (grid.node_prev[node] >= 0) {
+            grid.node_next[grid.node_prev[node]] = grid.node_next[node];
+        } else {
+            grid.cell_head[cell] = grid.node_next[node];
+        }
+        if (grid.node_next[node] >= 0) {
+            grid.node_prev[grid.node_next[node]] = grid.node_prev[node];
+        }
+        grid.node_cell[node] = -1;
+    }
+    addOccupancy(grid, grid.obstacle_cells[index], -1);
+
+    int node = index * 4;
+    for (int row = cells.row_min; row <= cells.row_max; ++row) {
+        for (int col = cells.col_min; col <= cells.col_max; ++col, ++node) {
+            int cell = row * grid.cols + col;
+            grid.node_cell[node] = cell;
+            grid.node_prev[node] = -1;
+            grid.node_next[node] = grid.cell_head[cell];
+            if (grid.cell_head[cell] >= 0) {
+                grid.node_prev[grid.cell_head[cell]] = node;
+            }
+            grid.cell_head[cell] = node;
+        }
+    }
+    addOccupancy(grid, cells, 1);
+    grid.obstacle_cells[index] = cells;
+}
+
+// Moves the player's reach (the area where obstacle projectiles hit or nearly miss) to new cells if needed
+void updatePlayerCells(BroadphaseGrid& grid, const Rectangle& reach) {
+    GridCellRange cells = gridCellsCovering(grid, reach.x - PROJECTILE_SIZE, reach.y - PROJECTILE_SIZE,
+                                            reach.x + reach.width, reach.y + reach.height);
+    if (sameCells(cells, grid.player_cells)) {
+        return;
+    }
+    addOccupancy(grid, grid.player_cells, -1);
+    addOccupancy(grid, cells, 1);
+    grid.player_cells = cells;
+}
+
+// Lists (each once) every obstacle whose rectangle might overlap `area`; callers still do the exact test.
+// The result is reused by the next call.
+const std::vector<int>& findObstaclesNear(BroadphaseGrid& grid, const Rectangle& area) {
+    grid.query_results.clear();
+    if (++grid.query_id == 0) { // Wrapped around: old stamps could collide with new ids
+        std::fill(grid.query_stamp.begin(), grid.query_stamp.end(), 0u);
+        grid.query_id = 1;
+    }
+    // Every obstacle is linked into the cell holding its own top-left corner
+    GridCellRange cells = gridCellsCovering(grid, area.x - obstacle_size, area.y - obstacle_size,
+                                            area.x + area.width, area.y + area.height);
+    for (int row = cells.row_min; row <= cells.row_max; ++row) {
+        for (int col = cells.col_min; col <= cells.col_max; ++col) {
+            for (int node = grid.cell_head[row * grid.cols + col]; node >= 0; node = grid.node_next[node]) {
+                int index = node / 4;
+                if (grid.query_stamp[index] != grid.query_id) {
+                    grid.query_stamp[index] = grid.query_id;
+                    grid.query_results.push_back(index);
+                }
+            }
+        }
+    }
+    return grid.query_results;
+}
+
+// Moves every projectile one tick, then bounces it off the screen edges (while it has bounces left)
+// or wraps it around. Branch-free over [0, count) so it vectorizes; dead slots are processed
+// too but have zero velocity and are never read. count must be a multiple of PROJECTILE_BATCH.
+// Edges are ignored for slots whose flags intersect edge_skip_mask (see integrateProjectiles).
+// Takes plain restrict pointers rather than the pool: GCC won't vectorize this loop otherwise.
+static void integrateProjectileArrays(float* __restrict px, float* __restrict py,
+                                      float* __restrict ppx, float* __restrict ppy,
+                                      float* __restrict pvx, float* __restrict pvy,
+                                      int32_t* __restrict bounces, const uint32_t* __restrict flags,
+                                      uint32_t edge_skip_mask, int count, float world_w, float world_h) {
+    const float size = PROJECTILE_SIZE;
+
+    // Conditions are 0/1 integers combined with & and |, and results are picked by blending with
+    // those 0/1 weights rather than with if/?:, so the loop body has no branches at all.
+    // Every weight is exactly 0 or 1, so the blends reproduce the plain if/else results bit for bit.
+    // The inner loop has a fixed trip count: at -O2 GCC only vectorizes loops it can cover completely
+    // with vector code, which rules out a single loop over a run-time count.
+    for (int batch = 0; batch < count; batch += PROJECTILE_BATCH)
+    for (int i = batch; i < batch + PROJECTILE_BATCH; ++i) {
+        const int32_t edges_apply = (int32_t)((flags[i] & edge_skip_mask) == 0u);
+        float x = px[i];
+        float y = py[i];
+        float vx = pvx[i];
+        float vy = pvy[i];
+        int32_t b = bounces[i];
+        ppx[i] = x;
+        ppy[i] = y;
+        x += vx;
+        y += vy;
+
+        // Bounce on X first, then Y (if a bounce is still left)
+        const int32_t hit_left = edges_apply & (int32_t)(b > 0) & (int32_t)(x < 0.0f);
+        const int32_t hit_right = edges_apply & (int32_t)(b > 0) & (hit_left ^ 1) & (int32_t)(x + size > world_w);
+        const int32_t bounced_on_x = hit_left | hit_right;
+        b -= bounced_on_x;
+
+        const int32_t hit_top = edges_apply & (int32_t)(b > 0) & (int32_t)(y < 0.0f);
+        const int32_t hit_bottom = edges_apply & (int32_t)(b > 0) & (hit_top ^ 1) & (int32_t)(y + size > world_h);
+        const int32_t bounced_on_y = hit_top | hit_bottom;
+        b -= bounced_on_y;
+
+        // Out of bounces (and didn't just bounce): wrap around
+        const int32_t wraps = edges_apply & (int32_t)(b <= 0) & ((bounced_on_x | bounced_on_y) ^ 1);
+        const int32_t wrap_left = wraps & (int32_t)(x < -size);
+        const int32_t wrap_right = wraps & (int32_t)(x > world_w);
+        const int32_t wrap_top = wraps & (int32_t)(y < -size);
+        const int32_t wrap_bottom = wraps & (int32_t)(y > world_h);
+
+        const float keep_x = (float)((hit_left | hit_right | wrap_left | wrap_right) ^ 1);
+        const float keep_y = (float)((hit_top | hit_bottom | wrap_top | wrap_bottom) ^ 1);
+        px[i] = x * keep_x + (float)hit_right * (world_w - size) + (float)wrap_left * world_w - (float)wrap_right * size;
+        py[i] = y * keep_y + (float)hit_bottom * (world_h - size) + (float)wrap_top * world_h - (float)wrap_bottom * size;
+        pvx[i] = vx * (1.0f - 2.0f * (float)bounced_on_x);
+        pvy[i] = vy * (1.0f - 2.0f * (float)bounced_on_y);
+        bounces[i] = b;
+    }
+}
+
+// In portal mode, player shots are left at the edge instead, so the portal pass can turn them into portals.
+// Runs up to the next multiple of PROJECTILE_BATCH past high_water; the slots in between are dead.
+static void integrateProjectiles(ProjectilePool& pool, float world_w, float world_h, bool portalMode) {
+    const int count = (pool.high_water + PROJECTILE_BATCH - 1) / PROJECTILE_BATCH * PROJECTILE_BATCH;
+    integrateProjectileArrays(pool.x.data(), pool.y.data(), pool.prev_x.data(), pool.prev_y.data(),
+                              pool.vx.data(), pool.vy.data(), pool.bounces_remaining.data(), pool.flags.data(),
+                              portalMode ? PROJECTILE_PLAYER_SHOT : 0u, count, world_w, world_h);
+}
+
+// Marks the projectiles that could touch an obstacle or the player (including the near-miss ring),
+// or that may create a portal: those whose top-left corner is in an occupied grid cell, plus
+// player shots in portal mode. Everything else needs no further work this tick. Also branch-free.
+static void findProjectileCandidates(ProjectilePool& pool, const BroadphaseGrid& grid, bool portalMode) {
+    const int count = pool.high_water;
+    const float* __restrict px = pool.x.data();
+    const float* __restrict py = pool.y.data();
+    const uint32_t* __restrict flags = pool.flags.data();
+    const uint32_t* __restrict occupancy = grid.occupancy.data();
+    uint32_t* __restrict candidate = pool.candidate.data();
+    const uint32_t portal_mask = portalMode ? PROJECTILE_PLAYER_SHOT : 0u;
+
+    for (int i = 0; i < count; ++i) {
+        const int cell = gridRow(grid, py[i]) * grid.cols + gridColumn(grid, px[i]);
+        const bool occupied = occupancy[cell] != 0u;
+        const bool portal_shot = (flags[i] & portal_mask) != 0u;
+        candidate[i] = (flags[i] & PROJECTILE_ACTIVE) & (uint32_t)(occupied | portal_shot);
+    }
+}
+
+// Keeps options.stress_projectiles extra projectiles in flight on top of the gameplay shots,
+// spawning replacements at random spots
+static void topUpStressProjectiles(SimState& s) {
+    while (s.projectiles.stress_count < s.stress_projectiles) {
+        float angle = nextRandomUnit(s.stress_rng) * 2.0f * PI;
+        bool is_player_shot = nextRandomUnit(s.stress_rng) < 0.5f;
+        float speed = is_player_shot ? PROJECTILE_SPEED : OBSTACLE_PROJECTILE_SPEED;
+        int slot = spawnProjectile(s.projectiles,
+                                   nextRandomUnit(s.stress_rng) * (s.world_width - PROJECTILE_SIZE),
+                                   nextRandomUnit(s.stress_rng) * (s.world_height - PROJECTILE_SIZE),
+                                   cosf(angle) * speed, sinf(angle) * speed, is_player_shot);
+        if (slot < 0) {
+            break;
+        }
+        s.projectiles.flags[slot] |= PROJECTILE_STRESS;
+        s.projectiles.stress_count++;
+    }
+}
+
+// --- Achievement engine ---
+
+// Interns an achievement id, giving it the next AchievementId if it's new. Main thread only.
+AchievementId internAchievementId(const std::string& name) {
+    auto found = ACHIEVEMENT_IDS.find(name);
+    if (found != ACHIEVEMENT_IDS.end()) {
+        return found->second;
+    }
+    if (ACHIEVEMENT_NAMES.size() >= ACHIEVEMENT_NONE) {
+        TraceLog(LOG_WARNING, "Too many achievement ids, ignoring '%s'.", name.c_str());
+        return ACHIEVEMENT_NONE;
+    }
+    AchievementId id = (AchievementId)ACHIEVEMENT_NAMES.size();
+    ACHIEVEMENT_NAMES.push_back(name);
+    ACHIEVEMENT_IDS[name] = id;
+    ACHIEVEMENTS_BY_ID.push_back(nullptr);
+    return id;
+}
+
+// ACHIEVEMENT_NONE if the id has never been seen
+AchievementId findAchievementId(const std::string& name) {
+    auto found = ACHIEVEMENT_IDS.find(name);
+    return found != ACHIEVEMENT_IDS.end() ? found->second : ACHIEVEMENT_NONE;
+}
+
+// The id strings in a set, sorted (for the save file; the save thread adds queued unlocks in place)
+std::vector<std::string> achievementNames(const AchievementSet& set) {
+    std::vector<std::string> names;
+    for (size_t word = 0; word < set.words.size(); ++word) {
+        for (uint64_t bits = set.words[word]; bits != 0; bits &= bits - 1) {
+            names.push_back(ACHIEVEMENT_NAMES[word * 64 + __builtin_ctzll(bits)]);
+        }
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+// Interns the rules' achievements and indexes the rules by event type
+void buildAchievementEngine(AchievementEngine& engine, const AchievementRuleDefinition* definitions, size_t count) {
+    engine = AchievementEngine();
+    for (size_t i = 0; i < count; ++i) {
+        const AchievementRuleDefinition& definition = definitions[i];
+        AchievementId achievement = internAchievementId(definition.achievement);
+        if (achievement == ACHIEVEMENT_NONE || engine.rules.size() >= UINT16_MAX) {
+            continue;
+        }
+        uint16_t rule = (uint16_t)engine.rules.size();
+        engine.rules.push_back({achievement, definition.event, definition.kind, definition.threshold, definition.cancelled_by});
+        engine.triggered_by[definition.event].push_back(rule);
+        engine.subscriptions[definition.event]++;
+        if (definition.cancelled_by >= 0 && definition.cancelled_by != definition.event) {
+            engine.cancelled_by[definition.cancelled_by].push_back(rule);
+            engine.subscriptions[definition.cancelled_by]++;
+        }
+    }
+}
+
+// Start of a game: every rule is open again. Keeps the vectors' memory.
+void resetAchievementProgress(const AchievementEngine& engine, AchievementProgress& progress) {
+    progress.counts.assign(engine.rules.size(), 0);
+    progress.finished.assign(engine.rules.size(), 0);
+    progress.events.clear();
+    progress.events.reserve(ACHIEVEMENT_EVENTS_RESERVE); // So publishing doesn't allocate mid-game
+    progress.listening = 0;
+    for (int type = 0; type < SIM_EVENT_TYPE_COUNT; ++type) {
+        progress.open_subscriptions[type] = engine.subscriptions[type];
+        if (engine.subscriptions[type] > 0) {
+            progress.listening |= simEventBit(type);
+        }
+    }
+}
+
+// Called from the gameplay code; costs a bit test when no rule cares about the event type
+static inline void publishSimEvent(SimState& s, SimEventType type, double value = 0.0) {
+    if (s.achievements.listening & simEventBit(type)) {
+        s.achievements.events.push_back({type, value});
+    }
+}
+
+// A rule fired or was ruled out: it stops listening, and so do event types nothing else listens to
+static void finishAchievementRule(const AchievementEngine& engine, AchievementProgress& progress, uint16_t rule) {
+    progress.finished[rule] = 1;
+    const AchievementRule& definition = engine.rules[rule];
+    if (--progress.open_subscriptions[definition.event] == 0) {
+        progress.listening &= ~simEventBit(definition.event);
+    }
+    if (definition.cancelled_by >= 0 && definition.cancelled_by != definition.event) {
+        if (--progress.open_subscriptions[definition.cancelled_by] == 0) {
+            progress.listening &= ~simEventBit(definition.cancelled_by);
+        }
+    }
+}
+
+// Runs the events published since the last call past the rules subscribed to them, in the order they
+// happened, and appends the achievements that fired.
+void processAchievementEvents(const AchievementEngine& engine, AchievementProgress& progress, std::vector<AchievementId>& unlocked) {
+    for (const SimEvent& event : progress.events) {
+        for (uint16_t rule : engine.cancelled_by[event.type]) {
+            if (!progress.finished[rule]) {
+                finishAchievementRule(engine, progress, rule);
+            }
+        }
+        for (uint16_t rule : engine.triggered_by[event.type]) {
+            if (progress.finished[rule]) {
+                continue;
+            }
+            const AchievementRule& definition = engine.rules[rule];
+            bool fired;
+            if (definition.kind == RULE_COUNT_AT_LEAST) {
+                fired = ++progress.counts[rule] >= definition.threshold;
+            } else {
+                fired = event.value >= definition.threshold;
+            }
+            if (fired) {
+                unlocked.push_back(definition.achievement);
+                finishAchievementRule(engine, progress, rule);
+            }
+        }
+    }
+    progress.events.clear();
+}
+
+void resetSimulation(SimState& s, const SimOptions& options) {
+    // Keep the projectile pool's and grid's memory across games; everything else goes back to its default
+    ProjectilePool pool = std::move(s.projectiles);
+    BroadphaseGrid grid = std::move(s.grid);
+    std::vector<Obstacle> obstacles = std::move(s.obstacles);
+    AchievementProgress achievements = std::move(s.achievements);
+    std::vector<AchievementId> pending_achievements = std::move(s.pending_achievements);
+    s = SimState();
+    s.projectiles = std::move(pool);
+    s.grid = std::move(grid);
+    s.obstacles = std::move(obstacles);
+    s.achievements = std::move(achievements);
+    s.pending_achievements = std::move(pending_achievements);
+    s.pending_achievements.clear();
+    s.pending_achievements.reserve(GAME_ACHIEVEMENTS_RESERVE); // So an unlock doesn't allocate mid-game
+    resetAchievementProgress(achievement_engine, s.achievements);
+    int capacity = DEFAULT_PROJECTILE_CAPACITY + options.stress_projectiles;
+    if (s.projectiles.capacity != capacity) {
+        initProjectilePool(s.projectiles, capacity);
+    } else {
+        clearProjectilePool(s.projectiles);
+    }
+
+    s.world_width = options.world_width;
+    s.world_height = options.world_height;
+    s.portal_mode = options.portal_mode;
+    s.stress_projectiles = options.stress_projectiles;
+    s.stress_rng = options.seed;
+    s.swarm_size = std::max(1, options.swarm_size);
+    applyDifficulty(s, options.difficulty_mode);
+    if (options.tuning) {
+        s.tuning = *options.tuning;
+    }
+
+    s.player_x = s.prev_player_x = (float)s.world_width / 2.0f - player_size / 2.0f;
+    s.player_y = s.prev_player_y = (float)s.world_height - player_size;
+
+    // Start every cooldown as already expired so the first shot/stun/dash is allowed immediately
+    s.player_last_shot_time = -s.tuning.player_shoot_cooldown;
+    s.player_last_stun_shot_time = -s.tuning.player_stun_shot_cooldown;
+    s.obstacle_last_stun_time = -s.tuning.obstacle_stun_cooldown;
+    s.player_last_dash_time = -s.tuning.player_dash_cooldown;
+
+    // The first obstacle starts at the top center as always. The rest of a swarm is scattered over
+    // the screen (the same way every game), but at least SWARM_SPAWN_CLEARANCE from the player in x or y,
+    // counting the wrap: obstacles chase across the edges, so one near the top is close to a player at
+    // the bottom. Otherwise big swarms end most games in the first few ticks. Their shot and AI timers
+    // are staggered so they don't all fire and turn on the same tick.
+    s.obstacles.assign(s.swarm_size, Obstacle());
+    uint32_t swarm_rng = 12345u;
+    const float player_center_x = s.player_x + player_size / 2.0f;
+    const float player_center_y = s.player_y + player_size / 2.0f;
+    auto wrapped_distance = [](float a, float b, float size) {
+        float d = fabsf(a - b);
+        return std::min(d, size - d);
+    };
+    for (int i = 0; i < s.swarm_size; ++i) {
+        Obstacle& obstacle = s.obstacles[i];
+        if (i == 0) {
+            obstacle.x = (float)s.world_width / 2.0f - obstacle_size / 2.0f;
+            obstacle.y = 0.0f;
+            obstacle.last_shot_time = -s.tuning.obstacle_shoot_cooldown;
+        } else {
+            for (int attempt = 0; attempt < SWARM_SPAWN_ATTEMPTS; ++attempt) {
+                obstacle.x = nextRandomUnit(swarm_rng) * (s.world_width - obstacle_size);
+                obstacle.y = nextRandomUnit(swarm_rng) * (s.world_height - obstacle_size);
+                float dx = wrapped_distance(obstacle.x + obstacle_size / 2.0f, player_center_x, (float)s.world_width);
+                float dy = wrapped_distance(obstacle.y + obstacle_size / 2.0f, player_center_y, (float)s.world_height);
+                if (std::max(dx, dy) >= SWARM_SPAWN_CLEARANCE) {
+                    break;
+                }
+            }
+            obstacle.last_shot_time = -nextRandomUnit(swarm_rng) * s.tuning.obstacle_shoot_cooldown;
+            obstacle.ai_reaction_timer = (int)(nextRandomUnit(swarm_rng) * s.tuning.ai_reaction_delay);
+        }
+        obstacle.prev_x = obstacle.x;
+        obstacle.prev_y = obstacle.y;
+    }
+
+    initBroadphaseGrid(s.grid, s.world_width, s.world_height, s.swarm_size);
+    for (int i = 0; i < s.swarm_size; ++i) {
+        updateObstacleCells(s.grid, i, s.obstacles[i]);
+    }
+}
+
+// Advances the game by exactly one tick (SIM_TICK_SECONDS). Does nothing once the game is over.
+void stepSimulation(SimState& s, const InputSnapshot& input) {
+    if (s.game_over) {
+        return;
+    }
+    PROFILE_SCOPE(PROFILE_SIM_STEP);
+
+    s.tick++;
+    s.time = s.tick * SIM_TICK_SECONDS;
+    const float world_w = (float)s.world_width;
+    const float world_h = (float)s.world_height;
+
+    s.prev_player_x = s.player_x;
+    s.prev_player_y = s.player_y;
+    for (Obstacle& obstacle : s.obstacles) {
+        obstacle.prev_x = obstacle.x;
+        obstacle.prev_y = obstacle.y;
+    }
+
+    // The window was resized (or went fullscreen) since the last tick: rebuild the grid for the new world
+    if (s.grid.world_width != s.world_width || s.grid.world_height != s.world_height) {
+        initBroadphaseGrid(s.grid, s.world_width, s.world_height, (int)s.obstacles.size());
+        for (int i = 0; i < (int)s.obstacles.size(); ++i) {
+            updateObstacleCells(s.grid, i, s.obstacles[i]);
+        }
+    }
+
+    s.elapsed_time_s = s.time;
+
+    // Survival-time achievements ("Bullet Ballet Master", "Long-Haul Dodger") watch this
+    publishSimEvent(s, SIM_EVENT_SURVIVAL_TICK, s.elapsed_time_s);
+
+    // Handle dash activation
+    PROFILE_BEGIN(PROFILE_PLAYER_MOVEMENT);
+    if (input.dash_pressed && s.time - s.player_last_dash_time >= s.tuning.player_dash_cooldown) {
+        s.player_is_dashing = true;
+        s.player_dash_end_time = s.time + s.tuning.player_dash_duration;
+        s.player_last_dash_time = s.time;
+
+        float dash_dir_x = 0.0f;
+        float dash_dir_y = 0.0f;
+
+        // Determine dash direction based on movement keys (arrows)
+        if (input.move_up) dash_dir_y = -1.0f;
+        if (input.move_down) dash_dir_y = 1.0f;
+        if (input.move_left) dash_dir_x = -1.0f;
+        if (input.move_right) dash_dir_x = 1.0f;
+
+        if (dash_dir_x == 0.0f && dash_dir_y == 0.0f) {
+            // If not moving, use aiming direction (WASD)
+            if (input.aim_up) dash_dir_y = -1.0f;
+            if (input.aim_down) dash_dir_y = 1.0f;
+            if (input.aim_left) dash_dir_x = -1.0f;
+            if (input.aim_right) dash_dir_x = 1.0f;
+        }
+
+        // Normalize dash direction to ensure consistent speed for diagonals
+        float dash_length = sqrtf(dash_dir_x * dash_dir_x + dash_dir_y * dash_dir_y);
+        if (dash_length > 0) {
+            dash_dir_x /= dash_length;
+            dash_dir_y /= dash_length;
+        } else {
+            // If no direction input at all, default to dashing upwards
+            dash_dir_y = -1.0f;
+        }
+
+        // Calculate dash velocity (pixels per second)
+        float dash_speed = PLAYER_DASH_DISTANCE / s.tuning.player_dash_duration;
+        s.player_dash_velocity_x = dash_dir_x * dash_speed;
+        s.player_dash_velocity_y = dash_dir_y * dash_speed;
+    }
+
+    // Update player position based on dash or normal movement
+    if (s.player_is_dashing) {
+        s.player_x += s.player_dash_velocity_x * (float)SIM_TICK_SECONDS;
+        s.player_y += s.player_dash_velocity_y * (float)SIM_TICK_SECONDS;
+
+        // Check if dash duration has ended
+        if (s.time > s.player_dash_end_time) {
+            s.player_is_dashing = false;
+            s.player_dash_velocity_x = 0.0f; // Stop dash movement
+            s.player_dash_velocity_y = 0.0f;
+            simLog("Player dash ended.");
+        }
+    } else {
+        // Normal movement (only if not stunned)
+        s.player_vx = 0.0f;
+        s.player_vy = 0.0f;
+        if (!s.player_is_stunned) {
+            if (input.move_up) s.player_vy = -s.tuning.player_speed;
+            if (input.move_down) s.player_vy = s.tuning.player_speed;
+            if (input.move_left) s.player_vx = -s.tuning.player_speed;
+            if (input.move_right) s.player_vx = s.tuning.player_speed;
+
+            s.player_x += s.player_vx;
+            s.player_y += s.player_vy;
+
+            // Update aiming angle based on movement or aiming keys
+            bool aiming_up = input.aim_up;
+            bool aiming_down = input.aim_down;
+            bool aiming_left = input.aim_left;
+            bool aiming_right = input.aim_right;
+
+            if (aiming_up || aiming_down || aiming_left || aiming_right) {
+                if (aiming_up && !aiming_left && !aiming_right) s.player_aim_angle = -PI / 2.0f;
+                else if (aiming_down && !aiming_left && !aiming_right) s.player_aim_angle = PI / 2.0f;
+                else if (aiming_left && !aiming_up && !aiming_down) s.player_aim_angle = PI;
+                else if (aiming_right && !aiming_up && !aiming_down) s.player_aim_angle = 0.0f;
+                else if (aiming_up && aiming_left) s.player_aim_angle = -3.0f * PI / 4.0f;
+                else if (aiming_up && aiming_right) s.player_aim_angle = -PI / 4.0f;
+                else if (aiming_down && aiming_left) s.player_aim_angle = 3.0f * PI / 4.0f;
+                else if (aiming_down && aiming_right) s.player_aim_angle = PI / 4.0f;
+            }
+            else if (s.player_vx != 0 || s.player_vy != 0) {
+                s.player_aim_angle = atan2f(s.player_vy, s.player_vx);
+            }
+        } else {
+            // If player is stunned, check for stun end time
+            if (s.time > s.player_stun_end_time) {
+                s.player_is_stunned = false;
+                simLog("Player stun ended.");
+            }
+        }
+    }
+
+    // Player wrap-around (applies to both normal movement and dash movement)
+    if (s.player_x < -player_size) s.player_x = world_w;
+    else if (s.player_x > world_w) s.player_x = -player_size;
+
+    if (s.player_y < -player_size) s.player_y = world_h;
+    else if (s.player_y > world_h) s.player_y = -player_size;
+    PROFILE_END(PROFILE_PLAYER_MOVEMENT);
+
+    // --- Portal Mode Logic (Teleportation and Timed Deactivation) ---
+    if (s.portal_mode) {
+        PROFILE_SCOPE(PROFILE_PORTALS);
+        // Portal deactivation over time
+        if (s.portal_1_active && s.time > s.portal_active_until_time_1) {
+            s.portal_1_active = false;
+            simLog("Portal 1 deactivated due to time.");
+        }
+        if (s.portal_2_active && s.time > s.portal_active_until_time_2) {
+            s.portal_2_active = false;
+            simLog("Portal 2 deactivated due to time.");
+        }
+
+        // Teleport logic for player
+        if (s.portal_1_active && s.portal_2_active && s.time - s.last_teleport_time >= TELEPORT_COOLDOWN) {
+            Vector2 player_center = {s.player_x + player_size / 2.0f, s.player_y + player_size / 2.0f};
+
+            // Check collision with Portal 1
+            if (circlesOverlap(player_center, player_size / 2.0f, s.portal_1_pos, PORTAL_RADIUS)) {
+                s.player_x = s.portal_2_pos.x - player_size / 2.0f;
+                s.player_y = s.portal_2_pos.y - player_size / 2.0f;
+                s.last_teleport_time = s.time;
+                simLog("Teleported player from Portal 1 to Portal 2.");
+            }
+            // Check collision with Portal 2
+            else if (circlesOverlap(player_center, player_size / 2.0f, s.portal_2_pos, PORTAL_RADIUS)) {
+                s.player_x = s.portal_1_pos.x - player_size / 2.0f;
+                s.player_y = s.portal_1_pos.y - player_size / 2.0f;
+                s.last_teleport_time = s.time;
+                simLog("Teleported player from Portal 2 to Portal 1.");
+            }
+        }
+
+        // Teleport logic for obstacles (separate cooldown not needed if last_teleport_time is for any entity)
+        // If separate cooldowns are needed for player and obstacle, new variables would be required.
+        // For now, using the same last_teleport_time for simplicity, meaning if player teleports, obstacle can't immediately.
+        // In a swarm, the lowest-numbered obstacle touching a portal goes through.
+        if (s.portal_1_active && s.portal_2_active && s.time - s.last_teleport_time >= TELEPORT_COOLDOWN) {
+            const Vector2 portal_positions[2] = {s.portal_1_pos, s.portal_2_pos};
+            for (int portal = 0; portal < 2; ++portal) {
+                const Vector2 entry = portal_positions[portal];
+                const Vector2 exit = portal_positions[1 - portal];
+                const Rectangle portal_box = {entry.x - PORTAL_RADIUS, entry.y - PORTAL_RADIUS, 2.0f * PORTAL_RADIUS, 2.0f * PORTAL_RADIUS};
+                int teleported = -1;
+                for (int index : findObstaclesNear(s.grid, portal_box)) {
+                    const Obstacle& obstacle = s.obstacles[index];
+                    Vector2 obstacle_center = {obstacle.x + obstacle_size / 2.0f, obstacle.y + obstacle_size / 2.0f};
+                    if ((teleported < 0 || index < teleported) &&
+                        circlesOverlap(obstacle_center, obstacle_size / 2.0f, entry, PORTAL_RADIUS)) {
+                        teleported = index;
+                    }
+                }
+                if (teleported >= 0) {
+                    Obstacle& obstacle = s.obstacles[teleported];
+                    obstacle.x = exit.x - obstacle_size / 2.0f;
+                    obstacle.y = exit.y - obstacle_size / 2.0f;
+                    updateObstacleCells(s.grid, teleported, obstacle);
+                    s.last_teleport_time = s.time;
+                    simLog("Teleported obstacle from Portal %d to Portal %d.", portal + 1, 2 - portal);
+                    break;
+                }
+            }
+        }
+    }
+
+
+    PROFILE_BEGIN(PROFILE_PROJECTILE_SPAWN);
+    if (input.shoot_pressed) {
+        publishSimEvent(s, SIM_EVENT_SHOT); // Player has shot, "Bullet Ballet Master" is now impossible this game
+        if (s.time - s.player_last_shot_time >= s.tuning.player_shoot_cooldown) {
+            spawnProjectile(s.projectiles,
+                            s.player_x + player_size / 2.0f - PROJECTILE_SIZE / 2.0f,
+                            s.player_y + player_size / 2.0f - PROJECTILE_SIZE / 2.0f,
+                            cosf(s.player_aim_angle) * PROJECTILE_SPEED,
+                            sinf(s.player_aim_angle) * PROJECTILE_SPEED,
+                            true);
+            s.player_last_shot_time = s.time;
+        }
+    }
+
+    for (Obstacle& obstacle : s.obstacles) {
+        if (obstacle.is_stunned || s.time - obstacle.last_shot_time < s.tuning.obstacle_shoot_cooldown) {
+            continue;
+        }
+        float obstacle_center_x = obstacle.x + obstacle_size / 2.0f;
+        float obstacle_center_y = obstacle.y + obstacle_size / 2.0f;
+
+        float angle_to_player = atan2f(s.player_y - obstacle.y, s.player_x - obstacle.x);
+        float dir_x = cosf(angle_to_player);
+        float dir_y = sinf(angle_to_player);
+
+        float nudge_distance = obstacle_size / 2.0f + PROJECTILE_SIZE / 2.0f + 5.0f;
+        spawnProjectile(s.projectiles,
+                        obstacle_center_x - PROJECTILE_SIZE / 2.0f + dir_x * nudge_distance,
+                        obstacle_center_y - PROJECTILE_SIZE / 2.2f + dir_y * nudge_distance, // Slightly adjusted Y to originate from center
+                        dir_x * OBSTACLE_PROJECTILE_SPEED,
+                        dir_y * OBSTACLE_PROJECTILE_SPEED,
+                        false);
+        obstacle.last_shot_time = s.time;
+    }
+
+    if (s.stress_projectiles > 0) {
+        topUpStressProjectiles(s);
+    }
+    PROFILE_END(PROFILE_PROJECTILE_SPAWN);
+
+    // --- Projectiles: batch movement/bouncing/wrapping, then exact checks for the few that need them ---
+    ProjectilePool& pool = s.projectiles;
+    PROFILE_BEGIN(PROFILE_PROJECTILE_LOOP);
+    integrateProjectiles(pool, world_w, world_h, s.portal_mode);
+    PROFILE_END(PROFILE_PROJECTILE_LOOP);
+
+    PROFILE_BEGIN(PROFILE_COLLISIONS);
+
+    BroadphaseGrid& grid = s.grid;
+    const Rectangle player_rect = {s.player_x, s.player_y, player_size, player_size};
+    const float player_reach_margin = PROJECTILE_SIZE / 2.0f + NEAR_MISS_MARGIN; // Covers hits and near misses
+    const Rectangle player_reach = {s.player_x - player_reach_margin, s.player_y - player_reach_margin,
+                                    player_size + 2.0f * player_reach_margin, player_size + 2.0f * player_reach_margin};
+    updatePlayerCells(grid, player_reach);
+    findProjectileCandidates(pool, grid, s.portal_mode);
+
+    for (int i = 0; i < pool.high_water; ++i) {
+        if (pool.candidate[i] == 0u) {
+            continue;
+        }
+        const bool is_player_shot = (pool.flags[i] & PROJECTILE_PLAYER_SHOT) != 0u;
+        const Rectangle projectile_rect = {pool.x[i], pool.y[i], PROJECTILE_SIZE, PROJECTILE_SIZE};
+        bool active = true;
+
+        // Obstacle hit by this projectile, if any (the lowest-numbered one if it touches several).
+        // Only the obstacles linked into the projectile's cell can be touching it.
+        int hit_obstacle = -1;
+        const int cell = gridRow(grid, projectile_rect.y) * grid.cols + gridColumn(grid, projectile_rect.x);
+        for (int node = grid.cell_head[cell]; node >= 0; node = grid.node_next[node]) {
+            const int index = node / 4;
+            const Obstacle& obstacle = s.obstacles[index];
+            if ((hit_obstacle < 0 || index < hit_obstacle) &&
+                rectsOverlap(projectile_rect, {obstacle.x, obstacle.y, obstacle_size, obstacle_size})) {
+                hit_obstacle = index;
+            }
+        }
+
+        // --- Portal Creation Logic (if in portal mode and player shot) ---
+        if (s.portal_mode && is_player_shot) {
+            bool hit_for_portal = false;
+            Vector2 portal_spawn_pos = {0,0};
+
+            // Calculate projectile center for accurate hit point
+            Vector2 projectile_center = {projectile_rect.x + PROJECTILE_SIZE / 2.0f, projectile_rect.y + PROJECTILE_SIZE / 2.0f};
+
+            // Check collision with screen edges for portal
+            // Use a small buffer to ensure it's "on" the edge, not just past it
+            float edge_buffer = 1.0f; // 1 pixel buffer
+            if (projectile_rect.x <= edge_buffer || projectile_rect.x + PROJECTILE_SIZE >= world_w - edge_buffer ||
+                projectile_rect.y <= edge_buffer || projectile_rect.y + PROJECTILE_SIZE >= world_h - edge_buffer) {
+                hit_for_portal = true;
+                // Determine exact impact point for portal placement
+                // Clamp to screen edges for precise placement
+                portal_spawn_pos.x = fmaxf(0.0f, fminf(world_w, projectile_center.x));
+                portal_spawn_pos.y = fmaxf(0.0f, fminf(world_h, projectile_center.y));
+            }
+
+            // Check collision with obstacle for portal
+            if (!hit_for_portal && hit_obstacle >= 0) {
+                hit_for_portal = true;
+                const Obstacle& obstacle = s.obstacles[hit_obstacle];
+                portal_spawn_pos = {obstacle.x + obstacle_size / 2.0f, obstacle.y + obstacle_size / 2.0f};
+            }
+
+            if (hit_for_portal) {
+                releaseProjectile(pool, i); // Deactivate projectile as it created a portal
+
+                if (s.next_projectile_portal_is_1) {
+                    s.portal_1_active = true;
+                    s.portal_1_pos = portal_spawn_pos;
+                    s.portal_active_until_time_1 = s.time + PORTAL_ACTIVE_DURATION;
+                    s.next_projectile_portal_is_1 = false; // Next one will be portal 2
+                    simLog("Portal 1 created by projectile at (%.1f, %.1f)", s.portal_1_pos.x, s.portal_1_pos.y);
+                } else {
+                    s.portal_2_active = true;
+                    s.portal_2_pos = portal_spawn_pos;
+                    s.portal_active_until_time_2 = s.time + PORTAL_ACTIVE_DURATION;
+                    s.next_projectile_portal_is_1 = true; // Next one will be portal 1
+                    simLog("Portal 2 created by projectile at (%.1f, %.1f)", s.portal_2_pos.x, s.portal_2_pos.y);
+                }
+                continue; // Skip further processing for this projectile
+            }
+        }
+        // --- End Portal Creation Logic ---
+
+        // --- Check for projectile collision with obstacle (Stun Mechanic) ---
+        if (hit_obstacle >= 0) {
+            active = false;
+            s.dodge_streak_start_time = s.time; // Reset streak on hit
+            if (is_player_shot && s.time > s.player_last_stun_shot_time + s.tuning.player_stun_shot_cooldown) {
+                Obstacle& obstacle = s.obstacles[hit_obstacle];
+                obstacle.is_stunned = true;
+                obstacle.stun_end_time = s.time + s.tuning.obstacle_stun_duration;
+                s.player_last_stun_shot_time = s.time;
+                publishSimEvent(s, SIM_EVENT_OBSTACLE_STUNNED); // Counted for "Stunned Silence"
+                simLog("Obstacle stunned for %.1f seconds!", s.tuning.obstacle_stun_duration);
+            }
+        }
+
+        if (!is_player_shot) {
+            const bool hits_player = rectsOverlap(projectile_rect, player_rect);
+
+            // --- Check for obstacle projectile collision with player (Stun Player) ---
+            // Only stun player if not dashing
+            if (!s.player_is_dashing && hits_player) {
+                active = false;
+                s.dodge_streak_start_time = s.time; // Reset streak on hit
+                if (s.time > s.obstacle_last_stun_time + s.tuning.obstacle_stun_cooldown) {
+                    s.player_is_stunned = true;
+                    s.player_stun_end_time = s.time + s.tuning.player_stun_duration;
+                    s.obstacle_last_stun_time = s.time;
+                    simLog("Player stunned for %.1f seconds by obstacle projectile!", s.tuning.player_stun_duration);
+                }
+            }
+
+            // --- "Dash of Genius" achievement check ---
+            // If player is dashing and this is an obstacle projectile, check for collision
+            if (s.player_is_dashing && hits_player) {
+                active = false; // Projectile is "dodged" by dash
+                publishSimEvent(s, SIM_EVENT_DASH_THROUGH);
+            }
+
+            // --- "Near Miss" achievement check ---
+            // Check if it's an obstacle projectile and not a direct hit, and player is not dashing.
+            // Skipped entirely once no rule is waiting for a near miss this game.
+            if ((s.achievements.listening & simEventBit(SIM_EVENT_NEAR_MISS)) && !s.player_is_dashing) {
+                float player_center_x = s.player_x + player_size / 2.0f;
+                float player_center_y = s.player_y + player_size / 2.0f;
+                float projectile_center_x = projectile_rect.x + PROJECTILE_SIZE / 2.0f;
+                float projectile_center_y = projectile_rect.y + PROJECTILE_SIZE / 2.0f;
+
+                float dx = player_center_x - projectile_center_x;
+                float dy = player_center_y - projectile_center_y;
+                float distance = sqrtf(dx*dx + dy*dy);
+
+                // Define a "near miss" threshold (e.g., within 1.5 times the combined radius, but not a direct hit)
+                float combined_radius = (player_size / 2.0f) + (PROJECTILE_SIZE / 2.0f);
+                float near_miss_threshold_distance = combined_radius + NEAR_MISS_MARGIN; // Just beyond direct collision
+
+                // If it's very close but not colliding AND it's an obstacle projectile
+                if (distance > combined_radius && distance < near_miss_threshold_distance) {
+                    publishSimEvent(s, SIM_EVENT_NEAR_MISS);
+                }
+            }
+        }
+
+        if (!active) {
+            releaseProjectile(pool, i);
+        }
+    }
+    PROFILE_END(PROFILE_COLLISIONS);
+
+    PROFILE_BEGIN(PROFILE_OBSTACLE_AI);
+    for (int index = 0; index < (int)s.obstacles.size(); ++index) {
+        Obstacle& obstacle = s.obstacles[index];
+        obstacle.ai_reaction_timer++;
+        if (obstacle.ai_reaction_timer >= s.tuning.ai_reaction_delay) {
+            float raw_predicted_player_x = s.player_x + (s.player_vx * s.tuning.prediction_frames);
+            float raw_predicted_player_y = s.player_y + (s.player_vy * s.tuning.prediction_frames);
+
+            float dx_direct = raw_predicted_player_x - obstacle.x;
+            float dx_wrap_left = (raw_predicted_player_x + world_w) - obstacle.x;
+            float dx_wrap_right = raw_predicted_player_x - (obstacle.x + world_w);
+
+            float shortest_dx = dx_direct;
+            if (std::abs(dx_wrap_left) < std::abs(shortest_dx)) {
+                shortest_dx = dx_wrap_left;
+            }
+            if (std::abs(dx_wrap_right) < std::abs(shortest_dx)) {
+                shortest_dx = dx_wrap_right;
+            }
+            obstacle.ai_target_x = obstacle.x + shortest_dx;
+
+            float dy_direct = raw_predicted_player_y - obstacle.y;
+            float dy_wrap_up = (raw_predicted_player_y + world_h) - obstacle.y;
+            float dy_wrap_down = raw_predicted_player_y - (obstacle.y + world_h);
+
+            float shortest_dy = dy_direct;
+            if (std::abs(dy_wrap_up) < std::abs(shortest_dy)) {
+                shortest_dy = dy_wrap_up;
+            }
+            if (std::abs(dy_wrap_down) < std::abs(shortest_dy)) {
+                shortest_dy = dy_wrap_down;
+            }
+            obstacle.ai_target_y = obstacle.y + shortest_dy;
+
+            obstacle.ai_reaction_timer = 0;
+        }
+
+        if (!obstacle.is_stunned) {
+            if (obstacle.x < obstacle.ai_target_x) {
+                obstacle.x += s.tuning.obstacle_speed;
+            } else if (obstacle.x > obstacle.ai_target_x) {
+                obstacle.x -= s.tuning.obstacle_speed;
+            }
+            if (obstacle.y < obstacle.ai_target_y) {
+                obstacle.y += s.tuning.obstacle_speed;
+            } else if (obstacle.y > obstacle.ai_target_y) {
+                obstacle.y -= s.tuning.obstacle_speed;
+            }
+        } else {
+            if (s.time > obstacle.stun_end_time) {
+                obstacle.is_stunned = false;
+                simLog("Obstacle stun ended.");
+            }
+        }
+
+        if (obstacle.x < -obstacle_size) obstacle.x = world_w;
+        else if (obstacle.x > world_w) obstacle.x = -obstacle_size;
+
+        if (obstacle.y < -obstacle_size) obstacle.y = world_h;
+        else if (obstacle.y > world_h) obstacle.y = -obstacle_size;
+
+        updateObstacleCells(grid, index, obstacle);
+    }
+    PROFILE_END(PROFILE_OBSTACLE_AI);
+
+    // --- Dodge Streak Time Bonus Logic ---
+    // Only award bonus if player is not stunned and hasn't just been hit
+    if (!s.player_is_stunned) {
+        if (s.time - s.dodge_streak_start_time >= DODGE_BONUS_INTERVAL) {
+            s.elapsed_time_s += DODGE_BONUS_AMOUNT;
+            s.dodge_streak_start_time = s.time; // Reset streak timer for next bonus
+            s.showing_time_bonus_message = true;
+            s.time_bonus_message_end_time = s.time + TIME_BONUS_MESSAGE_DURATION;
+            simLog("Time Bonus! +%.1f seconds. New elapsed time: %.2f", DODGE_BONUS_AMOUNT, s.elapsed_time_s);
+        }
+    }
+
+    // Hide time bonus message after its duration
+    if (s.showing_time_bonus_message && s.time > s.time_bonus_message_end_time) {
+        s.showing_time_bonus_message = false;
+    }
+
+    // Player vs Obstacle Collision (only if player is NOT dashing)
+    PROFILE_BEGIN(PROFILE_COLLISIONS);
+    bool touched_obstacle = false;
+    if (!s.player_is_dashing) {
+        const Rectangle player_now = {s.player_x, s.player_y, player_size, player_size};
+        for (int index : findObstaclesNear(grid, player_now)) {
+            const Obstacle& obstacle = s.obstacles[index];
+            if (rectsOverlap(player_now, {obstacle.x, obstacle.y, obstacle_size, obstacle_size})) {
+                touched_obstacle = true;
+                break;
+            }
+        }
+    }
+    PROFILE_END(PROFILE_COLLISIONS);
+    if (touched_obstacle) {
+
+        s.game_over = true;
+        s.final_survival_time_s = s.elapsed_time_s;
+
+        // --- CRITICAL FIX: Clear projectiles and reset dash state immediately on game over ---
+        clearProjectilePool(s.projectiles);
+        s.player_is_dashing = false;
+        s.player_dash_velocity_x = 0.0f;
+        s.player_dash_velocity_y = 0.0f;
+        // --- END CRITICAL FIX ---
+    }
+
+    // Run this tick's events past the achievement rules
+    PROFILE_BEGIN(PROFILE_ACHIEVEMENTS);
+    processAchievementEvents(achievement_engine, s.achievements, s.pending_achievements);
+    PROFILE_END(PROFILE_ACHIEVEMENTS);
+}
+
+// Reads the keyboard into an InputSnapshot (the only place gameplay input touches raylib)
+InputSnapshot sampleInput() {
+    InputSnapshot input;
+    input.move_up = IsKeyDown(KEY_UP);
+    input.move_down = IsKeyDown(KEY_DOWN);
+    input.move_left = IsKeyDown(KEY_LEFT);
+    input.move_right = IsKeyDown(KEY_RIGHT);
+    input.aim_up = IsKeyDown(KEY_W);
+    input.aim_down = IsKeyDown(KEY_S);
+    input.aim_left = IsKeyDown(KEY_A);
+    input.aim_right = IsKeyDown(KEY_D);
+    input.shoot_pressed = IsKeyPressed(KEY_LEFT_SHIFT) || IsKeyPressed(KEY_RIGHT_SHIFT);
+    input.dash_pressed = IsKeyPressed(KEY_LEFT_ALT) || IsKeyPressed(KEY_RIGHT_ALT);
+    return input;
+}
+
+// Changes the world size mid-game (window resize or fullscreen toggle). With recenter the player and
+// the first obstacle also go back to where a game starts.
+void resizeWorld(SimState& s, int width, int height, bool recenter) {
+    s.world_width = width;
+    s.world_height = height;
+    if (recenter) {
+        s.player_x = s.prev_player_x = (float)width / 2.0f - player_size / 2.0f;
+        s.player_y = s.prev_player_y = (float)height - player_size;
+        if (!s.obstacles.empty()) {
+            Obstacle& first_obstacle = s.obstacles[0];
+            first_obstacle.x = first_obstacle.prev_x = (float)width / 2.0f - obstacle_size / 2.0f;
+            first_obstacle.y = first_obstacle.prev_y = 0.0f;
+            // If the size didn't change the grid isn't rebuilt next tick, so move it to its new cells now
+            updateObstacleCells(s.grid, 0, first_obstacle);
+        }
+    }
+}
+
+// The window changed size, so the game's world follows it. A game in progress records the change in its
+// replay; a replay being watched keeps the world size it was recorded with.
+void resizeGameWorld(bool recenter) {
+    if (current_game_state == GAME_STATE_REPLAY) {
+        return;
+    }
+    if (current_game_state == GAME_STATE_COUNTDOWN || current_game_state == GAME_STATE_PLAYING) {
+        replayRecordResize(game_replay, SCREEN_WIDTH, SCREEN_HEIGHT, recenter);
+    }
+    resizeWorld(sim, SCREEN_WIDTH, SCREEN_HEIGHT, recenter);
+}
+
+// Called once when the simulation reports game over: scores, high score, replay and music
+void handleSimulationGameOver() {
+    current_game_state = GAME_STATE_GAME_OVER;
+    markStaticScreenDirty(); // The high score may change below
+
+    if (game_replay.active) {
+        last_replay_bytes = replayFinish(game_replay, sim);
+        queueReplayWrite(replay_directory, replayFilePath(replay_directory, game_replay), last_replay_bytes);
+    }
+
+    const double currentWinThreshold = WIN_THRESHOLD_TIMES[current_difficulty_mode];
+    bool didWin = sim.final_survival_time_s >= currentWinThreshold;
+
+    if (sim.final_survival_time_s > high_scores[current_difficulty_mode]) {
+        high_scores[current_difficulty_mode] = sim.final_survival_time_s;
+        HIGH_SCORES_BY_USER[current_username] = high_scores;
+        profile_store.dirty.insert(current_username);
+        is_new_high_score = true;
+        saveGameData(); // Keep the high score even if the game is closed from the game over screen
+    } else {
+        is_new_high_score = false;
+    }
+    TraceLog(LOG_INFO, "Game Over! Final Time: %.2f s, New High Score: %s", sim.final_survival_time_s, is_new_high_score ? "YES" : "NO");
+    TraceLog(LOG_INFO, "Current Difficulty High Score: %.2f s", high_scores[current_difficulty_mode]);
+
+    if (didWin && is_new_high_score) {
+        if (normal_music.frameCount > 0 && IsMusicStreamPlaying(normal_music)) {
+            StopMusicStream(normal_music);
+        }
+        if (win_music.frameCount > 0 && !IsMusicStreamPlaying(win_music)) {
+            PlayMusicStream(win_music);
+        }
+    } else {
+        if (win_music.frameCount > 0 && IsMusicStreamPlaying(win_music)) {
+            StopMusicStream(win_music);
+        }
+    }
+}
+
+// --- Replay Recording and Reading ---
+// Packs the ten inputs the simulation reads into the low 10 bits
+uint32_t packInput(const InputSnapshot& input) {
+    return (input.move_up ? 1u : 0u) | (input.move_down ? 2u : 0u) | (input.move_left ? 4u : 0u) |
+           (input.move_right ? 8u : 0u) | (input.aim_up ? 16u : 0u) | (input.aim_down ? 32u : 0u) |
+           (input.aim_left ? 64u : 0u) | (input.aim_right ? 128u : 0u) |
+           (input.shoot_pressed ? 256u : 0u) | (input.dash_pressed ? 512u : 0u);
+}
+
+InputSnapshot unpackInput(uint32_t bits) {
+    InputSnapshot input;
+    input.move_up = bits & 1;
+    input.move_down = bits & 2;
+    input.move_left = bits & 4;
+    input.move_right = bits & 8;
+    input.aim_up = bits & 16;
+    input.aim_down = bits & 32;
+    input.aim_left = bits & 64;
+    input.aim_right = bits & 128;
+    input.shoot_pressed = bits & 256;
+    input.dash_pressed = bits & 512;
+    return input;
+}
+
+static void appendVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += (char)((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
+
+static bool readVarint(const std::string& in, size_t& position, uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && position < in.size(); shift += 7) {
+        uint8_t byte = (uint8_t)in[position++];
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t replayContentHash(const ReplayHeader& header, const std::string& body) {
+    uint64_t hash = 1469598103934665603ull; // FNV-1a
+    auto mix = [&hash](const char* bytes, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ (uint8_t)bytes[i]) * 1099511628211ull;
+        }
+    };
+    mix((const char*)&header, sizeof(header));
+    mix(body.data(), body.size());
+    return hash;
+}
+
+// Starts recording a game that resetSimulation() is about to start (or just started) with `options`
+void replayBegin(ReplayRecorder& recorder, const SimOptions& options, const std::string& username) {
+    recorder = ReplayRecorder();
+    recorder.active = true;
+    recorder.body.reserve(REPLAY_BODY_RESERVE);
+    recorder.achievements.reserve(GAME_ACHIEVEMENTS_RESERVE);
+    ReplayHeader& header = recorder.header;
+    memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+    header.version = REPLAY_VERSION;
+    header.seed = options.seed;
+    header.world_width = options.world_width;
+    header.world_height = options.world_height;
+    header.stress_projectiles = options.stress_projectiles;
+    header.swarm_size = options.swarm_size;
+    header.portal_mode = options.portal_mode ? 1 : 0;
+    header.tick_rate = FPS;
+    strncpy(header.difficulty, options.difficulty_mode.c_str(), sizeof(header.difficulty) - 1);
+    strncpy(header.username, username.c_str(), sizeof(header.username) - 1);
+    header.recorded_at = (int64_t)time(nullptr);
+}
+
+static void replayFlushRun(ReplayRecorder& recorder) {
+    if (recorder.run_length > 0) {
+        appendVarint(recorder.body, (recorder.run_bits << 2) | REPLAY_TOKEN_RUN);
+        appendVarint(recorder.body, recorder.run_length);
+        recorder.run_length = 0;
+    }
+}
+
+// Records the input for the tick about to be simulated
+void replayRecordTick(ReplayRecorder& recorder, const InputSnapshot& input) {
+    if (!recorder.active) {
+        return;
+    }
+    uint32_t bits = packInput(input);
+    if (recorder.run_length > 0 && bits != recorder.run_bits) {
+        replayFlushRun(recorder);
+    }
+    recorder.run_bits = bits;
+    recorder.run_length++;
+    recorder.tick_count++;
+}
+
+// Records a world size change that happens before the next recorded tick
+void replayRecordResize(ReplayRecorder& recorder, int width, int height, bool recenter) {
+    if (!recorder.active) {
+        return;
+    }
+    replayFlushRun(recorder);
+    appendVarint(recorder.body, ((recenter ? 1u : 0u) << 2) | REPLAY_TOKEN_RESIZE);
+    appendVarint(recorder.body, (uint64_t)std::max(0, width));
+    appendVarint(recorder.body, (uint64_t)std::max(0, height));
+}
+
+// Ends the recording of a finished game and returns the replay file's contents
+std::string replayFinish(ReplayRecorder& recorder, const SimState& s) {
+    replayFlushRun(recorder);
+    appendVarint(recorder.body, REPLAY_TOKEN_END);
+    recorder.active = false;
+
+    ReplayFooter footer = {};
+    memcpy(footer.magic, REPLAY_FOOTER_MAGIC, sizeof(footer.magic));
+    footer.tick_count = recorder.tick_count;
+    footer.final_survival_time_s = s.final_survival_time_s;
+    footer.achievement_count = (uint32_t)recorder.achievements.size();
+    footer.content_hash = replayContentHash(recorder.header, recorder.body);
+
+    std::string bytes((const char*)&recorder.header, sizeof(ReplayHeader));
+    bytes += recorder.body;
+    bytes.append((const char*)&footer, sizeof(footer));
+    for (AchievementId achievement : recorder.achievements) {
+        const std::string& achievement_id = ACHIEVEMENT_NAMES[achievement];
+        size_t length = std::min<size_t>(achievement_id.size(), 255);
+        bytes += (char)length;
+        bytes.append(achievement_id, 0, length);
+    }
+    return bytes;
+}
+
+// Where a finished game's replay goes: DIR/<username>-<date>-<time>-<ticks>.dreplay
+std::string replayFilePath(const std::string& directory, const ReplayRecorder& recorder) {
+    std::string username = recorder.header.username;
+    std::replace(username.begin(), username.end(), ' ', '_');
+    std::replace(username.begin(), username.end(), '/', '_');
+    char stamp[32];
+    time_t recorded_at = (time_t)recorder.header.recorded_at;
+    struct tm local_time;
+    localtime_r(&recorded_at, &local_time);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local_time);
+    return directory + "/" + username + "-" + stamp + "-" + std::to_string(recorder.tick_count) + REPLAY_FILE_EXTENSION;
+}
+
+// Saves a replay, creating its directory if needed. Windowed games call this on the save thread
+// (see queueReplayWrite); headless recording calls it directly.
+bool writeReplayFile(const std::string& path, const std::string& bytes) {
+    size_t slash = path.rfind('/');
+    if (slash != std::string::npos) {
+        mkdir(path.substr(0, slash).c_str(), 0755); // Fails harmlessly if it already exists
+    }
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), (std::streamsize)bytes.size());
+    return (bool)out;
+}
+
+// Every replay file in a directory, sorted by name (so by player, then date). False if it can't be read.
+bool listReplayFiles(const std::string& directory, std::vector<std::string>* paths) {
+    paths->clear();
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        return false;
+    }
+    while (struct dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() > REPLAY_FILE_EXTENSION.size() &&
+            name.compare(name.size() - REPLAY_FILE_EXTENSION.size(), REPLAY_FILE_EXTENSION.size(), REPLAY_FILE_EXTENSION) == 0) {
+            paths->push_back(directory + "/" + name);
+        }
+    }
+    closedir(dir);
+    std::sort(paths->begin(), paths->end());
+    return true;
+}
+
+// Deletes the oldest replays in a directory until at most `keep` are left, so a machine that's played
+// all day (a kiosk, say) doesn't fill its disk
+void pruneReplayDirectory(const std::string& directory, size_t keep) {
+    std::vector<std::string> paths;
+    if (!listReplayFiles(directory, &paths) || paths.size() <= keep) {
+        return;
+    }
+    std::vector<std::pair<time_t, std::string>> by_age;
+    for (const std::string& path : paths) {
+        struct stat file_info;
+        by_age.push_back({stat(path.c_str(), &file_info) == 0 ? file_info.st_mtime : 0, path});
+    }
+    std::sort(by_age.begin(), by_age.end());
+    for (size_t i = 0; i + keep < by_age.size(); ++i) {
+        remove(by_age[i].second.c_str());
+    }
+    TraceLog(LOG_INFO, "Removed %zu old replays from %s.", by_age.size() - keep, directory.c_str());
+}
+
+// Splits a replay file into its parts and checks that they're intact
+bool parseReplay(const std::string& bytes, Replay* replay, std::string* error) {
+    if (bytes.size() < sizeof(ReplayHeader) + 1 + sizeof(ReplayFooter)) {
+        *error = "file too short";
+        return false;
+    }
+    memcpy(&replay->header, bytes.data(), sizeof(ReplayHeader));
+    const ReplayHeader& header = replay->header;
+    if (memcmp(header.magic, REPLAY_MAGIC, sizeof(header.magic)) != 0 || header.version != REPLAY_VERSION) {
+        *error = "not a replay, or from another version";
+        return false;
+    }
+    if (header.tick_rate != (uint32_t)FPS) {
+        *error = "recorded at a different tick rate";
+        return false;
+    }
+    if (DIFFICULTY_SETTINGS.count(std::string(header.difficulty, strnlen(header.difficulty, sizeof(header.difficulty)))) == 0) {
+        *error = "unknown difficulty";
+        return false;
+    }
+    if (header.world_width <= 0 || header.world_height <= 0 || header.swarm_size < 1 || header.stress_projectiles < 0) {
+        *error = "bad game settings";
+        return false;
+    }
+    replay->header.username[sizeof(header.username) - 1] = '\0';
+
+    // Find the END token to know where the body stops
+    size_t position = sizeof(ReplayHeader);
+    while (true) {
+        uint64_t token = 0;
+        uint64_t argument = 0;
+        if (!readVarint(bytes, position, &token)) {
+            *error = "body cut short";
+            return false;
+        }
+        uint32_t kind = (uint32_t)(token & 3);
+        if (kind == REPLAY_TOKEN_END) {
+            break;
+        }
+        int arguments = (kind == REPLAY_TOKEN_RUN) ? 1 : (kind == REPLAY_TOKEN_RESIZE) ? 2 : -1;
+        if (arguments < 0) {
+            *error = "bad token in body";
+            return false;
+        }
+        for (int i = 0; i < arguments; ++i) {
+            if (!readVarint(bytes, position, &argument)) {
+                *error = "body cut short";
+                return false;
+            }
+        }
+    }
+    replay->body.assign(bytes, sizeof(ReplayHeader), position - sizeof(ReplayHeader));
+
+    if (bytes.size() - position < sizeof(ReplayFooter)) {
+        *error = "footer missing";
+        return false;
+    }
+    memcpy(&replay->footer, bytes.data() + position, sizeof(ReplayFooter));
+    position += sizeof(ReplayFooter);
+    if (memcmp(replay->footer.magic, REPLAY_FOOTER_MAGIC, sizeof(replay->footer.magic)) != 0) {
+        *error = "footer missing";
+        return false;
+    }
+    if (replay->footer.content_hash != replayContentHash(replay->header, replay->body)) {
+        *error = "damaged (content hash mismatch)";
+        return false;
+    }
+    replay->achievements.clear();
+    for (uint32_t i = 0; i < replay->footer.achievement_count; ++i) {
+        if (position >= bytes.size() || bytes.size() - position - 1 < (uint8_t)bytes[position]) {
+            *error = "achievement list cut short";
+            return false;
+        }
+        size_t length = (uint8_t)bytes[position++];
+        replay->achievements.push_back(findAchievementId(bytes.substr(position, length)));
+        position += length;
+    }
+    return true;
+}
+
+SimOptions replayOptions(const ReplayHeader& header) {
+    SimOptions options;
+    options.world_width = header.world_width;
+    options.world_height = header.world_height;
+    options.portal_mode = header.portal_mode != 0;
+    options.stress_projectiles = header.stress_projectiles;
+    options.swarm_size = header.swarm_size;
+    options.seed = header.seed;
+    options.difficulty_mode.assign(header.difficulty, strnlen(header.difficulty, sizeof(header.difficulty)));
+    return options;
+}
+
+// Gets the input for the next tick, first applying any world resizes recorded before it.
+// Returns false at the end of the replay (or if the body is damaged, which sets reader.failed).
+bool replayNextTick(ReplayReader& reader, SimState& s, InputSnapshot* input) {
+    while (reader.run_left == 0) {
+        if (reader.ended || reader.failed) {
+            return false;
+        }
+        uint64_t token = 0;
+        if (!readVarint(*reader.body, reader.position, &token)) {
+            reader.failed = true;
+            return false;
+        }
+        uint32_t kind = (uint32_t)(token & 3);
+        if (kind == REPLAY_TOKEN_RUN) {
+            uint64_t length = 0;
+            if (!readVarint(*reader.body, reader.position, &length) || (token >> 2) > 0x3FF || length > UINT32_MAX) {
+                reader.failed = true;
+                return false;
+            }
+            reader.run_bits = (uint32_t)(token >> 2);
+            reader.run_left = (uint32_t)length;
+        } else if (kind == REPLAY_TOKEN_RESIZE) {
+            uint64_t width = 0;
+            uint64_t height = 0;
+            if (!readVarint(*reader.body, reader.position, &width) || !readVarint(*reader.body, reader.position, &height) ||
+                width == 0 || height == 0 || width > 1 << 16 || height > 1 << 16) {
+                reader.failed = true;
+                return false;
+            }
+            resizeWorld(s, (int)width, (int)height, (token >> 2) & 1);
+        } else if (kind == REPLAY_TOKEN_END) {
+            reader.ended = true;
+            return false;
+        } else {
+            reader.failed = true;
+            return false;
+        }
+    }
+    reader.run_left--;
+    *input = unpackInput(reader.run_bits);
+    return true;
+}
+
+// Re-simulates a replay in `scratch` and checks it ends the way its footer says: same tick, same
+// final time (bit for bit) and the same achievements in the same order
+bool verifyReplay(const Replay& replay, SimState& scratch, std::string* problem) {
+    resetSimulation(scratch, replayOptions(replay.header));
+    ReplayReader reader;
+    reader.body = &replay.body;
+    std::vector<AchievementId> achievements;
+    InputSnapshot input;
+    while (!scratch.game_over && replayNextTick(reader, scratch, &input)) {
+        stepSimulation(scratch, input);
+        achievements.insert(achievements.end(), scratch.pending_achievements.begin(), scratch.pending_achievements.end());
+        scratch.pending_achievements.clear();
+    }
+
+    char details[160];
+    if (reader.failed) {
+        *problem = "damaged input stream";
+        return false;
+    }
+    if (!scratch.game_over) {
+        snprintf(details, sizeof(details), "inputs end after %llu ticks but the game isn't over",
+                 (unsigned long long)scratch.tick);
+        *problem = details;
+        return false;
+    }
+    if (scratch.tick != replay.footer.tick_count || reader.run_left != 0) {
+        snprintf(details, sizeof(details), "game ends on tick %llu, replay claims %llu",
+                 (unsigned long long)scratch.tick, (unsigned long long)replay.footer.tick_count);
+        *problem = details;
+        return false;
+    }
+    if (memcmp(&scratch.final_survival_time_s, &replay.footer.final_survival_time_s, sizeof(double)) != 0) {
+        snprintf(details, sizeof(details), "survival time %.6f s, replay claims %.6f s",
+                 scratch.final_survival_time_s, replay.footer.final_survival_time_s);
+        *problem = details;
+        return false;
+    }
+    if (achievements != replay.achievements) {
+        snprintf(details, sizeof(details), "%zu achievements earned, replay claims %zu (or a different set)",
+                 achievements.size(), replay.achievements.size());
+        *problem = details;
+        return false;
+    }
+    return true;
+}
+
+// --- Replay Playback (window) ---
+bool startReplayPlayback(const std::string& bytes, GameState returnState) {
+    std::string error;
+    if (!parseReplay(bytes, &replay_playback, &error)) {
+        TraceLog(LOG_WARNING, "Can't play replay: %s.", error.c_str());
+        return false;
+    }
+    resetSimulation(sim, replayOptions(replay_playback.header));
+    replay_playback_reader = ReplayReader();
+    replay_playback_reader.body = &replay_playback.body;
+    replay_playback_achievements.clear();
+    replay_playback_achievements.reserve(GAME_ACHIEVEMENTS_RESERVE);
+    replay_playback_speed = 1;
+    replay_return_state = returnState;
+    sim_accumulator = 0.0;
+    sim_render_alpha = 0.0f;
+    current_game_state = GAME_STATE_REPLAY;
+    TraceLog(LOG_INFO, "Playing replay of %s (%llu ticks, %.2f s).", replay_playback.header.username,
+             (unsigned long long)replay_playback.footer.tick_count, replay_playback.footer.final_survival_time_s);
+    return true;
+}
+
+// Simulates one tick of the replay being watched. Returns false once it's over.
+static bool stepReplayPlayback() {
+    InputSnapshot input;
+    if (sim.game_over || !replayNextTick(replay_playback_reader, sim, &input)) {
+        return false;
+    }
+    stepSimulation(sim, input);
+    replay_playback_achievements.insert(replay_playback_achievements.end(),
+                                        sim.pending_achievements.begin(), sim.pending_achievements.end());
+    sim.pending_achievements.clear(); // Watching a replay never unlocks anything
+    return true;
+}
+
+void stopReplayPlayback() {
+    bool matches = sim.game_over && sim.tick == replay_playback.footer.tick_count &&
+                   sim.final_survival_time_s == replay_playback.footer.final_survival_time_s &&
+                   replay_playback_achievements == replay_playback.achievements;
+    TraceLog(matches ? LOG_INFO : LOG_WARNING, "Replay stopped at tick %llu: %s.", (unsigned long long)sim.tick,
+             sim.game_over ? (matches ? "matches the recording" : "DOES NOT match the recording") : "stopped early");
+    sim_accumulator = 0.0;
+    current_game_state = replay_return_state;
+}
+
+// Scripted stand-in for a player in headless runs. Holds a random set of keys for a few ticks at a
+// time so the run exercises movement, aiming, shooting and dashing, and is fully determined by the seed.
+static InputSnapshot scriptedHeadlessInput(uint32_t& rng_state, uint64_t tick, InputSnapshot held) {
+    if (tick % 12 == 0) {
+        uint32_t keys = nextRandom(rng_state);
+        held.move_up = keys & 1;
+        held.move_down = !held.move_up && (keys & 2);
+        held.move_left = keys & 4;
+        held.move_right = !held.move_left && (keys & 8);
+        held.aim_up = keys & 16;
+        held.aim_down = !held.aim_up && (keys & 32);
+        held.aim_left = keys & 64;
+        held.aim_right = !held.aim_left && (keys & 128);
+    }
+    held.shoot_pressed = nextRandom(rng_state) % 20 == 0;
+    held.dash_pressed = nextRandom(rng_state) % 90 == 0;
+    return held;
+}
+
+// Runs the simulation as fast as possible with no window or audio, restarting after every game over.
+// Prints throughput and a checksum of the run, which only changes if gameplay behaviour changes.
+int runHeadless(uint64_t ticks, uint32_t seed, int stressProjectiles, int swarmSize, bool portalMode) {
+    SimOptions options;
+    options.world_width = SCREEN_WIDTH;
+    options.world_height = SCREEN_HEIGHT;
+    options.portal_mode = portalMode;
+    options.stress_projectiles = stressProjectiles;
+    options.swarm_size = swarmSize;
+    SimState headless_sim;
+    resetSimulation(headless_sim, options);
+
+    uint32_t rng_state = seed;
+    InputSnapshot input;
+    uint64_t games = 0;
+    uint64_t achievements = 0;
+    uint64_t projectile_ticks = 0; // Sum of live projectiles over all ticks
+    uint64_t checksum = 1469598103934665603ull; // FNV-1a offset basis
+    auto mix = [&checksum](double value) {
+        checksum ^= (uint64_t)(int64_t)(value * 1000.0);
+        checksum *= 1099511628211ull;
+    };
+
+    // --record-replays: record every game, as the window does
+    const bool recording = !replay_record_directory.empty();
+    ReplayRecorder recorder;
+    if (recording) {
+        replayBegin(recorder, options, "headless");
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < ticks; ++i) {
+        input = scriptedHeadlessInput(rng_state, i, input);
+        if (recording) {
+            replayRecordTick(recorder, input);
+        }
+        stepSimulation(headless_sim, input);
+        PROFILE_END_FRAME(); // Every tick is a "frame" here
+        projectile_ticks += headless_sim.projectiles.live_count;
+        achievements += headless_sim.pending_achievements.size();
+        if (recording) {
+            recorder.achievements.insert(recorder.achievements.end(), headless_sim.pending_achievements.begin(),
+                                         headless_sim.pending_achievements.end());
+        }
+        headless_sim.pending_achievements.clear();
+        if (headless_sim.game_over) {
+            mix(headless_sim.final_survival_time_s);
+            mix(headless_sim.player_x);
+            mix(headless_sim.obstacles[0].x);
+            games++;
+            if (recording) {
+                char name[64];
+                snprintf(name, sizeof(name), "/headless-s%u-g%06llu", seed, (unsigned long long)games);
+                if (!writeReplayFile(replay_record_directory + name + REPLAY_FILE_EXTENSION, replayFinish(recorder, headless_sim))) {
+                    fprintf(stderr, "headless: could not write replays to %s\n", replay_record_directory.c_str());
+                    return 1;
+                }
+                replayBegin(recorder, options, "headless");
+            }
+            resetSimulation(headless_sim, options);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    mix(headless_sim.elapsed_time_s);
+    mix(headless_sim.player_x);
+    mix(headless_sim.player_y);
+    mix((double)headless_sim.projectiles.live_count);
+
+    printf("headless: %llu ticks, %llu games, %llu achievement unlocks in %.3f s (%.0f ticks/s, %.1fx real time)\n",
+           (unsigned long long)ticks, (unsigned long long)games, (unsigned long long)achievements,
+           seconds, ticks / seconds, ticks * SIM_TICK_SECONDS / seconds);
+    if (swarmSize > 1) {
+        printf("headless: swarm of %d obstacles, %.1f ticks per game on average\n",
+               swarmSize, games > 0 ? (double)ticks / games : (double)ticks);
+    }
+    if (recording) {
+        printf("headless: recorded %llu replays in %s\n", (unsigned long long)games, replay_record_directory.c_str());
+    }
+    if (stressProjectiles > 0) {
+        printf("headless: %.0f live projectiles on average, %.1f M projectile updates/s\n",
+               (double)projectile_ticks / ticks, projectile_ticks / seconds / 1e6);
+    }
+    printf("headless: checksum %016llx (seed %u%s)\n", (unsigned long long)checksum, seed, portalMode ? ", portal mode" : "");
+    return 0;
+}
+
+// Checks the broadphase grid against testing every pair, for the state a game is in right now:
+//  - every obstacle overlapping a live projectile is linked into the cell under the projectile's
+//    top-left corner, and that cell is marked occupied (so the projectile is a candidate)
+//  - with checkPlayer, a projectile in the player's hit/near-miss reach is in an occupied cell too, and
+//    findObstaclesNear(player) returns every obstacle touching the player
+// Returns the number of pairs the grid got wrong and adds the number of pairs looked at to *pairs.
+static uint64_t checkBroadphaseGrid(SimState& s, bool checkPlayer, uint64_t* pairs) {
+    BroadphaseGrid& grid = s.grid;
+    const ProjectilePool& pool = s.projectiles;
+    uint64_t wrong = 0;
+    const float player_reach_margin = PROJECTILE_SIZE / 2.0f + NEAR_MISS_MARGIN; // As in stepSimulation
+    const Rectangle player_rect = {s.player_x, s.player_y, player_size, player_size};
+    const Rectangle player_reach = {s.player_x - player_reach_margin, s.player_y - player_reach_margin,
+                                    player_size + 2.0f * player_reach_margin, player_size + 2.0f * player_reach_margin};
+
+    for (int i = 0; i < pool.high_water; ++i) {
+        if ((pool.flags[i] & PROJECTILE_ACTIVE) == 0u) {
+            continue;
+        }
+        const Rectangle projectile_rect = {pool.x[i], pool.y[i], PROJECTILE_SIZE, PROJECTILE_SIZE};
+        const int cell = gridRow(grid, projectile_rect.y) * grid.cols + gridColumn(grid, projectile_rect.x);
+        for (int index = 0; index < (int)s.obstacles.size(); ++index) {
+            const Obstacle& obstacle = s.obstacles[index];
+            (*pairs)++;
+            if (!rectsOverlap(projectile_rect, {obstacle.x, obstacle.y, obstacle_size, obstacle_size})) {
+                continue;
+            }
+            bool linked = false;
+            for (int node = grid.cell_head[cell]; node >= 0; node = grid.node_next[node]) {
+                linked = linked || node / 4 == index;
+            }
+            if (!linked || grid.occupancy[cell] == 0u) {
+                wrong++;
+            }
+        }
+        if (checkPlayer) {
+            (*pairs)++;
+            if (rectsOverlap(projectile_rect, player_reach) && grid.occupancy[cell] == 0u) {
+                wrong++;
+            }
+        }
+    }
+
+    if (checkPlayer) {
+        const std::vector<int>& near_player = findObstaclesNear(grid, player_rect);
+        for (int index = 0; index < (int)s.obstacles.size(); ++index) {
+            const Obstacle& obstacle = s.obstacles[index];
+            (*pairs)++;
+            if (rectsOverlap(player_rect, {obstacle.x, obstacle.y, obstacle_size, obstacle_size}) &&
+                std::find(near_player.begin(), near_player.end(), index) == near_player.end()) {
+                wrong++;
+            }
+        }
+    }
+    return wrong;
+}
+
+// --selftest-broadphase: plays swarm games with stress projectiles, in normal and portal mode, recentering
+// the world now and then, and after every tick (and every recenter) checks the grid against testing
+// every pair (checkBroadphaseGrid). The grid only decides what gets an exact check, so if it never
+// misses a pair the game plays exactly as it would testing every pair. Passes if nothing was missed.
+int runBroadphaseSelfTest() {
+    const uint64_t ticks_per_mode = 20000;
+    const int recenter_every = 300;
+    bool passed = true;
+    for (bool portal_mode : {false, true}) {
+        SimOptions options;
+        options.world_width = SCREEN_WIDTH;
+        options.world_height = SCREEN_HEIGHT;
+        options.portal_mode = portal_mode;
+        options.stress_projectiles = 300;
+        options.swarm_size = 40;
+        SimState s;
+        resetSimulation(s, options);
+
+        uint32_t rng_state = 1;
+        InputSnapshot input;
+        uint64_t pairs = 0;
+        uint64_t wrong = 0;
+        uint64_t games = 0;
+        for (uint64_t i = 0; i < ticks_per_mode; ++i) {
+            if (i % recenter_every == recenter_every - 1) {
+                resizeWorld(s, s.world_width, s.world_height, true);
+                wrong += checkBroadphaseGrid(s, false, &pairs); // The player's reach moves at the next tick
+            }
+            input = scriptedHeadlessInput(rng_state, i, input);
+            stepSimulation(s, input);
+            s.pending_achievements.clear();
+            wrong += checkBroadphaseGrid(s, true, &pairs);
+            if (s.game_over) {
+                games++;
+                resetSimulation(s, options);
+            }
+        }
+        printf("selftest-broadphase: %s mode: %llu ticks, %llu games, %llu pairs checked, %llu missed by the grid\n",
+               portal_mode ? "portal" : "normal", (unsigned long long)ticks_per_mode, (unsigned long long)games,
+               (unsigned long long)pairs, (unsigned long long)wrong);
+        passed = passed && wrong == 0 && pairs > 0;
+    }
+    printf("selftest-broadphase: %s\n", passed ? "PASS" : "FAIL");
+    return passed ? 0 : 1;
+}
+
+// --verify-replays: re-simulates every replay in a directory at full speed, spread over `jobs` threads
+// (each with its own SimState), and reports any whose score or achievements don't come out as recorded.
+// Calls worker(i) for every i in [0, jobs) on its own thread, the calling thread taking worker 0,
+// and returns once they have all finished
+template <typename Worker>
+static void runOnThreads(int jobs, const Worker& worker) {
+    std::vector<std::thread> threads;
+    for (int i = 1; i < jobs; ++i) {
+        threads.emplace_back([&worker, i]() { worker(i); });
+    }
+    worker(0); // The main thread works too
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+// Returns 1 if any replay failed.
+int runReplayVerification(const std::string& directory, int jobs) {
+    std::vector<std::string> paths;
+    if (!listReplayFiles(directory, &paths)) {
+        fprintf(stderr, "verify-replays: can't open directory %s\n", directory.c_str());
+        return 1;
+    }
+
+    if (jobs <= 0) {
+        jobs = (int)std::max(1u, std::thread::hardware_concurrency());
+    }
+    jobs = std::max(1, std::min(jobs, (int)paths.size()));
+
+    // Workers take the next unchecked replay until there are none left; results go in per-replay slots
+    std::vector<std::string> problems(paths.size());
+    std::vector<uint64_t> ticks(paths.size(), 0);
+    std::atomic<size_t> next_replay(0);
+    auto worker = [&](int) {
+        SimState scratch;
+        Replay replay;
+        std::string bytes;
+        while (true) {
+            size_t index = next_replay.fetch_add(1);
+            if (index >= paths.size()) {
+                break;
+            }
+            std::ifstream file(paths[index], std::ios::binary);
+            if (!file.is_open()) {
+                problems[index] = "can't open file";
+                continue;
+            }
+            bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            std::string problem;
+            if (!parseReplay(bytes, &replay, &problem)) {
+                problems[index] = problem.empty() ? "invalid" : problem;
+                continue; // Nothing simulated, so no ticks to count
+            }
+            if (!verifyReplay(replay, scratch, &problem)) {
+                problems[index] = problem.empty() ? "invalid" : problem;
+            }
+            ticks[index] = scratch.tick;
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    runOnThreads(jobs, worker);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t failed = 0;
+    uint64_t total_ticks = 0;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        total_ticks += ticks[i];
+        if (!problems[i].empty()) {
+            printf("verify-replays: FAIL %s: %s\n", paths[i].c_str(), problems[i].c_str());
+            failed++;
+        }
+    }
+    printf("verify-replays: %zu replays, %zu ok, %zu failed in %.3f s on %d threads (%.0f replays/s, %.1f M ticks/s, %.0fx real time)\n",
+           paths.size(), paths.size() - failed, failed, seconds, jobs, paths.size() / seconds,
+           total_ticks / seconds / 1e6, total_ticks * SIM_TICK_SECONDS / seconds);
+    return failed == 0 ? 0 : 1;
+}
+
+// --- Tuning Bot Farm ---
+// --tune plays thousands of bot games for every combination of the swept settings (--tune-sweep) and
+// reports how long the bot survives and how often it earns each achievement. Games run on a work-stealing
+// pool: every thread starts with its own share of the tasks (a few games each) and, once it runs dry,
+// steals from the others, so settings that make games longer don't leave threads idle. Each game has its
+// own SimState and bot, and game i of every setting uses the same seed, so settings are compared on
+// the same "player".
+
+// Heuristic stand-in for a player: runs from the nearest obstacle and away from the walls, sidesteps
+// obstacle shots heading for it (dashing if one is about to hit), and shoots at the nearest obstacle
+// whenever its shot is ready. Deliberately simple: a yardstick for comparing settings, not a good player.
+static InputSnapshot heuristicBotInput(const SimState& s, uint32_t& rng_state) {
+    InputSnapshot input;
+    const float player_center_x = s.player_x + player_size / 2.0f;
+    const float player_center_y = s.player_y + player_size / 2.0f;
+
+    // Nearest obstacle
+    float nearest_dx = 0.0f;
+    float nearest_dy = -1.0f;
+    float nearest_distance = 1e30f;
+    for (const Obstacle& obstacle : s.obstacles) {
+        float dx = obstacle.x + obstacle_size / 2.0f - player_center_x;
+        float dy = obstacle.y + obstacle_size / 2.0f - player_center_y;
+        float distance = sqrtf(dx * dx + dy * dy);
+        if (distance < nearest_distance) {
+            nearest_distance = distance;
+            nearest_dx = dx;
+            nearest_dy = dy;
+        }
+    }
+    float safe_distance = std::max(nearest_distance, 1.0f);
+    float move_x = -nearest_dx / safe_distance * (200.0f / safe_distance);
+    float move_y = -nearest_dy / safe_distance * (200.0f / safe_distance);
+
+    // Keep off the walls, where there's nowhere to run
+    const float wall_margin = 150.0f;
+    if (player_center_x < wall_margin) move_x += (wall_margin - player_center_x) / wall_margin;
+    if (player_center_x > s.world_width - wall_margin) move_x -= (player_center_x - (s.world_width - wall_margin)) / wall_margin;
+    if (player_center_y < wall_margin) move_y += (wall_margin - player_center_y) / wall_margin;
+    if (player_center_y > s.world_height - wall_margin) move_y -= (player_center_y - (s.world_height - wall_margin)) / wall_margin;
+
+    // Sidestep obstacle shots that will pass close by in the next 40 ticks
+    const ProjectilePool& pool = s.projectiles;
+    bool about_to_be_hit = false;
+    for (int i = 0; i < pool.high_water; ++i) {
+        if ((pool.flags[i] & PROJECTILE_ACTIVE) == 0 || (pool.flags[i] & PROJECTILE_PLAYER_SHOT)) {
+            continue;
+        }
+        float rx = pool.x[i] + PROJECTILE_SIZE / 2.0f - player_center_x;
+        float ry = pool.y[i] + PROJECTILE_SIZE / 2.0f - player_center_y;
+        float speed_squared = pool.vx[i] * pool.vx[i] + pool.vy[i] * pool.vy[i];
+        if (speed_squared <= 0.0f) {
+            continue;
+        }
+        float ticks_to_closest = -(rx * pool.vx[i] + ry * pool.vy[i]) / speed_squared;
+        if (ticks_to_closest < 0.0f || ticks_to_closest > 40.0f) {
+            continue;
+        }
+        float closest_x = rx + pool.vx[i] * ticks_to_closest;
+        float closest_y = ry + pool.vy[i] * ticks_to_closest;
+        float closest_distance = sqrtf(closest_x * closest_x + closest_y * closest_y);
+        if (closest_distance > player_size) {
+            continue;
+        }
+        // Move across the shot's path, to whichever side we're already on
+        float speed = sqrtf(speed_squared);
+        float side = (closest_x * -pool.vy[i] + closest_y * pool.vx[i]) >= 0.0f ? 1.0f : -1.0f;
+        move_x += side * -pool.vy[i] / speed * 3.0f;
+        move_y += side * pool.vx[i] / speed * 3.0f;
+        about_to_be_hit = about_to_be_hit || ticks_to_closest < 8.0f;
+    }
+
+    // A little noise so the bot doesn't settle into the same loop every game
+    move_x += (nextRandomUnit(rng_state) - 0.5f) * 0.4f;
+    move_y += (nextRandomUnit(rng_state) - 0.5f) * 0.4f;
+
+    const float threshold = 0.25f;
+    input.move_left = move_x < -threshold;
+    input.move_right = move_x > threshold;
+    input.move_up = move_y < -threshold;
+    input.move_down = move_y > threshold;
+
+    // Aim at the nearest obstacle (8 directions, like the keyboard)
+    float aim_angle = atan2f(nearest_dy, nearest_dx);
+    int octant = ((int)lroundf(aim_angle / (PI / 4.0f)) + 8) % 8; // 0 = right, 2 = down, 4 = left, 6 = up
+    input.aim_right = octant == 7 || octant == 0 || octant == 1;
+    input.aim_down = octant == 1 || octant == 2 || octant == 3;
+    input.aim_left = octant == 3 || octant == 4 || octant == 5;
+    input.aim_up = octant == 5 || octant == 6 || octant == 7;
+    input.shoot_pressed = s.time - s.player_last_shot_time >= s.tuning.player_shoot_cooldown;
+    input.dash_pressed = about_to_be_hit && s.time - s.player_last_dash_time >= s.tuning.player_dash_cooldown;
+    return input;
+}
+
+// The tuning a normal game gets (DIFFICULTY_SETTINGS["normal"] plus the constants)
+static SimTuning defaultSimTuning() {
+    SimTuning tuning;
+    const DifficultySettings& settings = DIFFICULTY_SETTINGS.at("normal");
+    tuning.player_speed = settings.player_speed;
+    tuning.obstacle_speed = settings.obstacle_speed;
+    tuning.ai_reaction_delay = settings.ai_reaction_delay;
+    return tuning;
+}
+
+const TuningParameter TUNING_PARAMETERS[] = {
+    {"player_speed", [](SimTuning& t, double v) { t.player_speed = (float)v; }, [](const SimTuning& t) { return (double)t.player_speed; }},
+    {"obstacle_speed", [](SimTuning& t, double v) { t.obstacle_speed = (float)v; }, [](const SimTuning& t) { return (double)t.obstacle_speed; }},
+    {"ai_reaction_delay", [](SimTuning& t, double v) { t.ai_reaction_delay = (int)v; }, [](const SimTuning& t) { return (double)t.ai_reaction_delay; }},
+    {"prediction_frames", [](SimTuning& t, double v) { t.prediction_frames = (int)v; }, [](const SimTuning& t) { return (double)t.prediction_frames; }},
+    {"player_shoot_cooldown", [](SimTuning& t, double v) { t.player_shoot_cooldown = (float)v; }, [](const SimTuning& t) { return (double)t.player_shoot_cooldown; }},
+    {"player_stun_shot_cooldown", [](SimTuning& t, double v) { t.player_stun_shot_cooldown = v; }, [](const SimTuning& t) { return t.player_stun_shot_cooldown; }},
+    {"obstacle_shoot_cooldown", [](SimTuning& t, double v) { t.obstacle_shoot_cooldown = (float)v; }, [](const SimTuning& t) { return (double)t.obstacle_shoot_cooldown; }},
+    {"obstacle_stun_cooldown", [](SimTuning& t, double v) { t.obstacle_stun_cooldown = v; }, [](const SimTuning& t) { return t.obstacle_stun_cooldown; }},
+    {"obstacle_stun_duration", [](SimTuning& t, double v) { t.obstacle_stun_duration = v; }, [](const SimTuning& t) { return t.obstacle_stun_duration; }},
+    {"player_stun_duration", [](SimTuning& t, double v) { t.player_stun_duration = v; }, [](const SimTuning& t) { return t.player_stun_duration; }},
+    {"player_dash_cooldown", [](SimTuning& t, double v) { t.player_dash_cooldown = v; }, [](const SimTuning& t) { return t.player_dash_cooldown; }},
+    {"player_dash_duration", [](SimTuning& t, double v) { t.player_dash_duration = v; }, [](const SimTuning& t) { return t.player_dash_duration; }},
+};
+
+// Parses "NAME=V1,V2,..." into `sweep`; prints what's wrong and returns false otherwise
+bool parseTuningSweep(const std::string& text, TuningSweep* sweep) {
+    size_t equals = text.find('=');
+    std::string name = text.substr(0, equals);
+    sweep->parameter = nullptr;
+    for (const TuningParameter& parameter : TUNING_PARAMETERS) {
+        if (name == parameter.name) {
+            sweep->parameter = &parameter;
+        }
+    }
+    if (sweep->parameter == nullptr || equals == std::string::npos) {
+        fprintf(stderr, "tune: bad sweep '%s'; expected NAME=V1,V2,... with NAME one of:", text.c_str());
+        for (const TuningParameter& parameter : TUNING_PARAMETERS) {
+            fprintf(stderr, " %s", parameter.name);
+        }
+        fprintf(stderr, "\n");
+        return false;
+    }
+    std::stringstream values(text.substr(equals + 1));
+    std::string value;
+    sweep->values.clear();
+    while (std::getline(values, value, ',')) {
+        char* end = nullptr;
+        double number = strtod(value.c_str(), &end);
+        if (value.empty() || *end != '\0') {
+            fprintf(stderr, "tune: '%s' in sweep '%s' isn't a number\n", value.c_str(), text.c_str());
+            return false;
+        }
+        sweep->values.push_back(number);
+    }
+    if (sweep->values.empty()) {
+        fprintf(stderr, "tune: sweep '%s' has no values; expected NAME=V1,V2,...\n", text.c_str());
+        return false;
+    }
+    return true;
+}
+
+struct TuneTask {
+    int setting;
+    int first_game;
+    int game_count;
+};
+
+// One thread's share of the tasks. The owner takes from the back; thieves take from the front.
+struct TuneTaskQueue {
+    std::mutex mutex;
+    std::deque<TuneTask> tasks;
+};
+
+// Per-thread tallies, merged after the run so the threads never share a counter
+struct TuneWorkerTotals {
+    std::vector<uint32_t> achievement_games; // [setting * achievement_count + achievement]
+    std::vector<uint32_t> capped_games;      // [setting]
+    uint64_t ticks = 0;
+    uint64_t tasks_stolen = 0;
+};
+
+int runTuning(const TuneConfig& config) {
+    std::vector<std::string> achievement_ids;
+    std::vector<int> achievement_index(ACHIEVEMENT_NAMES.size(), -1); // AchievementId -> column
+    for (const auto& pair : ALL_ACHIEVEMENTS) {
+        achievement_index[pair.second.index] = (int)achievement_ids.size();
+        achievement_ids.push_back(pair.first);
+    }
+    const int achievement_count = (int)achievement_ids.size();
+    const double win_threshold = WIN_THRESHOLD_TIMES.at("normal");
+
+    // Every combination of the swept values, starting from the normal game's tuning
+    std::vector<SimTuning> settings(1, defaultSimTuning());
+    for (const TuningSweep& sweep : config.sweeps) {
+        std::vector<SimTuning> combined;
+        for (const SimTuning& setting : settings) {
+            for (double value : sweep.values) {
+                SimTuning changed = setting;
+                sweep.parameter->set(changed, value);
+                combined.push_back(changed);
+            }
+        }
+        settings.swap(combined);
+    }
+    const int setting_count = (int)settings.size();
+    const uint64_t max_ticks = (uint64_t)(config.max_game_seconds * FPS);
+    int jobs = config.jobs > 0 ? config.jobs : (int)std::max(1u, std::thread::hardware_concurrency());
+
+    // Deal the tasks out in contiguous blocks; stealing evens things out as games run long or short
+    const int games_per_task = 8;
+    std::vector<TuneTask> all_tasks;
+    for (int setting = 0; setting < setting_count; ++setting) {
+        for (int game = 0; game < config.games_per_setting; game += games_per_task) {
+            all_tasks.push_back(TuneTask{setting, game, std::min(games_per_task, config.games_per_setting - game)});
+        }
+    }
+    jobs = std::max(1, std::min(jobs, (int)all_tasks.size()));
+    std::vector<TuneTaskQueue> queues(jobs);
+    for (size_t i = 0; i < all_tasks.size(); ++i) {
+        queues[i * jobs / all_tasks.size()].tasks.push_back(all_tasks[i]);
+    }
+    // survival[setting][game]: each slot is written by whichever thread plays that game
+    std::vector<std::vector<float>> survival(setting_count, std::vector<float>(config.games_per_setting, 0.0f));
+    std::vector<TuneWorkerTotals> totals(jobs);
+
+    auto take_task = [&](int worker, TuneTask* task) {
+        {
+            std::lock_guard<std::mutex> lock(queues[worker].mutex);
+            if (!queues[worker].tasks.empty()) {
+                *task = queues[worker].tasks.back();
+                queues[worker].tasks.pop_back();
+                return true;
+            }
+        }
+        for (int offset = 1; offset < jobs; ++offset) {
+            TuneTaskQueue& victim = queues[(worker + offset) % jobs];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                *task = victim.tasks.front();
+                victim.tasks.pop_front();
+                totals[worker].tasks_stolen++;
+                return true;
+            }
+        }
+        return false; // No task is ever added during the run, so every queue is empty for good
+    };
+
+    auto worker = [&](int worker_index) {
+        TuneWorkerTotals& mine = totals[worker_index];
+        mine.achievement_games.assign((size_t)setting_count * achievement_count, 0);
+        mine.capped_games.assign(setting_count, 0);
+        SimState game;
+        TuneTask task;
+        while (take_task(worker_index, &task)) {
+            SimOptions options;
+            options.tuning = &settings[task.setting];
+            for (int game_index = task.first_game; game_index < task.first_game + task.game_count; ++game_index) {
+                uint32_t game_seed = (uint32_t)game_index * 2654435761u + 1u; // Same for game i of every setting
+                options.seed = game_seed;
+                resetSimulation(game, options);
+                uint32_t rng_state = game_seed;
+                InputSnapshot input;
+                while (!game.game_over && game.tick < max_ticks) {
+                    input = config.scripted_bot ? scriptedHeadlessInput(rng_state, game.tick, input)
+                                                : heuristicBotInput(game, rng_state);
+                    stepSimulation(game, input);
+                    for (AchievementId achievement_id : game.pending_achievements) {
+                        if (achievement_index[achievement_id] >= 0) {
+                            mine.achievement_games[(size_t)task.setting * achievement_count + achievement_index[achievement_id]]++;
+                        }
+                    }
+                    game.pending_achievements.clear();
+                }
+                mine.ticks += game.tick;
+                if (!game.game_over) {
+                    mine.capped_games[task.setting]++;
+                }
+                survival[task.setting][game_index] = (float)(game.game_over ? game.final_survival_time_s : game.elapsed_time_s);
+            }
+        }
+    };
+
+    printf("tune: %d settings x %d games, %s bot, %d threads, games stop at %.0f s\n", setting_count,
+           config.games_per_setting, config.scripted_bot ? "scripted" : "heuristic", jobs, config.max_game_seconds);
+    auto start = std::chrono::steady_clock::now();
+    runOnThreads(jobs, worker);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Merge the per-thread tallies
+    std::vector<uint32_t> achievement_games((size_t)setting_count * achievement_count, 0);
+    std::vector<uint32_t> capped_games(setting_count, 0);
+    uint64_t total_ticks = 0;
+    uint64_t tasks_stolen = 0;
+    for (const TuneWorkerTotals& worker_totals : totals) {
+        for (size_t i = 0; i < achievement_games.size(); ++i) {
+            achievement_games[i] += worker_totals.achievement_games[i];
+        }
+        for (int i = 0; i < setting_count; ++i) {
+            capped_games[i] += worker_totals.capped_games[i];
+        }
+        total_ticks += worker_totals.ticks;
+        tasks_stolen += worker_totals.tasks_stolen;
+    }
+
+    std::ofstream csv;
+    if (!config.csv_path.empty()) {
+        csv.open(config.csv_path);
+        for (const TuningParameter& parameter : TUNING_PARAMETERS) {
+            csv << parameter.name << ",";
+        }
+        csv << "games,mean_s,p10_s,p25_s,p50_s,p75_s,p90_s,max_s,capped,win_rate";
+        for (const std::string& achievement_id : achievement_ids) {
+            csv << "," << achievement_id;
+        }
+        csv << "\n";
+    }
+
+    const SimTuning defaults = defaultSimTuning();
+    const int games = config.games_per_setting;
+    for (int setting = 0; setting < setting_count; ++setting) {
+        std::vector<float>& times = survival[setting];
+        std::sort(times.begin(), times.end());
+        double total = 0.0;
+        int wins = 0;
+        for (float time : times) {
+            total += time;
+            wins += time >= win_threshold ? 1 : 0;
+        }
+        auto percentile = [&times](double fraction) { return times[(size_t)(fraction * (times.size() - 1))]; };
+
+        // Name the setting by what differs from a normal game
+        std::string label;
+        for (const TuningParameter& parameter : TUNING_PARAMETERS) {
+            if (parameter.get(settings[setting]) != parameter.get(defaults)) {
+                char part[64];
+                snprintf(part, sizeof(part), "%s%s=%g", label.empty() ? "" : " ", parameter.name, parameter.get(settings[setting]));
+                label += part;
+            }
+        }
+        printf("tune: [%d] %s\n", setting + 1, label.empty() ? "normal game (no changes)" : label.c_str());
+        printf("tune:     survival s: mean %.1f  p10 %.1f  p25 %.1f  p50 %.1f  p75 %.1f  p90 %.1f  max %.1f (%u hit the limit)  win rate %.1f%% (>= %.0f s)\n",
+               total / games, percentile(0.10), percentile(0.25), percentile(0.50), percentile(0.75), percentile(0.90),
+               times.back(), capped_games[setting], 100.0 * wins / games, win_threshold);
+        std::string hit_rates;
+        for (int a = 0; a < achievement_count; ++a) {
+            uint32_t hits = achievement_games[(size_t)setting * achievement_count + a];
+            if (hits > 0) {
+                char part[96];
+                snprintf(part, sizeof(part), "%s%s %.1f%%", hit_rates.empty() ? "" : ", ", achievement_ids[a].c_str(), 100.0 * hits / games);
+                hit_rates += part;
+            }
+        }
+        printf("tune:     achievements: %s\n", hit_rates.empty() ? "none" : hit_rates.c_str());
+
+        if (csv.is_open()) {
+            for (const TuningParameter& parameter : TUNING_PARAMETERS) {
+                csv << parameter.get(settings[setting]) << ",";
+            }
+            csv << games << "," << total / games << "," << percentile(0.10) << "," << percentile(0.25) << ","
+                << percentile(0.50) << "," << percentile(0.75) << "," << percentile(0.90) << "," << times.back() << ","
+                << capped_games[setting] << "," << (double)wins / games;
+            for (int a = 0; a < achievement_count; ++a) {
+                csv << "," << (double)achievement_games[(size_t)setting * achievement_count + a] / games;
+            }
+            csv << "\n";
+        }
+    }
+
+    const double total_games = (double)setting_count * games;
+    const int cores = std::max(1, std::min(jobs, (int)std::thread::hardware_concurrency()));
+    printf("tune: %.0f games (%.1f M ticks) in %.2f s: %.0f games/s, %.0f games/s per core (%d cores busy), %.1f M ticks/s; %zu tasks, %llu stolen\n",
+           total_games, total_ticks / 1e6, seconds, total_games / seconds, total_games / seconds / cores, cores,
+           total_ticks / seconds / 1e6, all_tasks.size(), (unsigned long long)tasks_stolen);
+    if (csv.is_open()) {
+        printf("tune: wrote %s\n", config.csv_path.c_str());
+    }
+    return 0;
+}
+
+// --selftest-slow-io: saves to a disk that stalls write_delay_ms on every write. First a few saves go the
+// old synchronous way (to show the stall), then the game runs paced frames saving through the save thread.
+// Then a kiosk's worth of profiles (kiosk_profiles) is added and some of them unlock achievements, each
+// of which saves on the frame thread. The last save fails twice before it reaches the disk.
+// Passes if no write-behind frame comes anywhere near the disk delay, no unlock with thousands of
+// profiles takes more than a millisecond, bursts were merged into fewer writes, and after shutdown the
+// file holds the last snapshot. Uses its own file, not the real save.
+int runSlowIoSelfTest() {
+    const int write_delay_ms = 100;
+    const int frames = 180; // 3 seconds at 60 FPS
+    const int frames_between_saves = 5;
+    const int kiosk_profiles = 10000;
+    const int kiosk_unlocks = 60;
+    const std::string test_path = "dodger_selftest_save.json";
+
+    persistence.path = test_path;
+    persistence.injected_write_delay_ms = write_delay_ms;
+    current_username = "SelfTest";
+    UNLOCKED_ACHIEVEMENTS_BY_USER.clear();
+    HIGH_SCORES_BY_USER.clear();
+    profile_store.json_rewrite_pending = true;
+
+    SimState test_sim;
+    resetSimulation(test_sim, SimOptions());
+    uint32_t rng_state = 1;
+    InputSnapshot input;
+    // One frame of gameplay, saving every few frames like a run of unlocks would. Returns its duration in ms.
+    auto runFrame = [&](int frame, bool synchronousSave) {
+        auto start = std::chrono::steady_clock::now();
+        input = scriptedHeadlessInput(rng_state, frame, input);
+        stepSimulation(test_sim, input);
+        if (test_sim.game_over) {
+            resetSimulation(test_sim, SimOptions());
+        }
+        if (frame % frames_between_saves == 0) {
+            UNLOCKED_ACHIEVEMENTS_BY_USER[current_username].insert(internAchievementId("selftest_" + std::to_string(frame)));
+            if (synchronousSave) {
+                writeSaveFileAtomically(test_path, serializeSaveSnapshot(takeFullSaveSnapshot()), write_delay_ms);
+            } else {
+                saveGameData();
+            }
+        }
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    double synchronous_worst_ms = 0.0;
+    for (int frame = 0; frame < 3 * frames_between_saves; ++frame) {
+        synchronous_worst_ms = std::max(synchronous_worst_ms, runFrame(frame, true));
+    }
+
+    std::vector<double> frame_ms;
+    frame_ms.reserve(frames);
+    auto next_frame = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        frame_ms.push_back(runFrame(frame, false));
+        next_frame += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(SIM_TICK_SECONDS));
+        std::this_thread::sleep_until(next_frame);
+    }
+
+    // The kiosk: thousands of profiles, loaded once (like at startup), then unlocks for some of them
+    for (int i = 0; i < kiosk_profiles; ++i) {
+        const std::string username = "kiosk_" + std::to_string(i);
+        UNLOCKED_ACHIEVEMENTS_BY_USER[username].insert(internAchievementId("selftest_kiosk"));
+        HIGH_SCORES_BY_USER[username]["normal"] = i / 10.0;
+    }
+    profile_store.json_rewrite_pending = true;
+    saveGameData();
+    AchievementId kiosk_achievement = ACHIEVEMENT_NONE;
+    for (AchievementId id = 0; id < ACHIEVEMENTS_BY_ID.size() && kiosk_achievement == ACHIEVEMENT_NONE; ++id) {
+        if (ACHIEVEMENTS_BY_ID[id] != nullptr) {
+            kiosk_achievement = id;
+        }
+    }
+    double kiosk_worst_ms = 0.0;
+    for (int i = 0; i < kiosk_unlocks; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        unlockAchievement(kiosk_achievement, "kiosk_" + std::to_string(i * (kiosk_profiles / kiosk_unlocks)));
+        kiosk_worst_ms = std::max(kiosk_worst_ms, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(persistence.mutex);
+        persistence.injected_write_failures = 2;
+    }
+    UNLOCKED_ACHIEVEMENTS_BY_USER[current_username].insert(internAchievementId("selftest_after_failures"));
+    saveGameData();
+    const std::string expected_contents = serializeSaveSnapshot(takeFullSaveSnapshot());
+    shutdownPersistence();
+    UNLOCKED_ACHIEVEMENTS_BY_USER.clear();
+    HIGH_SCORES_BY_USER.clear();
+
+    std::ifstream saved_file(test_path);
+    std::stringstream saved_contents;
+    saved_contents << saved_file.rdbuf();
+    saved_file.close();
+    remove(test_path.c_str());
+
+    std::sort(frame_ms.begin(), frame_ms.end());
+    double total_ms = 0.0;
+    for (double ms : frame_ms) {
+        total_ms += ms;
+    }
+    const double p99_ms = frame_ms[(size_t)(0.99 * (frame_ms.size() - 1))];
+    const double worst_ms = frame_ms.back();
+
+    const bool frames_flat = worst_ms < write_delay_ms / 10.0;
+    const bool kiosk_unlocks_cheap = kiosk_worst_ms < 1.0;
+    const bool bursts_merged = persistence.writes < persistence.requests;
+    const bool file_matches = saved_contents.str() == expected_contents;
+    const bool failures_retried = persistence.failures == 2;
+    printf("selftest-slow-io: every write stalls %d ms\n", write_delay_ms);
+    printf("selftest-slow-io: synchronous saves: worst frame %.2f ms\n", synchronous_worst_ms);
+    printf("selftest-slow-io: write-behind: %d frames, %llu save requests -> %llu writes, frame avg %.3f ms, p99 %.3f ms, worst %.3f ms\n",
+           frames, (unsigned long long)persistence.requests, (unsigned long long)persistence.writes,
+           total_ms / frames, p99_ms, worst_ms);
+    printf("selftest-slow-io: %d profiles: %d unlocks, worst %.3f ms on the frame thread\n", kiosk_profiles, kiosk_unlocks, kiosk_worst_ms);
+    printf("selftest-slow-io: frames flat: %s, unlocks cheap: %s, bursts merged: %s, failed writes retried: %s, file holds last snapshot: %s\n",
+           frames_flat ? "yes" : "NO", kiosk_unlocks_cheap ? "yes" : "NO", bursts_merged ? "yes" : "NO",
+           failures_retried ? "yes" : "NO", file_matches ? "yes" : "NO");
+    bool passed = frames_flat && kiosk_unlocks_cheap && bursts_merged && failures_retried && file_matches;
+    printf("selftest-slow-io: %s\n", passed ? "PASS" : "FAIL");
+    return passed ? 0 : 1;
+}
+
+#ifdef DODGER_ALLOC_COUNT
+// --selftest-frame-allocs: opens the window and checks that steady frames don't allocate. Counts operator
+// new calls (see heap_allocation_count) across whole frames, update and draw, in three phases:
+//   screens - the static screens, drawn for a while each; only the first frame (the cache redraw) may allocate
+//   play    - a live game with no keys held, until it ends
+//   replay  - watching a long bot game at 1x
+// Frames that unlock an achievement count like any other (the unlock goes to the save thread without a
+// snapshot, see queueAchievementUnlock) and the play phase must have at least one. The frame that ends
+// the game or the replay leaves play: it finishes the replay, saves a high score and draws the game over
+// screen into its cache, so its allocations are reported on their own. Passes if every other frame did
+// zero allocations. Uses its own save file and a temporary replay directory, not the real ones.
+int runFrameAllocationSelfTest() {
+    const int frames_per_screen = 30;
+    const int max_play_frames = 60 * FPS;
+    const std::string test_path = "dodger_selftest_allocs.json";
+
+    SetTraceLogLevel(LOG_WARNING);
+    InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Dodger frame allocation self-test");
+    SCREEN_WIDTH = GetScreenWidth();
+    SCREEN_HEIGHT = GetScreenHeight();
+    persistence.path = test_path;
+    char replay_directory_template[] = "/tmp/dodger_selftest_replays_XXXXXX";
+    if (mkdtemp(replay_directory_template) == nullptr) {
+        printf("frame-allocs: can't create a temporary replay directory\n");
+        return 1;
+    }
+    replay_directory = replay_directory_template;
+    switchToProfile("AllocTest");
+    saveGameData(); // As loadGameData() does: the save thread gets its copy of the profiles before play
+
+    // Runs one frame the way the main loop does; returns how many allocations it made
+    auto run_frame = [](bool update) {
+        uint64_t before = heap_allocation_count;
+        if (update) {
+            updateGame(SIM_TICK_SECONDS);
+        }
+        BeginDrawing();
+        ClearBackground(BLACK);
+        drawGame();
+        EndDrawing();
+        return heap_allocation_count - before;
+    };
+
+    // Screens: draw only (updating would act on whatever keys are down)
+    const GameState screens[] = {GAME_STATE_USERNAME_INPUT, GAME_STATE_MAIN_MENU, GAME_STATE_ACHIEVEMENTS, GAME_STATE_GAME_OVER};
+    uint64_t screen_frames = 0;
+    uint64_t screen_allocations = 0;
+    uint64_t redraws_before = static_screen.redraws;
+    for (GameState screen : screens) {
+        current_game_state = screen;
+        for (int frame = 0; frame < frames_per_screen; ++frame) {
+            uint64_t allocations = run_frame(false);
+            if (frame > 0) {
+                screen_frames++;
+                screen_allocations += allocations;
+            }
+        }
+    }
+    uint64_t screen_redraws = static_screen.redraws - redraws_before;
+
+    // Play: a real game through updateGame, as if nobody touched the keyboard
+    resetGame();
+    current_game_state = GAME_STATE_PLAYING;
+    uint64_t play_frames = 0;
+    uint64_t play_unlock_frames = 0;
+    uint64_t play_allocations = 0;
+    uint64_t game_over_allocations = 0;
+    for (int frame = 0; frame < max_play_frames && current_game_state == GAME_STATE_PLAYING; ++frame) {
+        size_t achievements_before = game_replay.achievements.size();
+        uint64_t allocations = run_frame(true);
+        if (current_game_state != GAME_STATE_PLAYING) {
+            game_over_allocations = allocations;
+            break;
+        }
+        play_frames++;
+        play_allocations += allocations;
+        if (game_replay.achievements.size() != achievements_before) {
+            play_unlock_frames++;
+        }
+    }
+
+    // Replay: the longest of a few heuristic bot games, so there's shooting, dashing and stuns to draw
+    SimOptions options;
+    options.world_width = SCREEN_WIDTH;
+    options.world_height = SCREEN_HEIGHT;
+    std::string longest_replay;
+    uint64_t longest_ticks = 0;
+    SimState bot_game;
+    for (uint32_t seed = 1; seed <= 8; ++seed) {
+        options.seed = seed;
+        resetSimulation(bot_game, options);
+        ReplayRecorder recorder;
+        replayBegin(recorder, options, "AllocTest");
+        uint32_t rng_state = seed;
+        while (!bot_game.game_over && bot_game.tick < (uint64_t)max_play_frames) {
+            InputSnapshot input = heuristicBotInput(bot_game, rng_state);
+            replayRecordTick(recorder, input);
+            stepSimulation(bot_game, input);
+            recorder.achievements.insert(recorder.achievements.end(), bot_game.pending_achievements.begin(), bot_game.pending_achievements.end());
+            bot_game.pending_achievements.clear();
+        }
+        if (bot_game.game_over && bot_game.tick > longest_ticks) {
+            longest_ticks = bot_game.tick;
+            longest_replay = replayFinish(recorder, bot_game);
+        }
+    }
+    uint64_t replay_frames = 0;
+    uint64_t replay_unlock_frames = 0;
+    uint64_t replay_allocations = 0;
+    uint64_t replay_end_allocations = 0;
+    if (!longest_replay.empty() && startReplayPlayback(longest_replay, GAME_STATE_GAME_OVER)) {
+        while (current_game_state == GAME_STATE_REPLAY) {
+            size_t achievements_before = replay_playback_achievements.size();
+            uint64_t allocations = run_frame(true);
+            if (current_game_state != GAME_STATE_REPLAY) {
+                replay_end_allocations = allocations;
+                break;
+            }
+            replay_frames++;
+            replay_allocations += allocations;
+            if (replay_playback_achievements.size() != achievements_before) {
+                replay_unlock_frames++;
+            }
+        }
+    }
+
+    releaseStaticScreenCache();
+    CloseWindow();
+    shutdownPersistence();
+    remove(test_path.c_str());
+    std::vector<std::string> replay_paths;
+    listReplayFiles(replay_directory, &replay_paths);
+    for (const std::string& path : replay_paths) {
+        remove(path.c_str());
+    }
+    rmdir(replay_directory.c_str());
+
+    printf("frame-allocs: screens: %llu frames, %llu allocations (%llu cache redraws)\n", (unsigned long long)screen_frames,
+           (unsigned long long)screen_allocations, (unsigned long long)screen_redraws);
+    printf("frame-allocs: play:    %llu frames, %llu allocations (%llu with unlocks)\n", (unsigned long long)play_frames,
+           (unsigned long long)play_allocations, (unsigned long long)play_unlock_frames);
+    printf("frame-allocs: replay:  %llu frames, %llu allocations (%llu with unlocks)\n", (unsigned long long)replay_frames,
+           (unsigned long long)replay_allocations, (unsigned long long)replay_unlock_frames);
+    printf("frame-allocs: not counted: the frame ending the game made %llu allocations, the one ending the replay %llu\n",
+           (unsigned long long)game_over_allocations, (unsigned long long)replay_end_allocations);
+    bool passed = screen_allocations == 0 && play_allocations == 0 && replay_allocations == 0 &&
+                  screen_redraws == sizeof(screens) / sizeof(screens[0]) && play_unlock_frames > 0 && replay_frames > 0;
+    printf("frame-allocs: %s\n", passed ? "PASS" : "FAIL");
+    return passed ? 0 : 1;
+}
+#endif
+
+// --bench-save: compares the JSON save with the binary profile store at 10k and 100k generated profiles.
+// Measures writing everything, loading at startup (time and heap growth), looking profiles up, and
+// saving after one profile changed. Uses its own files, not the real save.
+int runSaveBenchmark() {
+    const std::string json_path = "dodger_bench_save.json";
+    profile_store.path = "dodger_bench_profiles.bin";
+    profile_store.index_path = "dodger_bench_profiles.idx";
+    std::vector<std::string> achievement_ids;
+    for (const auto& pair : ALL_ACHIEVEMENTS) {
+        achievement_ids.push_back(pair.first);
+    }
+    auto elapsed_ms = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    auto heap_in_use = []() {
+        struct mallinfo2 info = mallinfo2();
+        return (long long)(info.uordblks + info.hblkhd); // Small blocks plus the large ones malloc mmaps
+    };
+    auto file_size = [](const std::string& path) {
+        struct stat file_info;
+        return stat(path.c_str(), &file_info) == 0 ? (long long)file_info.st_size : 0LL;
+    };
+    auto close_store = []() {
+        close(profile_store.fd);
+        ProfileStore closed; // Drops the index too, so the next open is measured from scratch
+        closed.path = profile_store.path;
+        closed.index_path = profile_store.index_path;
+        profile_store = std::move(closed);
+    };
+    auto profile_name = [](uint32_t n) {
+        char name[16];
+        snprintf(name, sizeof(name), "P%06u", n);
+        return std::string(name);
+    };
+
+    printf("bench-save: %-9s %-7s %10s %12s %12s %14s %14s\n",
+           "profiles", "format", "file KB", "write all ms", "startup ms", "startup heap KB", "one-change ms");
+    for (uint32_t profile_count : {10000u, 100000u}) {
+        // Generate the profiles
+        uint32_t rng_state = 12345;
+        UNLOCKED_ACHIEVEMENTS_BY_USER.clear();
+        HIGH_SCORES_BY_USER.clear();
+        for (uint32_t n = 0; n < profile_count; ++n) {
+            std::string name = profile_name(n);
+            AchievementSet& unlocked = UNLOCKED_ACHIEVEMENTS_BY_USER[name];
+            for (const std::string& achievement_id : achievement_ids) {
+                if (nextRandom(rng_state) % 4 == 0) {
+                    unlocked.insert(findAchievementId(achievement_id));
+                }
+            }
+            HIGH_SCORES_BY_USER[name]["normal"] = (nextRandom(rng_state) % 100000) / 100.0;
+        }
+        last_active_username = current_username = profile_name(0);
+        high_scores = HIGH_SCORES_BY_USER[current_username];
+
+        auto start = std::chrono::steady_clock::now();
+        writeSaveFileAtomically(json_path, serializeSaveSnapshot(takeFullSaveSnapshot()), 0);
+        double json_write_ms = elapsed_ms(start);
+        start = std::chrono::steady_clock::now();
+        createProfileStore();
+        double binary_write_ms = elapsed_ms(start);
+        close_store();
+
+        // Startup with the JSON save, then one unlock (which rewrites every profile)
+        UNLOCKED_ACHIEVEMENTS_BY_USER.clear();
+        HIGH_SCORES_BY_USER.clear();
+        malloc_trim(0); // Tidy the heap up after freeing the maps, or the next timing pays for it
+        long long heap_before = heap_in_use();
+        start = std::chrono::steady_clock::now();
+        loadSaveFileJson(json_path);
+        switchToProfile(last_active_username);
+        double json_load_ms = elapsed_ms(start);
+        long long json_heap = heap_in_use() - heap_before;
+        bool json_complete = UNLOCKED_ACHIEVEMENTS_BY_USER.size() == profile_count;
+        UNLOCKED_ACHIEVEMENTS_BY_USER[profile_name(profile_count / 2)].insert(internAchievementId("bench_unlock"));
+        start = std::chrono::steady_clock::now();
+        writeSaveFileAtomically(json_path, serializeSaveSnapshot(takeFullSaveSnapshot()), 0);
+        double json_change_ms = elapsed_ms(start);
+
+        // Startup with the binary store, 1000 profile lookups, then one unlock (which writes one record)
+        UNLOCKED_ACHIEVEMENTS_BY_USER.clear();
+        HIGH_SCORES_BY_USER.clear();
+        malloc_trim(0);
+        heap_before = heap_in_use();
+        start = std::chrono::steady_clock::now();
+        openProfileStore();
+        switchToProfile(profile_store.header.last_username);
+        double binary_load_ms = elapsed_ms(start);
+        long long binary_heap = heap_in_use() - heap_before;
+        bool binary_complete = profile_store.header.record_count == profile_count;
+        const int lookups = 1000;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < lookups; ++i) {
+            ensureProfileLoaded(profile_name(nextRandom(rng_state) % profile_count));
+        }
+        double lookup_us = elapsed_ms(start) * 1000.0 / lookups;
+        std::string changed = profile_name(profile_count / 2);
+        ensureProfileLoaded(changed);
+        UNLOCKED_ACHIEVEMENTS_BY_USER[changed].insert(findAchievementId(achievement_ids[0]));
+        profile_store.dirty.insert(changed);
+        start = std::chrono::steady_clock::now();
+        writeProfileStoreChanges(takeSaveSnapshot(), 0);
+        double binary_change_ms = elapsed_ms(start);
+        close_store();
+
+        printf("bench-save: %-9u %-7s %10lld %12.1f %12.2f %14lld %14.2f%s\n", profile_count, "json",
+               file_size(json_path) / 1024, json_write_ms, json_load_ms, json_heap / 1024, json_change_ms,
+               json_complete ? "" : "  (INCOMPLETE LOAD)");
+        printf("bench-save: %-9u %-7s %10lld %12.1f %12.2f %14lld %14.2f%s\n", profile_count, "binary",
+               (file_size(profile_store.path) + file_size(profile_store.index_path)) / 1024, binary_write_ms,
+               binary_load_ms, binary_heap / 1024, binary_change_ms, binary_complete ? "" : "  (INCOMPLETE LOAD)");
+        printf("bench-save: %-9u binary lookup of a profile not loaded yet: %.2f us\n", profile_count, lookup_us);
+        remove(json_path.c_str());
+        remove(profile_store.path.c_str());
+        remove(profile_store.index_path.c_str());
+    }
+    UNLOCKED_ACHIEVEMENTS_BY_USER.clear();
+    HIGH_SCORES_BY_USER.clear();
+    return 0;
+}
+
+// --bench-achievements: `rules` generated achievement rules over a generated stream of `events` gameplay
+// events (a survival tick every tick plus random shots, stuns, dash-throughs and near misses, in 60 second
+// games). Times the engine against checking every rule on every event, checks both unlock the same
+// achievements in the same order, and times the unlocked check against scanning a list of id strings.
+int runAchievementBenchmark(uint64_t events, int rules) {
+    const int ticks_per_game = 60 * FPS;
+    uint32_t rng_state = 2024u;
+    auto elapsed_ms = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    // The rules: mostly event counts, survival times for the tick rules, and one in ten ruled out by another event
+    std::vector<std::string> names;
+    for (int i = 0; i < rules; ++i) {
+        names.push_back("bench_rule_" + std::to_string(i));
+    }
+    std::vector<AchievementRuleDefinition> definitions;
+    for (int i = 0; i < rules; ++i) {
+        AchievementRuleDefinition definition;
+        definition.achievement = names[i].c_str();
+        definition.event = (SimEventType)(nextRandom(rng_state) % SIM_EVENT_TYPE_COUNT);
+        if (definition.event == SIM_EVENT_SURVIVAL_TICK) {
+            definition.kind = RULE_VALUE_AT_LEAST;
+            definition.threshold = 1 + nextRandom(rng_state) % 120; // Seconds; some can't happen in a 60 second game
+        } else {
+            definition.kind = RULE_COUNT_AT_LEAST;
+            definition.threshold = 1 + nextRandom(rng_state) % 50;
+        }
+        definition.cancelled_by = -1;
+        if (nextRandom(rng_state) % 10 == 0) {
+            definition.cancelled_by = (definition.event + 1 + nextRandom(rng_state) % (SIM_EVENT_TYPE_COUNT - 1)) % SIM_EVENT_TYPE_COUNT;
+        }
+        definitions.push_back(definition);
+    }
+    AchievementEngine engine;
+    buildAchievementEngine(engine, definitions.data(), definitions.size());
+
+    // The events, split into ticks
+    std::vector<SimEvent> stream;
+    std::vector<size_t> tick_ends;
+    stream.reserve(events);
+    for (uint64_t tick = 0; stream.size() < events; ++tick) {
+        stream.push_back({SIM_EVENT_SURVIVAL_TICK, (double)(tick % ticks_per_game) / FPS});
+        uint32_t roll = nextRandom(rng_state) % 1000;
+        if (roll < 300) {
+            stream.push_back({SIM_EVENT_SHOT, 0.0});
+        }
+        if (roll % 50 == 0) {
+            stream.push_back({SIM_EVENT_OBSTACLE_STUNNED, 0.0});
+        }
+        if (roll % 100 == 1) {
+            stream.push_back({SIM_EVENT_DASH_THROUGH, 0.0});
+        }
+        if (roll % 20 == 2) {
+            stream.push_back({SIM_EVENT_NEAR_MISS, 0.0});
+        }
+        tick_ends.push_back(std::min<size_t>(stream.size(), events));
+    }
+    stream.resize(events);
+    auto unlock_hash = [](uint64_t hash, AchievementId id) {
+        return (hash ^ id) * 1099511628211ull;
+    };
+
+    // The engine, the way stepSimulation drives it: publish through the listening mask, process once a tick
+    AchievementProgress progress;
+    std::vector<AchievementId> unlocked;
+    uint64_t engine_unlocks = 0;
+    uint64_t engine_hash = 14695981039346656037ull;
+    auto start = std::chrono::steady_clock::now();
+    size_t position = 0;
+    for (size_t tick = 0; tick < tick_ends.size(); ++tick) {
+        if (tick % ticks_per_game == 0) {
+            resetAchievementProgress(engine, progress);
+        }
+        for (; position < tick_ends[tick]; ++position) {
+            if (progress.listening & simEventBit(stream[position].type)) {
+                progress.events.push_back(stream[position]);
+            }
+        }
+        processAchievementEvents(engine, progress, unlocked);
+        for (AchievementId id : unlocked) {
+            engine_hash = unlock_hash(engine_hash, id);
+        }
+        engine_unlocks += unlocked.size();
+        unlocked.clear();
+    }
+    double engine_ms = elapsed_ms(start);
+
+    // Every rule on every event
+    std::vector<uint32_t> counts(engine.rules.size());
+    std::vector<uint8_t> finished(engine.rules.size());
+    uint64_t naive_unlocks = 0;
+    uint64_t naive_hash = 14695981039346656037ull;
+    start = std::chrono::steady_clock::now();
+    position = 0;
+    for (size_t tick = 0; tick < tick_ends.size(); ++tick) {
+        if (tick % ticks_per_game == 0) {
+            std::fill(counts.begin(), counts.end(), 0);
+            std::fill(finished.begin(), finished.end(), 0);
+        }
+        for (; position < tick_ends[tick]; ++position) {
+            const SimEvent& event = stream[position];
+            for (size_t rule = 0; rule < engine.rules.size(); ++rule) {
+                const AchievementRule& definition = engine.rules[rule];
+                if (finished[rule]) {
+                    continue;
+                }
+                if (definition.cancelled_by == event.type) {
+                    finished[rule] = 1;
+                } else if (definition.event == event.type) {
+                    bool fired = definition.kind == RULE_COUNT_AT_LEAST ? ++counts[rule] >= definition.threshold
+                                                                       : event.value >= definition.threshold;
+                    if (fired) {
+                        finished[rule] = 1;
+                        naive_hash = unlock_hash(naive_hash, definition.achievement);
+                        naive_unlocks++;
+                    }
+                }
+            }
+        }
+    }
+    double naive_ms = elapsed_ms(start);
+
+    // "Is it unlocked?": the bitset against the list of id strings profiles used to keep
+    const int unlocked_count = std::min(rules, 300);
+    AchievementSet set;
+    std::vector<std::string> list;
+    for (int i = 0; i < unlocked_count; ++i) {
+        set.insert(engine.rules[i].achievement);
+        list.push_back(names[i]);
+    }
+    const int queries = 100000;
+    uint64_t set_hits = 0;
+    rng_state = 7u; // Both ask about the same ids
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < queries; ++i) {
+        set_hits += set.contains(engine.rules[nextRandom(rng_state) % rules].achievement);
+    }
+    double set_ms = elapsed_ms(start);
+    uint64_t list_hits = 0;
+    rng_state = 7u;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < queries; ++i) {
+        const std::string& wanted = names[nextRandom(rng_state) % rules];
+        list_hits += std::find(list.begin(), list.end(), wanted) != list.end();
+    }
+    double list_ms = elapsed_ms(start);
+
+    auto report = [events](const char* name, double ms, uint64_t unlocks) {
+        double per_second = events / (ms / 1000.0);
+        printf("bench-achievements: %-8s %10.1f ms %14.0f events/s %8.1f ns/event %8.3f%% of a core at 100k events/s, %llu unlocks\n",
+               name, ms, per_second, ms * 1e6 / events, 100.0 * 100000.0 / per_second, (unsigned long long)unlocks);
+    };
+    printf("bench-achievements: %d rules, %llu events in %zu ticks (%zu games)\n", (int)engine.rules.size(),
+           (unsigned long long)events, tick_ends.size(), (tick_ends.size() + ticks_per_game - 1) / ticks_per_game);
+    report("engine", engine_ms, engine_unlocks);
+    report("naive", naive_ms, naive_unlocks);
+    printf("bench-achievements: unlocked check over %d ids: bitset %.1f ns, string list %.1f ns (%llu/%llu hits)\n",
+           unlocked_count, set_ms * 1e6 / queries, list_ms * 1e6 / queries,
+           (unsigned long long)set_hits, (unsigned long long)list_hits);
+    bool same = engine_unlocks == naive_unlocks && engine_hash == naive_hash;
+    printf("bench-achievements: engine and naive unlocks %s\n", same ? "match" : "DIFFER");
+    return same ? 0 : 1;
+}
+
+void updateGame(double deltaTime) {
+    PROFILE_SCOPE(PROFILE_UPDATE);
+    if (current_game_state == GAME_STATE_TAMPERED) {
+        return;
+    }
+
+    if (current_game_state == GAME_STATE_USERNAME_INPUT) {
+        const size_t length_before_edit = username_input_buffer.length();
+        for (int key = KEY_A; key <= KEY_Z; ++key) {
+            if (IsKeyPressed(key) && username_input_buffer.length() < MAX_USERNAME_LENGTH) {
+                username_input_buffer += (char)key;
+            }
+        }
+        for (int key = KEY_ZERO; key <= KEY_NINE; ++key) {
+            if (IsKeyPressed(key) && username_input_buffer.length() < MAX_USERNAME_LENGTH) {
+                username_input_buffer += (char)key;
+            }
+        }
+        if (IsKeyPressed(KEY_SPACE) && username_input_buffer.length() < MAX_USERNAME_LENGTH) {
+            username_input_buffer += ' ';
+        }
+        if (IsKeyPressed(KEY_MINUS) && username_input_buffer.length() < MAX_USERNAME_LENGTH) {
+            username_input_buffer += '-';
+        }
+
+        if (IsKeyPressed(KEY_BACKSPACE)) {
+            if (username_input_buffer.length() > 0) {
+                username_input_buffer.pop_back();
+            }
+        }
+        // Keys append and backspace removes the last character, so any edit changes the length
+        if (username_input_buffer.length() != length_before_edit) {
+            markStaticScreenDirty();
+        }
+
+        if (IsKeyPressed(KEY_ENTER)) {
+            if (username_input_buffer.empty()) {
+                switchToProfile("Guest");
+            } else {
+                switchToProfile(username_input_buffer);
+            }
+            // If "PORTAL" username is entered, go to achievement profile selection
+            if (current_username == "PORTAL") {
+                is_portal_mode = true; // Enable portal mode immediately for gameplay
+                TraceLog(LOG_INFO, "Portal mode enabled!");
+                
+                // Populate available_profile_names for selection
+                available_profile_names = listProfileNames();
+                // Add current_username if it's not already in the list (e.g., brand new profile)
+                if (std::find(available_profile_names.begin(), available_profile_names.end(), current_username) == available_profile_names.end()) {
+                    available_profile_names.push_back(current_username);
                 }
-                // --- End Projectile Boundary Handling ---
+                // Sort for consistent display
+                std::sort(available_profile_names.begin(), available_profile_names.end());
                 
-                // --- Check for projectile collision with obstacle (Stun Mechanic) ---
-                if (CheckCollisionRecs(p.rect, {obstacle_x, obstacle_y, obstacle_size, obstacle_size})) {
-                    p.active = false;
-                    dodge_streak_start_time = GetTime(); // Reset streak on hit
-                    if (p.is_player_shot && GetTime() > player_last_stun_shot_time + PLAYER_STUN_SHOT_COOLDOWN) {
-                        obstacle_is_stunned = true;
-                        obstacle_stun_end_time = GetTime() + OBSTACLE_STUN_DURATION;
-                        player_last_stun_shot_time = GetTime();
-                        obstacle_stuns_this_game++; // Increment stun count for achievement
-                        if (obstacle_stuns_this_game >= 3) {
-                            unlockAchievement("stunned_silence", current_username);
-                        }
-                        TraceLog(LOG_INFO, "Obstacle stunned for %.1f seconds!", OBSTACLE_STUN_DURATION);
-                    }
-                }
-
-                // --- Check for obstacle projectile collision with player (Stun Player) ---
-                // Only stun player if not dashing
-                if (!player_is_dashing && !p.is_player_shot && CheckCollisionRecs(p.rect, {player_x, player_y, player_size, player_size})) {
-                    p.active = false;
-                    dodge_streak_start_time = GetTime(); // Reset streak on hit
-                    if (GetTime() > obstacle_last_stun_time + OBSTACLE_STUN_COOLDOWN) {
-                        player_is_stunned = true;
-                        player_stun_end_time = GetTime() + PLAYER_STUN_DURATION;
-                        obstacle_last_stun_time = GetTime();
-                        TraceLog(LOG_INFO, "Player stunned for %.1f seconds by obstacle projectile!", PLAYER_STUN_DURATION);
-                    }
-                }
-
-                // --- "Dash of Genius" achievement check ---
-                // If player is dashing and this is an obstacle projectile, check for collision
-                if (player_is_dashing && !p.is_player_shot && CheckCollisionRecs(p.rect, {player_x, player_y, player_size, player_size})) {
-                    p.active = false; // Projectile is "dodged" by dash
-                    if (!dash_through_projectile_achievement_unlocked_this_game) {
-                        unlockAchievement("dash_of_genius", current_username);
-                        dash_through_projectile_achievement_unlocked_this_game = true; // Only unlock once per game
+                // Set selected_profile_index to the current_username if possible
+                selected_profile_index = 0;
+                for(size_t i = 0; i < available_profile_names.size(); ++i) {
+                    if (available_profile_names[i] == last_active_username) {
+                        selected_profile_index = i;
+                        break;
                     }
                 }
 
-                // --- "Near Miss" achievement check ---
-                // Check if it's an obstacle projectile and not a direct hit, and player is not dashing
-                if (!near_miss_achievement_unlocked_this_game && !p.is_player_shot && !player_is_dashing) {
-                    float player_center_x = player_x + player_size / 2.0f;
-                    float player_center_y = player_y + player_size / 2.0f;
-                    float projectile_center_x = p.rect.x + p.rect.width / 2.0f;
-                    float projectile_center_y = p.rect.y + p.rect.height / 2.0f;
-
-                    float dx = player_center_x - projectile_center_x;
-                    float dy = player_center_y - projectile_center_y;
-                    float distance = sqrtf(dx*dx + dy*dy);
-
-                    // Define a "near miss" threshold (e.g., within 1.5 times the combined radius, but not a direct hit)
-                    float combined_radius = (player_size / 2.0f) + (PROJECTILE_SIZE / 2.0f);
-                    float near_miss_threshold_distance = combined_radius + 15.0f; // 15 pixels beyond direct collision
-
-                    // If it's very close but not colliding AND it's an obstacle projectile
-                    if (distance > combined_radius && distance < near_miss_threshold_distance) {
-                        unlockAchievement("near_miss", current_username);
-                        near_miss_achievement_unlocked_this_game = true; // Unlock once per game
-                    }
-                }
+                current_game_state = GAME_STATE_SELECT_ACHIEVEMENT_PROFILE;
+            } else {
+                is_portal_mode = false; // Disable portal mode for other usernames
+                last_active_username = current_username; // Update last active username
+                saveGameData(); // Save the new current_username as last active
+                username_input_buffer = "";
+                current_game_state = GAME_STATE_MAIN_MENU; // Go to main menu
             }
         }
-        projectiles.erase(std::remove_if(projectiles.begin(), projectiles.end(), [](const Projectile& p){ return !p.active; }), projectiles.end());
-
-        ai_reaction_timer++;
-        if (ai_reaction_timer >= ai_reaction_delay) {
-            float raw_predicted_player_x = player_x + (player_vx * prediction_frames);
-            float raw_predicted_player_y = player_y + (player_vy * prediction_frames);
-
-            float dx_direct = raw_predicted_player_x - obstacle_x;
-            float dx_wrap_left = (raw_predicted_player_x + SCREEN_WIDTH) - obstacle_x;
-            float dx_wrap_right = raw_predicted_player_x - (obstacle_x + SCREEN_WIDTH);
-
-            float shortest_dx = dx_direct;
-            if (std::abs(dx_wrap_left) < std::abs(shortest_dx)) {
-                shortest_dx = dx_wrap_left;
-            }
-            if (std::abs(dx_wrap_right) < std::abs(shortest_dx)) {
-                shortest_dx = dx_wrap_right;
-            }
-            ai_target_x = obstacle_x + shortest_dx;
-
-            float dy_direct = raw_predicted_player_y - obstacle_y;
-            float dy_wrap_up = (raw_predicted_player_y + SCREEN_HEIGHT) - obstacle_y;
-            float dy_wrap_down = raw_predicted_player_y - (obstacle_y + SCREEN_HEIGHT);
-
-            float shortest_dy = dy_direct;
-            if (std::abs(dy_wrap_up) < std::abs(shortest_dy)) {
-                shortest_dy = dy_wrap_up;
-            }
-            if (std::abs(dy_wrap_down) < std::abs(shortest_dy)) {
-                shortest_dy = dy_wrap_down;
-            }
-            ai_target_y = obstacle_y + shortest_dy;
 
-            ai_reaction_timer = 0;
+        // Only ESC to close window from username input screen
+        if (IsKeyPressed(KEY_ESCAPE)) {
+            CloseWindow(); // This will make WindowShouldClose() return true and exit the main loop
         }
 
-        if (!obstacle_is_stunned) {
-            if (obstacle_x < ai_target_x) {
-                obstacle_x += obstacle_speed;
-            } else if (obstacle_x > ai_target_x) {
-                obstacle_x -= obstacle_speed;
-            }
-            if (obstacle_y < ai_target_y) {
-                obstacle_y += obstacle_speed;
-            } else if (obstacle_y > ai_target_y) {
-                obstacle_y -= obstacle_speed;
-            }
-        } else {
-            if (GetTime() > obstacle_stun_end_time) {
-                obstacle_is_stunned = false;
-                TraceLog(LOG_INFO, "Obstacle stun ended.");
-            }
+    } else if (current_game_state == GAME_STATE_MAIN_MENU) {
+        if (IsKeyPressed(KEY_ENTER)) {
+            resetGame(); // Reset game state before starting
+            current_game_state = GAME_STATE_COUNTDOWN; // Start playing
         }
-
-        if (obstacle_x < -obstacle_size) obstacle_x = (float)SCREEN_WIDTH;
-        else if (obstacle_x > SCREEN_WIDTH) obstacle_x = -obstacle_size;
-        
-        if (obstacle_y < -obstacle_size) obstacle_y = (float)SCREEN_HEIGHT;
-        else if (obstacle_y > SCREEN_HEIGHT) obstacle_y = -obstacle_size;
-
-        // --- Dodge Streak Time Bonus Logic ---
-        // Only award bonus if player is not stunned and hasn't just been hit
-        if (!player_is_stunned) {
-            if (GetTime() - dodge_streak_start_time >= DODGE_BONUS_INTERVAL) {
-                elapsed_time_s += DODGE_BONUS_AMOUNT;
-                dodge_streak_start_time = GetTime(); // Reset streak timer for next bonus
-                showing_time_bonus_message = true;
-                time_bonus_message_end_time = GetTime() + TIME_BONUS_MESSAGE_DURATION;
-                TraceLog(LOG_INFO, "Time Bonus! +%.1f seconds. New elapsed time: %.2f", DODGE_BONUS_AMOUNT, elapsed_time_s);
-            }
+        if (IsKeyPressed(KEY_A)) {
+            current_game_state = GAME_STATE_ACHIEVEMENTS;
         }
-
-        // Hide time bonus message after its duration
-        if (showing_time_bonus_message && GetTime() > time_bonus_message_end_time) {
-            showing_time_bonus_message = false;
+        if (IsKeyPressed(KEY_P) || IsKeyPressed(KEY_ESCAPE)) { // P OR ESC to change profile
+            current_game_state = GAME_STATE_USERNAME_INPUT; // Go back to username input
+            username_input_buffer = current_username; // Pre-fill input with current username
         }
 
-        // Handle achievement popup visibility
-        if (!current_achievement_popup_id.empty() && GetTime() > achievement_popup_display_end_time) {
-            current_achievement_popup_id = ""; // Clear the popup
+    } else if (current_game_state == GAME_STATE_SELECT_ACHIEVEMENT_PROFILE) {
+        if (IsKeyPressed(KEY_UP)) {
+            selected_profile_index = (selected_profile_index - 1 + available_profile_names.size()) % available_profile_names.size();
+            markStaticScreenDirty();
         }
-
-        // Player vs Obstacle Collision (only if player is NOT dashing)
-        if (!player_is_dashing && player_x < obstacle_x + obstacle_size &&
-            player_x + player_size > obstacle_x &&
-            player_y < obstacle_y + obstacle_size &&
-            player_y + player_size > obstacle_y) {
+        if (IsKeyPressed(KEY_DOWN)) {
+            selected_profile_index = (selected_profile_index + 1) % available_profile_names.size();
+            markStaticScreenDirty();
+        }
+        if (IsKeyPressed(KEY_ENTER)) {
+            std::string chosen_profile = available_profile_names[selected_profile_index];
+            unlockAchievement("portal_username", chosen_profile); // Unlock for chosen profile
             
-            current_game_state = GAME_STATE_GAME_OVER;
-            final_survival_time_s = elapsed_time_s;
+            // After selection, go back to main menu to allow playing with "PORTAL"
+            switchToProfile("PORTAL"); // Keep username as PORTAL for gameplay
+            last_active_username = current_username; // Update last active username
+            saveGameData(); // Save the new last active username and achievement
+            username_input_buffer = ""; // Clear buffer for next input
+            current_game_state = GAME_STATE_MAIN_MENU; // Go to main menu after selection
+        }
+        if (IsKeyPressed(KEY_ESCAPE)) {
+            current_game_state = GAME_STATE_USERNAME_INPUT; // Go back to username input
+            username_input_buffer = current_username; // Pre-fill input with current username
+        }
 
-            // --- CRITICAL FIX: Clear projectiles and reset dash state immediately on game over ---
-            projectiles.clear();
-            player_is_dashing = false;
-            player_dash_velocity_x = 0.0f;
-            player_dash_velocity_y = 0.0f;
-            // --- END CRITICAL FIX ---
+    } else if (current_game_state == GAME_STATE_COUNTDOWN || current_game_state == GAME_STATE_PLAYING) {
+        // Collect input every frame; held keys are replaced, presses are kept until a tick consumes them
+        PROFILE_BEGIN(PROFILE_INPUT);
+        InputSnapshot frame_input = sampleInput();
+        bool shoot_pressed = latched_input.shoot_pressed || frame_input.shoot_pressed;
+        bool dash_pressed = latched_input.dash_pressed || frame_input.dash_pressed;
+        latched_input = frame_input;
+        latched_input.shoot_pressed = shoot_pressed;
+        latched_input.dash_pressed = dash_pressed;
+        PROFILE_END(PROFILE_INPUT);
+
+        // Run as many fixed ticks as the real time since the last frame covers
+        sim_accumulator += std::min(deltaTime, MAX_FRAME_SECONDS);
+        while (sim_accumulator >= SIM_TICK_SECONDS) {
+            sim_accumulator -= SIM_TICK_SECONDS;
+
+            if (current_game_state == GAME_STATE_COUNTDOWN) {
+                current_countdown_frame--;
+                if (current_countdown_frame <= 0) {
+                    current_game_state = GAME_STATE_PLAYING;
+                    latched_input = InputSnapshot(); // Don't carry presses from the countdown into the game
+
+                    if (normal_music.frameCount > 0 && !IsMusicStreamPlaying(normal_music)) {
+                        PlayMusicStream(normal_music);
+                    }
+                    if (win_music.frameCount > 0 && IsMusicStreamPlaying(win_music)) {
+                        StopMusicStream(win_music);
+                    }
+                }
+                continue;
+            }
 
-            const double currentWinThreshold = WIN_THRESHOLD_TIMES[current_difficulty_mode];
-            bool didWin = final_survival_time_s >= currentWinThreshold;
+            replayRecordTick(game_replay, latched_input);
+            stepSimulation(sim, latched_input);
+            latched_input.shoot_pressed = false;
+            latched_input.dash_pressed = false;
 
-            if (final_survival_time_s > high_scores[current_difficulty_mode]) {
-                high_scores[current_difficulty_mode] = final_survival_time_s;
-                is_new_high_score = true;
-            } else {
-                is_new_high_score = false;
+            PROFILE_BEGIN(PROFILE_ACHIEVEMENTS);
+            for (AchievementId achievement_id : sim.pending_achievements) {
+                game_replay.achievements.push_back(achievement_id);
+                unlockAchievement(achievement_id, current_username);
             }
-            TraceLog(LOG_INFO, "Game Over! Final Time: %.2f s, New High Score: %s", final_survival_time_s, is_new_high_score ? "YES" : "NO");
-            TraceLog(LOG_INFO, "Current Difficulty High Score: %.2f s", high_scores[current_difficulty_mode]);
+            sim.pending_achievements.clear();
+            PROFILE_END(PROFILE_ACHIEVEMENTS);
 
-            if (didWin && is_new_high_score) {
-                if (normal_music.frameCount > 0 && IsMusicStreamPlaying(normal_music)) {
-                    StopMusicStream(normal_music);
-                }
-                if (win_music.frameCount > 0 && !IsMusicStreamPlaying(win_music)) {
-                    PlayMusicStream(win_music);
-                }
-            } else {
-                if (win_music.frameCount > 0 && IsMusicStreamPlaying(win_music)) {
-                    StopMusicStream(win_music);
-                }
+            if (sim.game_over) {
+                handleSimulationGameOver();
+                sim_accumulator = 0.0;
+                break;
             }
         }
+        sim_render_alpha = (float)(sim_accumulator / SIM_TICK_SECONDS);
+
+        // Handle achievement popup visibility
+        if (current_achievement_popup != ACHIEVEMENT_NONE && GetTime() > achievement_popup_display_end_time) {
+            current_achievement_popup = ACHIEVEMENT_NONE; // Clear the popup
+        }
 
     } else if (current_game_state == GAME_STATE_GAME_OVER) {
         if (IsKeyPressed(KEY_R)) {
             TraceLog(LOG_INFO, "R key pressed. Attempting to restart/advance difficulty.");
             const double currentWinThreshold = WIN_THRESHOLD_TIMES[current_difficulty_mode];
-            const bool didWin = final_survival_time_s >= currentWinThreshold;
+            const bool didWin = sim.final_survival_time_s >= currentWinThreshold;
 
             if (didWin) {
                 nextGameMessage = "YOU HAVE BEATEN THE GAME ON NORMAL MODE!";
             } else {
                 nextGameMessage = "TRY AGAIN!";
             }
-            applyDifficulty("normal");
-            resetGame();
+            resetGame(); // Also re-applies the difficulty
             current_game_state = GAME_STATE_COUNTDOWN; // Go straight to countdown after game over restart
         }
+        if (IsKeyPressed(KEY_V) && !last_replay_bytes.empty()) { // V to watch the game that just ended
+            startReplayPlayback(last_replay_bytes, GAME_STATE_GAME_OVER);
+        }
         if (IsKeyPressed(KEY_P)) { // P to change profile from Game Over screen
             current_game_state = GAME_STATE_USERNAME_INPUT;
             username_input_buffer = current_username;
@@ -1385,32 +5679,152 @@ void updateGame(double deltaTime) {
             }
         }
 
-        if (current_difficulty_mode == "babymode" && final_survival_time_s < 10.0 && high_scores["babymode"] > 20.0) {
+        if (current_difficulty_mode == "babymode" && sim.final_survival_time_s < 10.0 && high_scores["babymode"] > 20.0) {
             // Rickroll placeholder
         }
     } else if (current_game_state == GAME_STATE_ACHIEVEMENTS) {
         if (IsKeyPressed(KEY_ESCAPE)) {
             current_game_state = GAME_STATE_MAIN_MENU; // Go back to main menu
         }
+    } else if (current_game_state == GAME_STATE_REPLAY) {
+        if (IsKeyPressed(KEY_ONE)) replay_playback_speed = 1;
+        if (IsKeyPressed(KEY_TWO)) replay_playback_speed = 2;
+        if (IsKeyPressed(KEY_THREE)) replay_playback_speed = 8;
+        if (IsKeyPressed(KEY_FOUR)) replay_playback_speed = 0; // Uncapped
+        if (IsKeyPressed(KEY_ESCAPE)) {
+            stopReplayPlayback();
+            return;
+        }
+
+        bool finished = false;
+        if (replay_playback_speed == 0) {
+            // As many ticks as fit in most of a frame, checking the clock every 64 ticks
+            auto start = std::chrono::steady_clock::now();
+            do {
+                for (int i = 0; i < 64 && !finished; ++i) {
+                    finished = !stepReplayPlayback();
+                }
+            } while (!finished && std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < REPLAY_UNCAPPED_FRAME_SECONDS);
+            sim_render_alpha = 1.0f;
+        } else {
+            sim_accumulator += std::min(deltaTime, MAX_FRAME_SECONDS) * replay_playback_speed;
+            while (sim_accumulator >= SIM_TICK_SECONDS && !finished) {
+                sim_accumulator -= SIM_TICK_SECONDS;
+                finished = !stepReplayPlayback();
+            }
+            sim_render_alpha = (float)(sim_accumulator / SIM_TICK_SECONDS);
+        }
+        if (finished) {
+            stopReplayPlayback();
+        }
     } else if (current_game_state == GAME_STATE_SELECT_ACHIEVEMENT_PROFILE) {
         drawSelectAchievementProfileScreen();
     }
 }
 
-void drawCenteredText(const std::string& text, int fontSize, Color color, int yOffset) {
-    int textWidth = MeasureText(text.c_str(), fontSize);
-    DrawText(text.c_str(), (SCREEN_WIDTH - textWidth) / 2, (SCREEN_HEIGHT - fontSize) / 2 + yOffset, fontSize, color);
+// Blends a coordinate between the previous and current tick. Jumps too large to be real motion
+// (screen wrap-around, teleports) snap straight to the new position instead of sliding across the screen.
+static inline float interpolatePosition(float previous, float current, float alpha) {
+    if (std::abs(current - previous) > INTERPOLATION_SNAP_DISTANCE) {
+        return current;
+    }
+    return previous + (current - previous) * alpha;
+}
+
+void drawCenteredText(const char* text, int fontSize, Color color, int yOffset) {
+    int textWidth = MeasureText(text, fontSize);
+    DrawText(text, (SCREEN_WIDTH - textWidth) / 2, (SCREEN_HEIGHT - fontSize) / 2 + yOffset, fontSize, color);
 }
 
-void drawInfoText(const std::string& text, int fontSize, Color color, int x, int y, TextAlignment align) {
-    int textWidth = MeasureText(text.c_str(), fontSize);
+void drawInfoText(const char* text, int fontSize, Color color, int x, int y, TextAlignment align) {
+    int textWidth = MeasureText(text, fontSize);
     int drawX = x;
     if (align == ALIGN_CENTER) {
         drawX = x - textWidth / 2;
     } else if (align == ALIGN_RIGHT) {
         drawX = x - textWidth;
     }
-    DrawText(text.c_str(), drawX, y, fontSize, color);
+    DrawText(text, drawX, y, fontSize, color);
+}
+
+// --- Retained HUD text ---
+// The value std::to_string(value).substr(0, find('.') + 1 + digits) used to show, as an integer count of
+// 1/scale units (value >= 0). HUD fields use it both to format and to tell whether the text changed.
+static inline int64_t displayedFixedPoint(double value, int64_t scale) {
+    return (int64_t)(value * scale + 5e-7 * scale); // to_string rounds to 6 decimals before the cut
+}
+
+// Re-formats and re-measures a HUD field only if `key` (whatever identifies the value shown, e.g. tenths
+// of a second) or the font size changed since last frame. Formats into the field's own buffer, so it
+// never allocates.
+static void updateHudText(HudText& field, int fontSize, int64_t key, const char* format, ...) {
+    if (field.key == key && field.font_size == fontSize) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vsnprintf(field.text, sizeof(field.text), format, args);
+    va_end(args);
+    field.key = key;
+    field.font_size = fontSize;
+    field.width = MeasureText(field.text, fontSize);
+}
+
+static void drawHudText(const HudText& field, Color color, int x, int y, TextAlignment align) {
+    int drawX = x;
+    if (align == ALIGN_CENTER) {
+        drawX = x - field.width / 2;
+    } else if (align == ALIGN_RIGHT) {
+        drawX = x - field.width;
+    }
+    DrawText(field.text, drawX, y, field.font_size, color);
+}
+
+// Formats a cooldown line ("Dash CD: 1.4s") into `field` if it's running, draws it and moves `y` up a line
+static void drawCooldownLine(HudText& field, const char* label, double remaining, Color color, int& y) {
+    int64_t tenths = displayedFixedPoint(remaining, 10);
+    updateHudText(field, 20, tenths, "%s: %lld.%llds", label, (long long)(tenths / 10), (long long)(tenths % 10));
+    drawHudText(field, color, SCREEN_WIDTH / 2, y, ALIGN_CENTER);
+    y -= 25; // Spacing between cooldown lines
+}
+
+// --- Cached static screens ---
+void markStaticScreenDirty() {
+    static_screen.dirty = true;
+    display_generation++;
+}
+
+// Shows a static screen from the cache, first redrawing it into the render texture if it's out of date
+static void drawStaticScreen(void (*drawScreen)()) {
+    if (!static_screen.loaded || static_screen.width != SCREEN_WIDTH || static_screen.height != SCREEN_HEIGHT) {
+        if (static_screen.loaded) {
+            UnloadRenderTexture(static_screen.texture);
+        }
+        static_screen.texture = LoadRenderTexture(SCREEN_WIDTH, SCREEN_HEIGHT);
+        static_screen.loaded = true;
+        static_screen.width = SCREEN_WIDTH;
+        static_screen.height = SCREEN_HEIGHT;
+        static_screen.dirty = true;
+    }
+    if (static_screen.dirty || static_screen.state != current_game_state) {
+        BeginTextureMode(static_screen.texture);
+        ClearBackground(BLACK);
+        drawScreen();
+        EndTextureMode();
+        static_screen.dirty = false;
+        static_screen.state = current_game_state;
+        static_screen.redraws++;
+    }
+    // Render textures are stored upside down, hence the negative height
+    DrawTextureRec(static_screen.texture.texture, Rectangle{0.0f, 0.0f, (float)static_screen.width, -(float)static_screen.height},
+                   Vector2{0.0f, 0.0f}, WHITE);
+}
+
+void releaseStaticScreenCache() {
+    if (static_screen.loaded) {
+        UnloadRenderTexture(static_screen.texture);
+        static_screen.loaded = false;
+    }
 }
 
 void drawAchievementsScreen() {
@@ -1420,37 +5834,28 @@ void drawAchievementsScreen() {
     drawCenteredText("ACHIEVEMENTS", 60, GOLD, current_y_offset - (SCREEN_HEIGHT/2 - 60/2));
     current_y_offset += 100;
 
-    // Check if the current user has any unlocked achievements
-    const auto& user_unlocked_achievements = UNLOCKED_ACHIEVEMENTS_BY_USER[current_username];
+    // The current user's unlocked achievements, looked up once
+    const AchievementSet& user_unlocked_achievements = UNLOCKED_ACHIEVEMENTS_BY_USER[current_username];
 
+    char line[256];
     for (const auto& pair : ALL_ACHIEVEMENTS) {
         const Achievement& achievement = pair.second;
-        bool is_unlocked = false;
-        // Check if this specific achievement ID is in the current user's unlocked list
-        for (const auto& unlocked_id : user_unlocked_achievements) {
-            if (unlocked_id == achievement.id) {
-                is_unlocked = true;
-                break;
-            }
-        }
+        bool is_unlocked = user_unlocked_achievements.contains(achievement.index);
 
         Color display_color = is_unlocked ? UNLOCKED_ACHIEVEMENT_COLOR : LOCKED_ACHIEVEMENT_COLOR;
-        std::string display_name;
-        std::string display_description;
+        const char* display_name = achievement.name.c_str();
+        const char* display_description = achievement.description.c_str();
 
         if (achievement.is_secret && !is_unlocked) {
             display_name = "??? Secret Achievement ???";
             display_description = "Unlock this to reveal its purpose!";
-        } else {
-            display_name = achievement.name;
-            display_description = achievement.description;
         }
-        
-        std::string status_prefix = is_unlocked ? "[UNLOCKED] " : "[LOCKED]   ";
 
-        DrawText((status_prefix + display_name).c_str(), 50, current_y_offset, 30, display_color);
+        snprintf(line, sizeof(line), "%s%s", is_unlocked ? "[UNLOCKED] " : "[LOCKED]   ", display_name);
+        DrawText(line, 50, current_y_offset, 30, display_color);
         current_y_offset += 35;
-        DrawText(("  - " + display_description).c_str(), 70, current_y_offset, 20, display_color);
+        snprintf(line, sizeof(line), "  - %s", display_description);
+        DrawText(line, 70, current_y_offset, 20, display_color);
         current_y_offset += 50; // More space between achievements
     }
 
@@ -1470,7 +5875,7 @@ void drawSelectAchievementProfileScreen() {
         for (size_t i = 0; i < available_profile_names.size(); ++i) {
             Color color = (i == selected_profile_index) ? SELECTED_ITEM_COLOR : LIGHTGRAY_CUSTOM;
             int fontSize = (i == selected_profile_index) ? 35 : 30;
-            drawCenteredText(available_profile_names[i], fontSize, color, current_y_offset - (SCREEN_HEIGHT/2 - fontSize/2));
+            drawCenteredText(available_profile_names[i].c_str(), fontSize, color, current_y_offset - (SCREEN_HEIGHT/2 - fontSize/2));
             current_y_offset += 45;
         }
     }
@@ -1479,281 +5884,565 @@ void drawSelectAchievementProfileScreen() {
     drawCenteredText("Press ESC to go back to username input.", 20, WHITE, SCREEN_HEIGHT - 50 - (SCREEN_HEIGHT/2 - 20/2));
 }
 
+void drawTamperedScreen() {
+    drawCenteredText("ARE YOU HAPPY THAT YOU'RE A CHEATER?", 40, RED, -50);
+    drawCenteredText("Game will close shortly.", 20, WHITE, 20);
+}
 
-void drawGame() {
-    if (current_game_state == GAME_STATE_TAMPERED) {
-        drawCenteredText("ARE YOU HAPPY THAT YOU'RE A CHEATER?", 40, RED, -50);
-        drawCenteredText("Game will close shortly.", 20, WHITE, 20);
-    } else if (current_game_state == GAME_STATE_USERNAME_INPUT) {
-        // Define font sizes and padding for clarity
-        int title_font_size = 60;
-        int input_text_font_size = 28;
-        int confirm_font_size = 30;
-        int disclaimer_font_size = 22;
-        // Removed instructions_font_size as "Press A" is no longer here
-
-        int input_box_width = 500;
-        int input_box_height = 60;
-        int vertical_padding = 40; // Padding between main elements
-
-        // Calculate initial Y for the title, aiming to center the whole block
-        // Adjusted total_height_of_main_elements as "Press A" instruction is removed
-        int total_height_of_main_elements = title_font_size + vertical_padding + input_box_height + vertical_padding + confirm_font_size;
-        int current_y = (SCREEN_HEIGHT / 2) - (total_height_of_main_elements / 2);
-
-        // "ENTER USERNAME" title
-        DrawText("ENTER USERNAME", (int)(SCREEN_WIDTH / 2 - MeasureText("ENTER USERNAME", title_font_size) / 2), current_y, title_font_size, GOLD);
-        current_y += title_font_size + vertical_padding; // Move Y down for next element
-
-        // Input box
-        int input_box_x = (SCREEN_WIDTH - input_box_width) / 2;
-        DrawRectangle(input_box_x, current_y, input_box_width, input_box_height, LIGHTGRAY);
-        DrawRectangleLines(input_box_x, current_y, input_box_width, input_box_height, WHITE);
-        // Center text vertically within the input box
-        DrawText(username_input_buffer.c_str(), input_box_x + 15, current_y + (input_box_height - input_text_font_size) / 2, input_text_font_size, BLACK);
-        current_y += input_box_height + vertical_padding; // Move Y down for next element
-
-        // "Press ENTER to confirm" message
-        DrawText("Press ENTER to confirm", (int)(SCREEN_WIDTH / 2 - MeasureText("Press ENTER to confirm", confirm_font_size) / 2), current_y, confirm_font_size, WHITE);
-        // current_y += confirm_font_size + vertical_padding; // No need to move Y down for next element here
-
-        // Disclaimer text (fixed at bottom, with some padding from the bottom edge)
-        const Color disclaimer_color = YELLOW; // Redeclared here
-        const std::string disclaimer_text_line1 = "WARNING: This game may contain rapidly flashing elements."; // Redeclared here
-        const std::string disclaimer_text_line2 = "Players with photosensitive epilepsy should exercise caution."; // Redeclared here
-
-        int disclaimer_bottom_margin = 50;
-        int disclaimer_line_spacing = 30;
-        int disclaimer_y2 = SCREEN_HEIGHT - disclaimer_bottom_margin;
-        int disclaimer_y1 = disclaimer_y2 - disclaimer_line_spacing;
-
-        drawCenteredText(disclaimer_text_line1, disclaimer_font_size, disclaimer_color, disclaimer_y1 - (SCREEN_HEIGHT/2 - disclaimer_font_size/2));
-        drawCenteredText(disclaimer_text_line2, disclaimer_font_size, disclaimer_color, disclaimer_y2 - (SCREEN_HEIGHT/2 - disclaimer_font_size/2));
-
+void drawUsernameInputScreen() {
+    // Define font sizes and padding for clarity
+    int title_font_size = 60;
+    int input_text_font_size = 28;
+    int confirm_font_size = 30;
+    int disclaimer_font_size = 22;
+
+    int input_box_width = 500;
+    int input_box_height = 60;
+    int vertical_padding = 40; // Padding between main elements
+
+    // Calculate initial Y for the title, aiming to center the whole block
+    int total_height_of_main_elements = title_font_size + vertical_padding + input_box_height + vertical_padding + confirm_font_size;
+    int current_y = (SCREEN_HEIGHT / 2) - (total_height_of_main_elements / 2);
+
+    // "ENTER USERNAME" title
+    DrawText("ENTER USERNAME", (int)(SCREEN_WIDTH / 2 - MeasureText("ENTER USERNAME", title_font_size) / 2), current_y, title_font_size, GOLD);
+    current_y += title_font_size + vertical_padding; // Move Y down for next element
+
+    // Input box
+    int input_box_x = (SCREEN_WIDTH - input_box_width) / 2;
+    DrawRectangle(input_box_x, current_y, input_box_width, input_box_height, LIGHTGRAY);
+    DrawRectangleLines(input_box_x, current_y, input_box_width, input_box_height, WHITE);
+    // Center text vertically within the input box
+    DrawText(username_input_buffer.c_str(), input_box_x + 15, current_y + (input_box_height - input_text_font_size) / 2, input_text_font_size, BLACK);
+    current_y += input_box_height + vertical_padding; // Move Y down for next element
+
+    // "Press ENTER to confirm" message
+    DrawText("Press ENTER to confirm", (int)(SCREEN_WIDTH / 2 - MeasureText("Press ENTER to confirm", confirm_font_size) / 2), current_y, confirm_font_size, WHITE);
+
+    // Disclaimer text (fixed at bottom, with some padding from the bottom edge)
+    const Color disclaimer_color = YELLOW;
+    const char* disclaimer_text_line1 = "WARNING: This game may contain rapidly flashing elements.";
+    const char* disclaimer_text_line2 = "Players with photosensitive epilepsy should exercise caution.";
+
+    int disclaimer_bottom_margin = 50;
+    int disclaimer_line_spacing = 30;
+    int disclaimer_y2 = SCREEN_HEIGHT - disclaimer_bottom_margin;
+    int disclaimer_y1 = disclaimer_y2 - disclaimer_line_spacing;
+
+    drawCenteredText(disclaimer_text_line1, disclaimer_font_size, disclaimer_color, disclaimer_y1 - (SCREEN_HEIGHT/2 - disclaimer_font_size/2));
+    drawCenteredText(disclaimer_text_line2, disclaimer_font_size, disclaimer_color, disclaimer_y2 - (SCREEN_HEIGHT/2 - disclaimer_font_size/2));
+}
 
-    } else if (current_game_state == GAME_STATE_MAIN_MENU) {
-        int current_y = (SCREEN_HEIGHT / 2) - 100; // Adjusted start Y
+void drawMainMenuScreen() {
+    int current_y = (SCREEN_HEIGHT / 2) - 100; // Adjusted start Y
 
-        drawCenteredText("WELCOME, " + current_username + "!", 50, GOLD, current_y - (SCREEN_HEIGHT/2 - 50/2));
-        current_y += 100;
+    char welcome[96];
+    snprintf(welcome, sizeof(welcome), "WELCOME, %s!", current_username.c_str());
+    drawCenteredText(welcome, 50, GOLD, current_y - (SCREEN_HEIGHT/2 - 50/2));
+    current_y += 100;
 
-        Color play_color = WHITE;
-        Color achievements_color = LIGHTGRAY_CUSTOM;
-        // Removed profile_color as the text is no longer drawn here
+    Color play_color = WHITE;
+    Color achievements_color = LIGHTGRAY_CUSTOM;
 
-        // No visual feedback for key press, just the text itself
-        drawCenteredText("PLAY GAME (Press ENTER)", 40, play_color, current_y - (SCREEN_HEIGHT/2 - 40/2));
-        current_y += 60;
-        drawCenteredText("VIEW ACHIEVEMENTS (Press A)", 30, achievements_color, current_y - (SCREEN_HEIGHT/2 - 30/2));
-        // Removed the "Press P to Change Profile" text line from here
-        current_y += 80; // Maintain spacing for consistency
+    // No visual feedback for key press, just the text itself
+    drawCenteredText("PLAY GAME (Press ENTER)", 40, play_color, current_y - (SCREEN_HEIGHT/2 - 40/2));
+    current_y += 60;
+    drawCenteredText("VIEW ACHIEVEMENTS (Press A)", 30, achievements_color, current_y - (SCREEN_HEIGHT/2 - 30/2));
+    current_y += 80; // Maintain spacing for consistency
 
-        drawCenteredText("Press ESC to go back to username input", 20, WHITE, SCREEN_HEIGHT - 50 - (SCREEN_HEIGHT/2 - 20/2));
+    drawCenteredText("Press ESC to go back to username input", 20, WHITE, SCREEN_HEIGHT - 50 - (SCREEN_HEIGHT/2 - 20/2));
+}
 
+void drawGameOverScreen() {
+    const float center_x = (float)SCREEN_WIDTH / 2.0f;
+
+    // Redeclare variables for this scope
+    double currentProfileHighScore = high_scores[current_difficulty_mode];
+    const double currentWinThreshold = WIN_THRESHOLD_TIMES[current_difficulty_mode];
+    const bool didWin = sim.final_survival_time_s >= currentWinThreshold;
+
+    // Start Y for the first element, adjusted to center the entire block of text
+    int current_y_pos = (SCREEN_HEIGHT / 2) - 250; // Adjusted starting Y to move content up
+
+    // "GAME OVER!" title
+    int game_over_font_size = 130;
+    DrawText("GAME OVER!", (int)(center_x - MeasureText("GAME OVER!", game_over_font_size) / 2), current_y_pos, game_over_font_size, RED);
+    current_y_pos += game_over_font_size + 30; // Move Y down, add padding
+
+    // Profile Info
+    int profile_font_size = 40;
+    std::string profile_text = "Profile: " + current_username + " (" + current_difficulty_mode + ")";
+    DrawText(profile_text.c_str(), (int)(center_x - MeasureText(profile_text.c_str(), profile_font_size) / 2), current_y_pos, profile_font_size, WHITE);
+    current_y_pos += profile_font_size + 40; // Move Y down, add more padding
+
+    // Score/Time Display
+    if (is_new_high_score) {
+        int new_best_font_size = 80;
+        std::string new_best_text = "NEW BEST: " + std::to_string(sim.final_survival_time_s).substr(0, std::to_string(sim.final_survival_time_s).find('.') + 3) + " seconds!";
+        DrawText(new_best_text.c_str(), (int)(center_x - MeasureText(new_best_text.c_str(), new_best_font_size) / 2), current_y_pos, new_best_font_size, GOLD);
+        current_y_pos += new_best_font_size + 30;
+    } else {
+        int final_time_font_size = 60;
+        std::string final_time_text = "Your Time: " + std::to_string(sim.final_survival_time_s).substr(0, std::to_string(sim.final_survival_time_s).find('.') + 3) + " seconds!";
+        DrawText(final_time_text.c_str(), (int)(center_x - MeasureText(final_time_text.c_str(), final_time_font_size) / 2), current_y_pos, final_time_font_size, WHITE);
+        current_y_pos += final_time_font_size + 30;
+    }
 
-    } else if (current_game_state == GAME_STATE_COUNTDOWN) {
-        int display_countdown = (current_countdown_frame / FPS) + 1;
-        if (display_countdown > 0) {
-            drawCenteredText(std::to_string(display_countdown), 100, WHITE);
-        } else {
-            drawCenteredText("GO!", 100, GREEN);
+    // High Score / Time Needed to Win
+    int score_info_font_size = 48;
+    if (currentProfileHighScore >= currentWinThreshold) {
+        std::string highScoreDisplay = "Your High Score: " + std::to_string(currentProfileHighScore).substr(0, std::to_string(currentProfileHighScore).find('.') + 3) + "s";
+        DrawText(highScoreDisplay.c_str(), (int)(center_x - MeasureText(highScoreDisplay.c_str(), score_info_font_size) / 2), current_y_pos, score_info_font_size, GOLD);
+        current_y_pos += score_info_font_size + 30;
+    } else {
+        if (!didWin) {
+            std::string time_needed_text = "You needed " + std::to_string(currentWinThreshold - sim.final_survival_time_s).substr(0, std::to_string(currentWinThreshold - sim.final_survival_time_s).find('.') + 3) + " more seconds to win!";
+            DrawText(time_needed_text.c_str(), (int)(center_x - MeasureText(time_needed_text.c_str(), score_info_font_size) / 2), current_y_pos, score_info_font_size, GOLD);
+            current_y_pos += score_info_font_size + 30;
         }
-    } else if (current_game_state == GAME_STATE_PLAYING) {
-        // Top-Left: Profile Info
-        drawInfoText("Profile: " + current_username + " (" + current_difficulty_mode + ")", 24, WHITE, 20, 20, ALIGN_LEFT);
+    }
 
-        // Top-Center: Current Time
-        std::string time_display_str = "Time: " + std::to_string(elapsed_time_s).substr(0, std::to_string(elapsed_time_s).find('.') + 2) + "s";
-        drawInfoText(time_display_str, 36, WHITE, SCREEN_WIDTH / 2, 20, ALIGN_CENTER);
+    // Win/Try Again message - MODIFIED LOGIC HERE
+    int game_message_font_size = 52;
+    if (didWin && is_new_high_score) { // Only show "BEATEN THE GAME" if it's a new high score AND a win
+        nextGameMessage = "YOU HAVE BEATEN THE GAME ON NORMAL MODE!";
+    } else {
+        nextGameMessage = "TRY AGAIN!"; // Otherwise, default to "TRY AGAIN!"
+    }
+    DrawText(nextGameMessage.c_str(), (int)(center_x - MeasureText(nextGameMessage.c_str(), game_message_font_size) / 2), current_y_pos + 20, game_message_font_size, WHITE); // Add extra padding before this message
+    current_y_pos += game_message_font_size + 50; // Move Y down
+
+    // Instructions
+    int instruction_font_size = 45;
+    DrawText("Press R to Continue", (int)(center_x - MeasureText("Press R to Continue", instruction_font_size) / 2), current_y_pos + 20, instruction_font_size, WHITE);
+    DrawText("Press P to Change Profile", (int)(center_x - MeasureText("Press P to Change Profile", instruction_font_size) / 2), current_y_pos + 80, instruction_font_size, WHITE);
+    if (!last_replay_bytes.empty()) {
+        int replay_font_size = 30;
+        DrawText("Press V to Watch the Replay", (int)(center_x - MeasureText("Press V to Watch the Replay", replay_font_size) / 2), current_y_pos + 140, replay_font_size, LIGHTGRAY);
+    }
 
-        // Top-Right: High Score or Time Left to Win
-        if (high_scores["normal"] >= WIN_THRESHOLD_TIMES["normal"]) {
-            std::string highScoreDisplay = "High Score: " + std::to_string(high_scores["normal"]).substr(0, std::to_string(high_scores["normal"]).find('.') + 3) + "s";
-            drawInfoText(highScoreDisplay, 24, GOLD, SCREEN_WIDTH - 20, 20, ALIGN_RIGHT);
-        } else {
-            const double timeLeft = std::max(0.0, WIN_THRESHOLD_TIMES["normal"] - elapsed_time_s);
-            std::string timeLeftDisplay_str = "Time to Win: " + std::to_string(timeLeft).substr(0, std::to_string(timeLeft).find('.') + 2) + "s";
-            drawInfoText(timeLeftDisplay_str, 24, GOLD, SCREEN_WIDTH - 20, 20, ALIGN_RIGHT);
-        }
-        
-        // Draw player and obstacle
-        DrawRectangle(static_cast<int>(player_x), static_cast<int>(player_y),
-                      static_cast<int>(player_size), static_cast<int>(player_size),
-                      player_is_stunned ? LIGHTGRAY_CUSTOM : player_color);
+    if (current_difficulty_mode == "babymode" && sim.final_survival_time_s < 10.0 && high_scores["babymode"] > 20.0) {
+        // Rickroll placeholder
+    }
+}
 
-        Vector2 playerCenter = {player_x + player_size / 2.0f, player_y + player_size / 2.0f};
-        float aimLineLength = player_size * 1.5f;
-        Vector2 aimLineEnd = {
-            playerCenter.x + cosf(player_aim_angle) * aimLineLength,
-            playerCenter.y + sinf(player_aim_angle) * aimLineLength
-        };
-        DrawLineV(playerCenter, aimLineEnd, WHITE);
+// The playing field and HUD, for both a live game and replay playback. Allocation-free: HUD text is
+// formatted into HudText buffers only when the value shown changes (see updateHudText).
+void drawPlayingScreen() {
+    // Refresh what the HUD reads from the maps when the profile or high score may have changed
+    if (hud.generation != display_generation) {
+        hud.generation = display_generation;
+        hud.high_score = high_scores["normal"];
+        hud.win_threshold = WIN_THRESHOLD_TIMES["normal"];
+    }
 
-        DrawRectangle(static_cast<int>(obstacle_x), static_cast<int>(obstacle_y),
-                      static_cast<int>(obstacle_size), static_cast<int>(obstacle_size), 
-                      obstacle_is_stunned ? OBSTACLE_STUNNED_COLOR : obstacle_color);
+    // Draw player, obstacles and projectiles (interpolated between the last two simulation ticks).
+    // Shapes go first, grouped by primitive: raylib merges consecutive draws with the same texture and
+    // mode into one draw call, so a line or a piece of text (font texture) in between starts a new one.
+    PROFILE_BEGIN(PROFILE_DRAW_CALLS);
+    float draw_player_x = interpolatePosition(sim.prev_player_x, sim.player_x, sim_render_alpha);
+    float draw_player_y = interpolatePosition(sim.prev_player_y, sim.player_y, sim_render_alpha);
+    DrawRectangle(static_cast<int>(draw_player_x), static_cast<int>(draw_player_y),
+                  static_cast<int>(player_size), static_cast<int>(player_size),
+                  sim.player_is_stunned ? LIGHTGRAY_CUSTOM : player_color);
+
+    for (const Obstacle& obstacle : sim.obstacles) {
+        float draw_obstacle_x = interpolatePosition(obstacle.prev_x, obstacle.x, sim_render_alpha);
+        float draw_obstacle_y = interpolatePosition(obstacle.prev_y, obstacle.y, sim_render_alpha);
+        DrawRectangle(static_cast<int>(draw_obstacle_x), static_cast<int>(draw_obstacle_y),
+                      static_cast<int>(obstacle_size), static_cast<int>(obstacle_size),
+                      obstacle.is_stunned ? OBSTACLE_STUNNED_COLOR : obstacle_color);
+    }
 
-        // Draw projectiles
-        for (const auto& p : projectiles) {
-            if (p.active) {
-                DrawRectangleRec(p.rect, p.is_player_shot ? PROJECTILE_COLOR : OBSTACLE_PROJECTILE_COLOR);
-            }
+    const ProjectilePool& pool = sim.projectiles;
+    for (int i = 0; i < pool.high_water; ++i) {
+        if (pool.flags[i] & PROJECTILE_ACTIVE) {
+            Rectangle draw_rect = {interpolatePosition(pool.prev_x[i], pool.x[i], sim_render_alpha),
+                                   interpolatePosition(pool.prev_y[i], pool.y[i], sim_render_alpha),
+                                   PROJECTILE_SIZE, PROJECTILE_SIZE};
+            DrawRectangleRec(draw_rect, (pool.flags[i] & PROJECTILE_PLAYER_SHOT) ? PROJECTILE_COLOR : OBSTACLE_PROJECTILE_COLOR);
         }
+    }
 
-        // --- Draw Portals if active ---
-        if (is_portal_mode) {
-            if (portal_1_active) {
-                DrawCircleV(portal_1_pos, PORTAL_RADIUS, PORTAL_COLOR_1);
-            }
-            if (portal_2_active) {
-                DrawCircleV(portal_2_pos, PORTAL_RADIUS, PORTAL_COLOR_2);
-            }
+    Vector2 playerCenter = {draw_player_x + player_size / 2.0f, draw_player_y + player_size / 2.0f};
+    float aimLineLength = player_size * 1.5f;
+    Vector2 aimLineEnd = {
+        playerCenter.x + cosf(sim.player_aim_angle) * aimLineLength,
+        playerCenter.y + sinf(sim.player_aim_angle) * aimLineLength
+    };
+    DrawLineV(playerCenter, aimLineEnd, WHITE);
+
+    // --- Draw Portals if active ---
+    if (sim.portal_mode) {
+        if (sim.portal_1_active) {
+            DrawCircleV(sim.portal_1_pos, PORTAL_RADIUS, PORTAL_COLOR_1);
         }
-
-        // --- Draw Time Bonus Message ---
-        if (showing_time_bonus_message) {
-            drawCenteredText("TIME BONUS +1s!", 50, GREEN, 0); // Centered, large green text
+        if (sim.portal_2_active) {
+            DrawCircleV(sim.portal_2_pos, PORTAL_RADIUS, PORTAL_COLOR_2);
         }
+    }
+    PROFILE_END(PROFILE_DRAW_CALLS);
+
+    PROFILE_BEGIN(PROFILE_HUD_TEXT);
+    // Top-Left: Profile Info
+    updateHudText(hud.profile, 24, (int64_t)display_generation, "Profile: %s (%s)", current_username.c_str(), current_difficulty_mode.c_str());
+    drawHudText(hud.profile, WHITE, 20, 20, ALIGN_LEFT);
+
+    // Top-Center: Current Time
+    int64_t time_tenths = displayedFixedPoint(sim.elapsed_time_s, 10);
+    updateHudText(hud.time, 36, time_tenths, "Time: %lld.%llds", (long long)(time_tenths / 10), (long long)(time_tenths % 10));
+    drawHudText(hud.time, WHITE, SCREEN_WIDTH / 2, 20, ALIGN_CENTER);
+
+    // Top-Right: High Score or Time Left to Win (the low bit of the key says which)
+    if (hud.high_score >= hud.win_threshold) {
+        int64_t hundredths = displayedFixedPoint(hud.high_score, 100);
+        updateHudText(hud.goal, 24, hundredths * 2 + 1, "High Score: %lld.%02llds", (long long)(hundredths / 100), (long long)(hundredths % 100));
+    } else {
+        int64_t tenths = displayedFixedPoint(std::max(0.0, hud.win_threshold - sim.elapsed_time_s), 10);
+        updateHudText(hud.goal, 24, tenths * 2, "Time to Win: %lld.%llds", (long long)(tenths / 10), (long long)(tenths % 10));
+    }
+    drawHudText(hud.goal, GOLD, SCREEN_WIDTH - 20, 20, ALIGN_RIGHT);
 
-        // --- Draw Achievement Popup ---
-        if (!current_achievement_popup_id.empty()) {
-            const Achievement& popup_achievement = ALL_ACHIEVEMENTS.at(current_achievement_popup_id);
-            std::string popup_name = popup_achievement.name;
-            std::string popup_desc = popup_achievement.description;
+    // --- Draw Time Bonus Message ---
+    if (sim.showing_time_bonus_message) {
+        drawCenteredText("TIME BONUS +1s!", 50, GREEN, 0); // Centered, large green text
+    }
 
-            int popup_width = 600;
-            int popup_height = 150;
-            int popup_x = (SCREEN_WIDTH - popup_width) / 2;
-            int popup_y = (SCREEN_HEIGHT - popup_height) / 2; // Centered vertically
+    // --- Draw Achievement Popup ---
+    if (current_achievement_popup != ACHIEVEMENT_NONE) {
+        const Achievement& popup_achievement = *ACHIEVEMENTS_BY_ID[current_achievement_popup];
+        const int64_t popup_key = current_achievement_popup;
 
-            DrawRectangle(popup_x, popup_y, popup_width, popup_height, Fade(BLACK, 0.8f));
-            DrawRectangleLines(popup_x, popup_y, popup_width, popup_height, UNLOCKED_ACHIEVEMENT_COLOR);
+        int popup_width = 600;
+        int popup_height = 150;
+        int popup_x = (SCREEN_WIDTH - popup_width) / 2;
+        int popup_y = (SCREEN_HEIGHT - popup_height) / 2; // Centered vertically
 
-            int text_start_y = popup_y + 20; // Padding from top of popup
+        DrawRectangle(popup_x, popup_y, popup_width, popup_height, Fade(BLACK, 0.8f));
+        DrawRectangleLines(popup_x, popup_y, popup_width, popup_height, UNLOCKED_ACHIEVEMENT_COLOR);
 
-            int title_font_size = 30;
-            int name_font_size = 25;
-            int desc_font_size = 20;
+        int text_start_y = popup_y + 20; // Padding from top of popup
+        int popup_center_x = popup_x + popup_width / 2;
 
-            // "ACHIEVEMENT UNLOCKED!"
-            int text_width_title = MeasureText("ACHIEVEMENT UNLOCKED!", title_font_size);
-            DrawText("ACHIEVEMENT UNLOCKED!", popup_x + (popup_width - text_width_title) / 2, text_start_y, title_font_size, UNLOCKED_ACHIEVEMENT_COLOR);
-            text_start_y += title_font_size + 10;
+        // "ACHIEVEMENT UNLOCKED!"
+        updateHudText(hud.popup_title, 30, 0, "ACHIEVEMENT UNLOCKED!");
+        drawHudText(hud.popup_title, UNLOCKED_ACHIEVEMENT_COLOR, popup_center_x, text_start_y, ALIGN_CENTER);
+        text_start_y += hud.popup_title.font_size + 10;
 
-            // Achievement Name
-            int text_width_name = MeasureText(popup_name.c_str(), name_font_size);
-            DrawText(popup_name.c_str(), popup_x + (popup_width - text_width_name) / 2, text_start_y, name_font_size, WHITE);
-            text_start_y += name_font_size + 10;
+        // Achievement Name
+        updateHudText(hud.popup_name, 25, popup_key, "%s", popup_achievement.name.c_str());
+        drawHudText(hud.popup_name, WHITE, popup_center_x, text_start_y, ALIGN_CENTER);
+        text_start_y += hud.popup_name.font_size + 10;
 
-            // Achievement Description
-            int text_width_desc = MeasureText(popup_desc.c_str(), desc_font_size);
-            DrawText(popup_desc.c_str(), popup_x + (popup_width - text_width_desc) / 2, text_start_y, desc_font_size, LIGHTGRAY);
-        }
+        // Achievement Description
+        updateHudText(hud.popup_description, 20, popup_key, "%s", popup_achievement.description.c_str());
+        drawHudText(hud.popup_description, LIGHTGRAY, popup_center_x, text_start_y, ALIGN_CENTER);
+    }
 
-        // Bottom-Center: Cooldowns
-        int cooldown_y_offset = SCREEN_HEIGHT - 30; // Starting Y for cooldowns, from bottom
-        const int cooldown_line_height = 25; // Spacing between cooldown lines
+    // Bottom-Center: Cooldowns
+    int cooldown_y_offset = SCREEN_HEIGHT - 30; // Starting Y for cooldowns, from bottom
 
-        if (GetTime() - player_last_dash_time < PLAYER_DASH_COOLDOWN) {
-            double cooldown_remaining = PLAYER_DASH_COOLDOWN - (GetTime() - player_last_dash_time);
-            std::string cooldown_str = "Dash CD: " + std::to_string(cooldown_remaining).substr(0, std::to_string(cooldown_remaining).find('.') + 2) + "s";
-            drawInfoText(cooldown_str, 20, BLUE, SCREEN_WIDTH / 2, cooldown_y_offset, ALIGN_CENTER);
-            cooldown_y_offset -= cooldown_line_height;
-        }
+    if (sim.time - sim.player_last_dash_time < sim.tuning.player_dash_cooldown) {
+        drawCooldownLine(hud.cooldowns[0], "Dash CD", sim.tuning.player_dash_cooldown - (sim.time - sim.player_last_dash_time), BLUE, cooldown_y_offset);
+    }
+    if (sim.time - sim.player_last_stun_shot_time < sim.tuning.player_stun_shot_cooldown) {
+        drawCooldownLine(hud.cooldowns[1], "Player Stun Shot CD", sim.tuning.player_stun_shot_cooldown - (sim.time - sim.player_last_stun_shot_time), ORANGE, cooldown_y_offset);
+    }
+    if (sim.time - sim.obstacle_last_stun_time < sim.tuning.obstacle_stun_cooldown) {
+        drawCooldownLine(hud.cooldowns[2], "Obstacle Stun CD", sim.tuning.obstacle_stun_cooldown - (sim.time - sim.obstacle_last_stun_time), RED, cooldown_y_offset);
+    }
+    // In a swarm this only follows the first obstacle; the others are staggered anyway
+    if (sim.time - sim.obstacles[0].last_shot_time < sim.tuning.obstacle_shoot_cooldown) {
+        drawCooldownLine(hud.cooldowns[3], "Obstacle Shoot CD", sim.tuning.obstacle_shoot_cooldown - (sim.time - sim.obstacles[0].last_shot_time), OBSTACLE_PROJECTILE_COLOR, cooldown_y_offset);
+    }
 
-        if (GetTime() - player_last_stun_shot_time < PLAYER_STUN_SHOT_COOLDOWN) {
-            double cooldown_remaining = PLAYER_STUN_SHOT_COOLDOWN - (GetTime() - player_last_stun_shot_time);
-            std::string cooldown_str = "Player Stun Shot CD: " + std::to_string(cooldown_remaining).substr(0, std::to_string(cooldown_remaining).find('.') + 2) + "s";
-            drawInfoText(cooldown_str, 20, ORANGE, SCREEN_WIDTH / 2, cooldown_y_offset, ALIGN_CENTER);
-            cooldown_y_offset -= cooldown_line_height;
+    if (current_game_state == GAME_STATE_REPLAY) {
+        if (replay_playback_speed == 0) {
+            updateHudText(hud.replay_label, 24, 0, "REPLAY: %s at uncapped", replay_playback.header.username);
+        } else {
+            updateHudText(hud.replay_label, 24, replay_playback_speed, "REPLAY: %s at %dx", replay_playback.header.username, replay_playback_speed);
         }
+        drawHudText(hud.replay_label, SKYBLUE, 20, SCREEN_HEIGHT - 60, ALIGN_LEFT);
+        drawInfoText("1/2/3/4: 1x/2x/8x/uncapped, ESC: stop", 20, LIGHTGRAY, 20, SCREEN_HEIGHT - 30, ALIGN_LEFT);
+    }
+    PROFILE_END(PROFILE_HUD_TEXT);
+}
 
-        if (GetTime() - obstacle_last_stun_time < OBSTACLE_STUN_COOLDOWN) {
-            double cooldown_remaining = OBSTACLE_STUN_COOLDOWN - (GetTime() - obstacle_last_stun_time);
-            std::string cooldown_str = "Obstacle Stun CD: " + std::to_string(cooldown_remaining).substr(0, std::to_string(cooldown_remaining).find('.') + 2) + "s";
-            drawInfoText(cooldown_str, 20, RED, SCREEN_WIDTH / 2, cooldown_y_offset, ALIGN_CENTER);
-            cooldown_y_offset -= cooldown_line_height;
+void drawGame() {
+    PROFILE_SCOPE(PROFILE_DRAW);
+    // Screens that only change on input come from the static screen cache
+    switch (current_game_state) {
+        case GAME_STATE_TAMPERED: drawStaticScreen(drawTamperedScreen); return;
+        case GAME_STATE_USERNAME_INPUT: drawStaticScreen(drawUsernameInputScreen); return;
+        case GAME_STATE_MAIN_MENU: drawStaticScreen(drawMainMenuScreen); return;
+        case GAME_STATE_GAME_OVER: drawStaticScreen(drawGameOverScreen); return;
+        case GAME_STATE_ACHIEVEMENTS: drawStaticScreen(drawAchievementsScreen); return;
+        case GAME_STATE_SELECT_ACHIEVEMENT_PROFILE: drawStaticScreen(drawSelectAchievementProfileScreen); return;
+        default: break;
+    }
+    // Coming back to a static screen (e.g. the next game over) must redraw it
+    static_screen.dirty = true;
+
+    if (current_game_state == GAME_STATE_COUNTDOWN) {
+        int display_countdown = (current_countdown_frame / FPS) + 1;
+        if (display_countdown > 0) {
+            char countdown_text[16];
+            snprintf(countdown_text, sizeof(countdown_text), "%d", display_countdown);
+            drawCenteredText(countdown_text, 100, WHITE);
+        } else {
+            drawCenteredText("GO!", 100, GREEN);
         }
+    } else if (current_game_state == GAME_STATE_PLAYING || current_game_state == GAME_STATE_REPLAY) {
+        drawPlayingScreen();
+    }
+}
+
+#ifdef DODGER_PROFILE
+// --- Profiler ---
+const uint32_t PROFILE_RING_CAPACITY = 1u << 16;  // Power of two; a frame records a few dozen samples
+const int PROFILE_HISTOGRAM_BUCKETS = 256;         // 8 per power of two, enough for durations up to ~8 s
+const size_t PROFILE_TRACE_CAPACITY = 1u << 20;    // Most recent samples kept for dodger_trace.json
+const uint64_t PROFILE_WINDOW_NS = 1000000000ull;  // The overlay shows statistics over this much real time
+const char* const PROFILE_CSV_FILE_NAME = "dodger_profile.csv";
+const char* const PROFILE_TRACE_FILE_NAME = "dodger_trace.json";
+
+// Single-producer/single-consumer ring: the producer only advances head, the consumer only advances tail
+struct ProfileRing {
+    ProfileSample samples[PROFILE_RING_CAPACITY];
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> tail{0};
+    std::atomic<uint64_t> dropped{0}; // Samples lost because the ring was full
+};
+
+// Durations in log-linear buckets, so percentiles are within 1/8 of the true value
+struct ProfileHistogram {
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t min_ns = UINT64_MAX;
+    uint64_t max_ns = 0;
+    uint32_t buckets[PROFILE_HISTOGRAM_BUCKETS] = {};
+};
+
+static ProfileRing profile_ring;
+static thread_local bool profile_thread_enabled = false;
+static thread_local uint64_t profile_zone_start_ns[PROFILE_ZONE_COUNT];
+static const std::chrono::steady_clock::time_point profile_epoch = std::chrono::steady_clock::now();
+
+// Consumer side (only touched by profileEndFrame/profileShutdown on the main thread)
+static uint64_t profile_frame_ns[PROFILE_ZONE_COUNT];
+static uint32_t profile_frame_hits[PROFILE_ZONE_COUNT];
+static ProfileHistogram profile_window[PROFILE_ZONE_COUNT];      // Being collected
+static ProfileHistogram profile_last_window[PROFILE_ZONE_COUNT]; // Shown by the overlay
+static ProfileHistogram profile_total[PROFILE_ZONE_COUNT];       // Whole run, for the CSV
+static uint64_t profile_window_start_ns = 0;
+static std::vector<ProfileSample> profile_trace; // Circular buffer of PROFILE_TRACE_CAPACITY samples
+static uint64_t profile_trace_written = 0;
+static bool profile_overlay_visible = false;
+
+uint64_t profileNow() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - profile_epoch).count();
+}
+
+void profileEnableThisThread() {
+    profile_thread_enabled = true;
+}
+
+static void profileRecord(ProfileZone zone, uint64_t start_ns) {
+    if (!profile_thread_enabled) {
+        return;
+    }
+    uint64_t end_ns = profileNow();
+    uint32_t head = profile_ring.head.load(std::memory_order_relaxed);
+    uint32_t tail = profile_ring.tail.load(std::memory_order_acquire);
+    if (head - tail >= PROFILE_RING_CAPACITY) {
+        profile_ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    ProfileSample& sample = profile_ring.samples[head & (PROFILE_RING_CAPACITY - 1)];
+    sample.start_ns = start_ns;
+    sample.duration_ns = (uint32_t)std::min<uint64_t>(end_ns - start_ns, UINT32_MAX);
+    sample.zone = (uint32_t)zone;
+    profile_ring.head.store(head + 1, std::memory_order_release);
+}
+
+ProfileScope::ProfileScope(ProfileZone z) : zone(z), start_ns(profile_thread_enabled ? profileNow() : 0) {}
 
-        if (GetTime() - obstacle_last_shot_time < OBSTACLE_SHOOT_COOLDOWN) {
-            double cooldown_remaining = OBSTACLE_SHOOT_COOLDOWN - (GetTime() - obstacle_last_shot_time);
-            std::string cooldown_str = "Obstacle Shoot CD: " + std::to_string(cooldown_remaining).substr(0, std::to_string(cooldown_remaining).find('.') + 2) + "s";
-            drawInfoText(cooldown_str, 20, OBSTACLE_PROJECTILE_COLOR, SCREEN_WIDTH / 2, cooldown_y_offset, ALIGN_CENTER);
-            cooldown_y_offset -= cooldown_line_height;
+ProfileScope::~ProfileScope() {
+    profileRecord(zone, start_ns);
+}
+
+void profileBegin(ProfileZone zone) {
+    if (profile_thread_enabled) {
+        profile_zone_start_ns[zone] = profileNow();
+    }
+}
+
+void profileEnd(ProfileZone zone) {
+    profileRecord(zone, profile_zone_start_ns[zone]);
+}
+
+static int profileBucket(uint64_t ns) {
+    if (ns < 8) {
+        return (int)ns;
+    }
+    int octave = 63 - __builtin_clzll(ns); // >= 3
+    int index = (octave - 2) * 8 + (int)((ns >> (octave - 3)) & 7);
+    return std::min(index, PROFILE_HISTOGRAM_BUCKETS - 1);
+}
+
+static uint64_t profileBucketUpperBound(int index) {
+    if (index < 8) {
+        return (uint64_t)index;
+    }
+    int octave = index / 8 + 2;
+    return ((uint64_t)(8 + index % 8 + 1) << (octave - 3)) - 1;
+}
+
+static void profileAdd(ProfileHistogram& histogram, uint64_t ns) {
+    histogram.count++;
+    histogram.total_ns += ns;
+    histogram.min_ns = std::min(histogram.min_ns, ns);
+    histogram.max_ns = std::max(histogram.max_ns, ns);
+    histogram.buckets[profileBucket(ns)]++;
+}
+
+static uint64_t profilePercentile(const ProfileHistogram& histogram, double fraction) {
+    if (histogram.count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)ceil(fraction * histogram.count);
+    uint64_t seen = 0;
+    for (int i = 0; i < PROFILE_HISTOGRAM_BUCKETS; ++i) {
+        seen += histogram.buckets[i];
+        if (seen >= rank) {
+            return std::min(profileBucketUpperBound(i), histogram.max_ns);
         }
+    }
+    return histogram.max_ns;
+}
 
+// Consumer: drains the ring, folds this frame's per-zone totals into the histograms and rolls the overlay window
+void profileEndFrame() {
+    if (!profile_thread_enabled) {
+        return;
+    }
+    if (profile_trace.empty()) {
+        profile_trace.resize(PROFILE_TRACE_CAPACITY);
+    }
 
-    } else if (current_game_state == GAME_STATE_GAME_OVER) {
-        const float center_x = (float)SCREEN_WIDTH / 2.0f;
-        const float center_y = (float)SCREEN_HEIGHT / 2.0f;
-
-        // Redeclare variables for this scope
-        double currentProfileHighScore = high_scores[current_difficulty_mode];
-        const double currentWinThreshold = WIN_THRESHOLD_TIMES[current_difficulty_mode];
-        const bool didWin = final_survival_time_s >= currentWinThreshold;
-
-        // Start Y for the first element, adjusted to center the entire block of text
-        int current_y_pos = (SCREEN_HEIGHT / 2) - 250; // Adjusted starting Y to move content up
-
-        // "GAME OVER!" title
-        int game_over_font_size = 130;
-        DrawText("GAME OVER!", (int)(center_x - MeasureText("GAME OVER!", game_over_font_size) / 2), current_y_pos, game_over_font_size, RED);
-        current_y_pos += game_over_font_size + 30; // Move Y down, add padding
-
-        // Profile Info
-        int profile_font_size = 40;
-        std::string profile_text = "Profile: " + current_username + " (" + current_difficulty_mode + ")";
-        DrawText(profile_text.c_str(), (int)(center_x - MeasureText(profile_text.c_str(), profile_font_size) / 2), current_y_pos, profile_font_size, WHITE);
-        current_y_pos += profile_font_size + 40; // Move Y down, add more padding
-
-        // Score/Time Display
-        if (is_new_high_score) {
-            int new_best_font_size = 80;
-            std::string new_best_text = "NEW BEST: " + std::to_string(final_survival_time_s).substr(0, std::to_string(final_survival_time_s).find('.') + 3) + " seconds!";
-            DrawText(new_best_text.c_str(), (int)(center_x - MeasureText(new_best_text.c_str(), new_best_font_size) / 2), current_y_pos, new_best_font_size, GOLD);
-            current_y_pos += new_best_font_size + 30;
-        } else {
-            int final_time_font_size = 60;
-            std::string final_time_text = "Your Time: " + std::to_string(final_survival_time_s).substr(0, std::to_string(final_survival_time_s).find('.') + 3) + " seconds!";
-            DrawText(final_time_text.c_str(), (int)(center_x - MeasureText(final_time_text.c_str(), final_time_font_size) / 2), current_y_pos, final_time_font_size, WHITE);
-            current_y_pos += final_time_font_size + 30;
+    uint32_t tail = profile_ring.tail.load(std::memory_order_relaxed);
+    const uint32_t head = profile_ring.head.load(std::memory_order_acquire);
+    for (; tail != head; ++tail) {
+        const ProfileSample& sample = profile_ring.samples[tail & (PROFILE_RING_CAPACITY - 1)];
+        profile_frame_ns[sample.zone] += sample.duration_ns;
+        profile_frame_hits[sample.zone]++;
+        profile_trace[profile_trace_written % PROFILE_TRACE_CAPACITY] = sample;
+        profile_trace_written++;
+    }
+    profile_ring.tail.store(tail, std::memory_order_release);
+
+    for (int zone = 0; zone < PROFILE_ZONE_COUNT; ++zone) {
+        if (profile_frame_hits[zone] > 0) {
+            profileAdd(profile_window[zone], profile_frame_ns[zone]);
+            profileAdd(profile_total[zone], profile_frame_ns[zone]);
+            profile_frame_ns[zone] = 0;
+            profile_frame_hits[zone] = 0;
         }
+    }
 
-        // High Score / Time Needed to Win
-        int score_info_font_size = 48;
-        if (currentProfileHighScore >= currentWinThreshold) {
-            std::string highScoreDisplay = "Your High Score: " + std::to_string(currentProfileHighScore).substr(0, std::to_string(currentProfileHighScore).find('.') + 3) + "s";
-            DrawText(highScoreDisplay.c_str(), (int)(center_x - MeasureText(highScoreDisplay.c_str(), score_info_font_size) / 2), current_y_pos, score_info_font_size, GOLD);
-            current_y_pos += score_info_font_size + 30;
-        } else {
-            if (!didWin) {
-                std::string time_needed_text = "You needed " + std::to_string(currentWinThreshold - final_survival_time_s).substr(0, std::to_string(currentWinThreshold - final_survival_time_s).find('.') + 3) + " more seconds to win!";
-                DrawText(time_needed_text.c_str(), (int)(center_x - MeasureText(time_needed_text.c_str(), score_info_font_size) / 2), current_y_pos, score_info_font_size, GOLD);
-                current_y_pos += score_info_font_size + 30;
-            }
+    uint64_t now = profileNow();
+    if (now - profile_window_start_ns >= PROFILE_WINDOW_NS) {
+        for (int zone = 0; zone < PROFILE_ZONE_COUNT; ++zone) {
+            profile_last_window[zone] = profile_window[zone];
+            profile_window[zone] = ProfileHistogram();
         }
+        profile_window_start_ns = now;
+    }
+}
 
-        // Win/Try Again message - MODIFIED LOGIC HERE
-        int game_message_font_size = 52;
-        if (didWin && is_new_high_score) { // Only show "BEATEN THE GAME" if it's a new high score AND a win
-            nextGameMessage = "YOU HAVE BEATEN THE GAME ON NORMAL MODE!";
-        } else {
-            nextGameMessage = "TRY AGAIN!"; // Otherwise, default to "TRY AGAIN!"
+void profileToggleOverlay() {
+    profile_overlay_visible = !profile_overlay_visible;
+}
+
+// Per-zone min/avg/p99 (microseconds per frame) over the last completed window
+void drawProfileOverlay() {
+    if (!profile_overlay_visible) {
+        return;
+    }
+    const int font_size = 16;
+    const int line_height = 18;
+    const int x = 10;
+    int y = 60;
+    const int column_min = x + 170;
+    const int column_avg = x + 250;
+    const int column_p99 = x + 330;
+    DrawRectangle(x - 6, y - 6, 400, (PROFILE_ZONE_COUNT + 2) * line_height + 12, Fade(BLACK, 0.75f));
+
+    char text[64];
+    DrawText("zone (us/frame)", x, y, font_size, SKYBLUE);
+    DrawText("min", column_min, y, font_size, SKYBLUE);
+    DrawText("avg", column_avg, y, font_size, SKYBLUE);
+    DrawText("p99", column_p99, y, font_size, SKYBLUE);
+    y += line_height;
+    for (int zone = 0; zone < PROFILE_ZONE_COUNT; ++zone) {
+        const ProfileHistogram& histogram = profile_last_window[zone];
+        Color color = histogram.count > 0 ? WHITE : DARKGRAY;
+        DrawText(PROFILE_ZONE_NAMES[zone], x, y, font_size, color);
+        if (histogram.count > 0) {
+            snprintf(text, sizeof(text), "%.1f", histogram.min_ns / 1000.0);
+            DrawText(text, column_min, y, font_size, color);
+            snprintf(text, sizeof(text), "%.1f", (double)histogram.total_ns / histogram.count / 1000.0);
+            DrawText(text, column_avg, y, font_size, color);
+            snprintf(text, sizeof(text), "%.1f", profilePercentile(histogram, 0.99) / 1000.0);
+            DrawText(text, column_p99, y, font_size, color);
         }
-        DrawText(nextGameMessage.c_str(), (int)(center_x - MeasureText(nextGameMessage.c_str(), game_message_font_size) / 2), current_y_pos + 20, game_message_font_size, WHITE); // Add extra padding before this message
-        current_y_pos += game_message_font_size + 50; // Move Y down
+        y += line_height;
+    }
+    snprintf(text, sizeof(text), "dropped samples: %llu",
+             (unsigned long long)profile_ring.dropped.load(std::memory_order_relaxed));
+    DrawText(text, x, y, font_size, LIGHTGRAY);
+}
 
-        // Instructions
-        int instruction_font_size = 45;
-        DrawText("Press R to Continue", (int)(center_x - MeasureText("Press R to Continue", instruction_font_size) / 2), current_y_pos + 20, instruction_font_size, WHITE);
-        DrawText("Press P to Change Profile", (int)(center_x - MeasureText("Press P to Change Profile", instruction_font_size) / 2), current_y_pos + 80, instruction_font_size, WHITE);
+void profileShutdown() {
+    profileEndFrame(); // Pick up anything recorded since the last frame
 
-        if (current_difficulty_mode == "babymode" && final_survival_time_s < 10.0 && high_scores["babymode"] > 20.0) {
-            // Rickroll placeholder
+    FILE* csv = fopen(PROFILE_CSV_FILE_NAME, "w");
+    if (csv != nullptr) {
+        fprintf(csv, "zone,frames,min_us,avg_us,p99_us,max_us,total_ms\n");
+        for (int zone = 0; zone < PROFILE_ZONE_COUNT; ++zone) {
+            const ProfileHistogram& histogram = profile_total[zone];
+            if (histogram.count == 0) {
+                continue;
+            }
+            fprintf(csv, "%s,%llu,%.3f,%.3f,%.3f,%.3f,%.3f\n", PROFILE_ZONE_NAMES[zone],
+                    (unsigned long long)histogram.count, histogram.min_ns / 1000.0,
+                    (double)histogram.total_ns / histogram.count / 1000.0,
+                    profilePercentile(histogram, 0.99) / 1000.0, histogram.max_ns / 1000.0,
+                    histogram.total_ns / 1e6);
         }
-    } else if (current_game_state == GAME_STATE_ACHIEVEMENTS) {
-        drawAchievementsScreen();
-    } else if (current_game_state == GAME_STATE_SELECT_ACHIEVEMENT_PROFILE) {
-        drawSelectAchievementProfileScreen();
+        fclose(csv);
+        TraceLog(LOG_INFO, "Profile summary written to %s", PROFILE_CSV_FILE_NAME);
+    } else {
+        TraceLog(LOG_WARNING, "Failed to open %s for writing.", PROFILE_CSV_FILE_NAME);
+    }
+
+    // Chrome trace event format: one complete ("X") event per sample, times in microseconds
+    FILE* trace = fopen(PROFILE_TRACE_FILE_NAME, "w");
+    if (trace != nullptr) {
+        uint64_t kept = std::min<uint64_t>(profile_trace_written, PROFILE_TRACE_CAPACITY);
+        uint64_t first = profile_trace_written - kept;
+        fprintf(trace, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        for (uint64_t i = first; i < profile_trace_written; ++i) {
+            const ProfileSample& sample = profile_trace[i % PROFILE_TRACE_CAPACITY];
+            fprintf(trace, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+                    i == first ? "" : ",\n", PROFILE_ZONE_NAMES[sample.zone],
+                    sample.start_ns / 1000.0, sample.duration_ns / 1000.0);
+        }
+        fprintf(trace, "\n]}\n");
+        fclose(trace);
+        TraceLog(LOG_INFO, "Profile trace (%llu samples) written to %s", (unsigned long long)kept, PROFILE_TRACE_FILE_NAME);
+    } else {
+        TraceLog(LOG_WARNING, "Failed to open %s for writing.", PROFILE_TRACE_FILE_NAME);
     }
 }
+#endif